@@ -0,0 +1,298 @@
+#ifndef ATTENTION_H_
+#define ATTENTION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "gemm.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+// Fused scaled dot product attention, softmax(scale * q * k^T) * v, for q
+// [batch, q_len, dim], k [batch, kv_len, dim] and v [batch, kv_len, v_dim].
+//
+// A task takes kAttentionTileQ queries and walks the keys kAttentionTileK at
+// a time, so it only ever holds one tile of scores next to the q, k and v
+// tiles, which together stay in L2. The softmax is online: each query row
+// keeps the running max and sum of its exponentials, and its output is
+// rescaled whenever the max grows. The backward pass recomputes the score
+// tiles from each row's log-sum-exp, so no buffer of size q_len * kv_len is
+// ever allocated. Tile products go through Gemm, which runs on the calling
+// thread inside the parallel loops over tiles.
+//
+// With causal masking query i sees keys j <= i + kv_len - q_len, so the last
+// query sees every key.
+
+const int64_t kAttentionTileQ = 64;
+const int64_t kAttentionTileK = 64;
+
+struct AttentionParams {
+  int64_t batch;
+  int64_t q_len, kv_len;
+  int64_t dim, v_dim;
+  float scale;
+  bool causal;
+
+  // Number of keys query i sees.
+  int64_t NumKeys(int64_t i) const {
+    if (!causal) return kv_len;
+    return std::min(kv_len, std::max<int64_t>(i + kv_len - q_len + 1, 0));
+  }
+
+  int64_t NumQueryTiles() const {
+    return (q_len + kAttentionTileQ - 1) / kAttentionTileQ;
+  }
+
+  int64_t NumKeyTiles() const {
+    return (kv_len + kAttentionTileK - 1) / kAttentionTileK;
+  }
+};
+
+// scores[r * cols + c] = scale * q[q0 + r] . k[k0 + c] for the first valid[r]
+// columns of each row, the keys query q0 + r sees. The other columns are
+// left unscaled.
+inline void AttentionScores(const AttentionParams& p, const float* q,
+                            const float* k, int64_t q0, int64_t rows,
+                            int64_t k0, int64_t cols, float* scores,
+                            int64_t* valid) {
+  Gemm(false, true, rows, cols, p.dim, q + q0 * p.dim, k + k0 * p.dim,
+       scores);
+  for (int64_t r = 0; r < rows; r++) {
+    valid[r] = std::min(cols, std::max<int64_t>(p.NumKeys(q0 + r) - k0, 0));
+    SimdScale(scores + r * cols, p.scale, valid[r]);
+  }
+}
+
+// Folds a scores tile into the running max and sum of each row and leaves
+// exp(score - max) in its place, zero past the valid columns. correction[r]
+// is what earlier terms of row r must be scaled by for the new max.
+inline void AttentionOnlineSoftmax(int64_t rows, int64_t cols,
+                                   const int64_t* valid, float* scores,
+                                   float* row_max, float* row_sum,
+                                   float* correction) {
+  for (int64_t r = 0; r < rows; r++) {
+    float* s = scores + r * cols;
+    correction[r] = 1.0f;
+    if (valid[r] > 0) {
+      float new_max = std::max(row_max[r], SimdMax(s, valid[r]));
+      correction[r] = std::exp(row_max[r] - new_max);
+      row_sum[r] = row_sum[r] * correction[r] +
+                   SimdExp(s, new_max, valid[r], s);
+      row_max[r] = new_max;
+    }
+    std::fill(s + valid[r], s + cols, 0.0f);
+  }
+}
+
+// out is [batch, q_len, v_dim]. A query that sees no keys gets zeros.
+inline void AttentionForward(const float* q, const float* k, const float* v,
+                             const AttentionParams& p, float* out) {
+  const int64_t tiles = p.NumQueryTiles();
+  ThreadPool::Global()->ParallelFor(p.batch * tiles, [&](int64_t task) {
+    const int64_t n = task / tiles;
+    const int64_t q0 = (task % tiles) * kAttentionTileQ;
+    const int64_t rows = std::min(kAttentionTileQ, p.q_len - q0);
+    const float* q_n = q + n * p.q_len * p.dim;
+    const float* k_n = k + n * p.kv_len * p.dim;
+    const float* v_n = v + n * p.kv_len * p.v_dim;
+    float* out_tile = out + (n * p.q_len + q0) * p.v_dim;
+
+    static thread_local std::vector<float> scores;
+    static thread_local std::vector<float> partial;
+    scores.resize(kAttentionTileQ * kAttentionTileK);
+    partial.resize(kAttentionTileQ * p.v_dim);
+    int64_t valid[kAttentionTileQ];
+    float row_max[kAttentionTileQ];
+    float row_sum[kAttentionTileQ];
+    float correction[kAttentionTileQ];
+    std::fill(row_max, row_max + rows,
+              -std::numeric_limits<float>::infinity());
+    std::fill(row_sum, row_sum + rows, 0.0f);
+    std::fill(out_tile, out_tile + rows * p.v_dim, 0.0f);
+
+    const int64_t k_end = p.NumKeys(q0 + rows - 1);
+    for (int64_t k0 = 0; k0 < k_end; k0 += kAttentionTileK) {
+      const int64_t cols = std::min(kAttentionTileK, p.kv_len - k0);
+      AttentionScores(p, q_n, k_n, q0, rows, k0, cols, scores.data(), valid);
+      AttentionOnlineSoftmax(rows, cols, valid, scores.data(), row_max,
+                             row_sum, correction);
+      Gemm(false, false, rows, p.v_dim, cols, scores.data(),
+           v_n + k0 * p.v_dim, partial.data());
+      for (int64_t r = 0; r < rows; r++) {
+        float* dst = out_tile + r * p.v_dim;
+        SimdScale(dst, correction[r], p.v_dim);
+        SimdAccumulate(dst, partial.data() + r * p.v_dim, p.v_dim);
+      }
+    }
+
+    for (int64_t r = 0; r < rows; r++) {
+      if (row_sum[r] > 0) {
+        SimdScale(out_tile + r * p.v_dim, 1.0f / row_sum[r], p.v_dim);
+      }
+    }
+  });
+}
+
+// The two per-query terms of the backward pass, stats[i] = {lse, delta}
+// with lse the log-sum-exp of the row's scores (-inf for a query that sees
+// no keys) and delta = dout[i] . out[i]. stats is [batch, q_len, 2].
+inline void AttentionStats(const float* dout, const float* out,
+                           const float* q, const float* k,
+                           const AttentionParams& p, float* stats) {
+  const int64_t tiles = p.NumQueryTiles();
+  ThreadPool::Global()->ParallelFor(p.batch * tiles, [&](int64_t task) {
+    const int64_t n = task / tiles;
+    const int64_t q0 = (task % tiles) * kAttentionTileQ;
+    const int64_t rows = std::min(kAttentionTileQ, p.q_len - q0);
+    const float* q_n = q + n * p.q_len * p.dim;
+    const float* k_n = k + n * p.kv_len * p.dim;
+
+    static thread_local std::vector<float> scores;
+    scores.resize(kAttentionTileQ * kAttentionTileK);
+    int64_t valid[kAttentionTileQ];
+    float row_max[kAttentionTileQ];
+    float row_sum[kAttentionTileQ];
+    float correction[kAttentionTileQ];
+    std::fill(row_max, row_max + rows,
+              -std::numeric_limits<float>::infinity());
+    std::fill(row_sum, row_sum + rows, 0.0f);
+
+    const int64_t k_end = p.NumKeys(q0 + rows - 1);
+    for (int64_t k0 = 0; k0 < k_end; k0 += kAttentionTileK) {
+      const int64_t cols = std::min(kAttentionTileK, p.kv_len - k0);
+      AttentionScores(p, q_n, k_n, q0, rows, k0, cols, scores.data(), valid);
+      AttentionOnlineSoftmax(rows, cols, valid, scores.data(), row_max,
+                             row_sum, correction);
+    }
+
+    for (int64_t r = 0; r < rows; r++) {
+      const int64_t i = n * p.q_len + q0 + r;
+      stats[2 * i] = row_max[r] + std::log(row_sum[r]);
+      stats[2 * i + 1] = SimdDot(dout + i * p.v_dim, out + i * p.v_dim,
+                                 p.v_dim);
+    }
+  });
+}
+
+// Recomputes the softmax of a scores tile from the row log-sum-exp into
+// probs, and, unless dscores is null, the scores' gradient
+// probs * (dout * v^T - delta). Both are zero past the valid columns.
+inline void AttentionTileGrad(const AttentionParams& p, const float* q,
+                              const float* k, const float* v,
+                              const float* dout, const float* stats,
+                              int64_t q0, int64_t rows, int64_t k0,
+                              int64_t cols, float* probs, float* dscores) {
+  int64_t valid[kAttentionTileQ];
+  AttentionScores(p, q, k, q0, rows, k0, cols, probs, valid);
+  for (int64_t r = 0; r < rows; r++) {
+    float* s = probs + r * cols;
+    SimdExp(s, stats[2 * (q0 + r)], valid[r], s);
+    std::fill(s + valid[r], s + cols, 0.0f);
+  }
+  if (dscores == nullptr) return;
+
+  Gemm(false, true, rows, cols, p.v_dim, dout + q0 * p.v_dim,
+       v + k0 * p.v_dim, dscores);
+  for (int64_t r = 0; r < rows; r++) {
+    const float delta = stats[2 * (q0 + r) + 1];
+    for (int64_t c = 0; c < cols; c++) {
+      const int64_t idx = r * cols + c;
+      dscores[idx] = probs[idx] * (dscores[idx] - delta);
+    }
+  }
+}
+
+// dq is [batch, q_len, dim]; each task owns a tile of queries.
+inline void AttentionBackwardQuery(const float* dout, const float* q,
+                                   const float* k, const float* v,
+                                   const float* stats,
+                                   const AttentionParams& p, float* dq) {
+  const int64_t tiles = p.NumQueryTiles();
+  ThreadPool::Global()->ParallelFor(p.batch * tiles, [&](int64_t task) {
+    const int64_t n = task / tiles;
+    const int64_t q0 = (task % tiles) * kAttentionTileQ;
+    const int64_t rows = std::min(kAttentionTileQ, p.q_len - q0);
+    const float* k_n = k + n * p.kv_len * p.dim;
+    float* dq_tile = dq + (n * p.q_len + q0) * p.dim;
+
+    static thread_local std::vector<float> probs;
+    static thread_local std::vector<float> dscores;
+    static thread_local std::vector<float> partial;
+    probs.resize(kAttentionTileQ * kAttentionTileK);
+    dscores.resize(kAttentionTileQ * kAttentionTileK);
+    partial.resize(kAttentionTileQ * p.dim);
+    std::fill(dq_tile, dq_tile + rows * p.dim, 0.0f);
+
+    const int64_t k_end = p.NumKeys(q0 + rows - 1);
+    for (int64_t k0 = 0; k0 < k_end; k0 += kAttentionTileK) {
+      const int64_t cols = std::min(kAttentionTileK, p.kv_len - k0);
+      AttentionTileGrad(p, q + n * p.q_len * p.dim, k_n,
+                        v + n * p.kv_len * p.v_dim,
+                        dout + n * p.q_len * p.v_dim, stats + n * p.q_len * 2,
+                        q0, rows, k0, cols, probs.data(), dscores.data());
+      Gemm(false, false, rows, p.dim, cols, dscores.data(), k_n + k0 * p.dim,
+           partial.data());
+      SimdAccumulate(dq_tile, partial.data(), rows * p.dim);
+    }
+    SimdScale(dq_tile, p.scale, rows * p.dim);
+  });
+}
+
+// dk is [batch, kv_len, dim] and dv is [batch, kv_len, v_dim], either may be
+// null; each task owns a tile of keys.
+inline void AttentionBackwardKeyValue(const float* dout, const float* q,
+                                      const float* k, const float* v,
+                                      const float* stats,
+                                      const AttentionParams& p, float* dk,
+                                      float* dv) {
+  const int64_t tiles = p.NumKeyTiles();
+  ThreadPool::Global()->ParallelFor(p.batch * tiles, [&](int64_t task) {
+    const int64_t n = task / tiles;
+    const int64_t k0 = (task % tiles) * kAttentionTileK;
+    const int64_t cols = std::min(kAttentionTileK, p.kv_len - k0);
+    const float* q_n = q + n * p.q_len * p.dim;
+    const float* dout_n = dout + n * p.q_len * p.v_dim;
+
+    static thread_local std::vector<float> probs;
+    static thread_local std::vector<float> dscores;
+    static thread_local std::vector<float> partial;
+    probs.resize(kAttentionTileQ * kAttentionTileK);
+    dscores.resize(kAttentionTileQ * kAttentionTileK);
+    partial.resize(kAttentionTileK * std::max(p.dim, p.v_dim));
+    float* dk_tile = dk == nullptr ? nullptr : dk + (n * p.kv_len + k0) * p.dim;
+    float* dv_tile =
+        dv == nullptr ? nullptr : dv + (n * p.kv_len + k0) * p.v_dim;
+    if (dk_tile != nullptr) std::fill(dk_tile, dk_tile + cols * p.dim, 0.0f);
+    if (dv_tile != nullptr) {
+      std::fill(dv_tile, dv_tile + cols * p.v_dim, 0.0f);
+    }
+
+    // Queries before q_begin see none of this tile's keys.
+    int64_t q_begin = 0;
+    if (p.causal) q_begin = std::max<int64_t>(k0 - p.kv_len + p.q_len, 0);
+    q_begin -= q_begin % kAttentionTileQ;
+    for (int64_t q0 = q_begin; q0 < p.q_len; q0 += kAttentionTileQ) {
+      const int64_t rows = std::min(kAttentionTileQ, p.q_len - q0);
+      AttentionTileGrad(p, q_n, k + n * p.kv_len * p.dim,
+                        v + n * p.kv_len * p.v_dim, dout_n,
+                        stats + n * p.q_len * 2, q0, rows, k0, cols,
+                        probs.data(),
+                        dk_tile == nullptr ? nullptr : dscores.data());
+      if (dv_tile != nullptr) {
+        Gemm(true, false, cols, p.v_dim, rows, probs.data(),
+             dout_n + q0 * p.v_dim, partial.data());
+        SimdAccumulate(dv_tile, partial.data(), cols * p.v_dim);
+      }
+      if (dk_tile != nullptr) {
+        Gemm(true, false, cols, p.dim, rows, dscores.data(),
+             q_n + q0 * p.dim, partial.data());
+        SimdAccumulate(dk_tile, partial.data(), cols * p.dim);
+      }
+    }
+    if (dk_tile != nullptr) SimdScale(dk_tile, p.scale, cols * p.dim);
+  });
+}
+
+#endif  // ATTENTION_H_
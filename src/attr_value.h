@@ -0,0 +1,250 @@
+#ifndef ATTR_VALUE_H_
+#define ATTR_VALUE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tensor_shape.h"
+
+// AttrKey is an interned attribute name, comparing two keys is an integer
+// compare. Ops keep their keys in statics so lookups never hash strings.
+class AttrKey {
+public:
+  AttrKey(const std::string& name) : id_(Intern(name)) {}
+
+  AttrKey(const char* name) : id_(Intern(name)) {}
+
+  int id() const { return id_; }
+
+  std::string name() const {
+    std::lock_guard<std::mutex> lock(Mutex());
+    return Names()[id_];
+  }
+
+  bool operator==(const AttrKey& rhs) const { return id_ == rhs.id_; }
+
+private:
+  static std::mutex& Mutex() {
+    static std::mutex mu;
+    return mu;
+  }
+
+  static std::vector<std::string>& Names() {
+    static std::vector<std::string>* names = new std::vector<std::string>();
+    return *names;
+  }
+
+  static int Intern(const std::string& name) {
+    static std::unordered_map<std::string, int>* ids =
+        new std::unordered_map<std::string, int>();
+    std::lock_guard<std::mutex> lock(Mutex());
+    auto iter = ids->find(name);
+    if (iter != ids->end()) return iter->second;
+    int id = Names().size();
+    Names().push_back(name);
+    (*ids)[name] = id;
+    return id;
+  }
+
+  int id_;
+};
+
+// AttrValue holds one typed attribute. Values are stored exactly as set,
+// numeric values can be read back as any numeric type.
+class AttrValue {
+public:
+  enum class Type {
+    kNone,
+    kBool,
+    kInt,
+    kFloat,
+    kDouble,
+    kString,
+    kIntList,
+    kShape
+  };
+
+  AttrValue() : type_(Type::kNone), int_(0) {}
+  AttrValue(bool val) : type_(Type::kBool), int_(val) {}
+  AttrValue(int val) : type_(Type::kInt), int_(val) {}
+  AttrValue(int64_t val) : type_(Type::kInt), int_(val) {}
+  AttrValue(float val) : type_(Type::kFloat), float_(val) {}
+  AttrValue(double val) : type_(Type::kDouble), double_(val) {}
+  AttrValue(const char* val) : type_(Type::kString), int_(0), str_(val) {}
+  AttrValue(const std::string& val)
+      : type_(Type::kString), int_(0), str_(val) {}
+  AttrValue(const std::vector<int>& val)
+      : type_(Type::kIntList), int_(0), list_(val.begin(), val.end()) {}
+  AttrValue(const std::vector<int64_t>& val)
+      : type_(Type::kIntList), int_(0), list_(val) {}
+  AttrValue(const TensorShape& val)
+      : type_(Type::kShape), int_(0), shape_(val) {}
+
+  Type type() const { return type_; }
+
+  bool Get(bool& val) const {
+    if (!IsNumeric()) return false;
+    val = AsDouble() != 0;
+    return true;
+  }
+
+  bool Get(int& val) const {
+    if (!IsNumeric()) return false;
+    val = type_ == Type::kInt || type_ == Type::kBool ?
+        static_cast<int>(int_) : static_cast<int>(AsDouble());
+    return true;
+  }
+
+  bool Get(int64_t& val) const {
+    if (!IsNumeric()) return false;
+    val = type_ == Type::kInt || type_ == Type::kBool ?
+        int_ : static_cast<int64_t>(AsDouble());
+    return true;
+  }
+
+  bool Get(float& val) const {
+    if (!IsNumeric()) return false;
+    val = type_ == Type::kFloat ? float_ : static_cast<float>(AsDouble());
+    return true;
+  }
+
+  bool Get(double& val) const {
+    if (!IsNumeric()) return false;
+    val = AsDouble();
+    return true;
+  }
+
+  bool Get(std::string& val) const {
+    if (type_ != Type::kString) return false;
+    val = str_;
+    return true;
+  }
+
+  bool Get(std::vector<int>& val) const {
+    if (type_ != Type::kIntList) return false;
+    val.assign(list_.begin(), list_.end());
+    return true;
+  }
+
+  bool Get(std::vector<int64_t>& val) const {
+    if (type_ != Type::kIntList) return false;
+    val = list_;
+    return true;
+  }
+
+  bool Get(TensorShape& val) const {
+    if (type_ != Type::kShape) return false;
+    val = shape_;
+    return true;
+  }
+
+  bool operator==(const AttrValue& rhs) const {
+    if (type_ != rhs.type_) return false;
+    switch (type_) {
+      case Type::kNone: return true;
+      case Type::kBool:
+      case Type::kInt: return int_ == rhs.int_;
+      case Type::kFloat: return float_ == rhs.float_;
+      case Type::kDouble: return double_ == rhs.double_;
+      case Type::kString: return str_ == rhs.str_;
+      case Type::kIntList: return list_ == rhs.list_;
+      case Type::kShape: return shape_ == rhs.shape_;
+    }
+    return false;
+  }
+
+  bool operator!=(const AttrValue& rhs) const { return !(*this == rhs); }
+
+  size_t Hash() const {
+    size_t h = static_cast<size_t>(type_);
+    auto mix = [&h](size_t v) {
+      h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    };
+    switch (type_) {
+      case Type::kNone: break;
+      case Type::kBool:
+      case Type::kInt: mix(std::hash<int64_t>()(int_)); break;
+      case Type::kFloat: mix(std::hash<float>()(float_)); break;
+      case Type::kDouble: mix(std::hash<double>()(double_)); break;
+      case Type::kString: mix(std::hash<std::string>()(str_)); break;
+      case Type::kIntList:
+        for (int64_t v : list_) mix(std::hash<int64_t>()(v));
+        break;
+      case Type::kShape: mix(shape_.Hash()); break;
+    }
+    return h;
+  }
+
+private:
+  bool IsNumeric() const {
+    return type_ == Type::kBool || type_ == Type::kInt ||
+           type_ == Type::kFloat || type_ == Type::kDouble;
+  }
+
+  double AsDouble() const {
+    switch (type_) {
+      case Type::kFloat: return float_;
+      case Type::kDouble: return double_;
+      default: return static_cast<double>(int_);
+    }
+  }
+
+  Type type_;
+  union {
+    int64_t int_;
+    float float_;
+    double double_;
+  };
+  std::string str_;
+  std::vector<int64_t> list_;
+  TensorShape shape_;
+};
+
+// Attributes of a node, kept as a small vector since nodes carry only a
+// handful of them and a linear scan over interned ids beats hashing. Entries
+// are ordered by key id, so maps holding the same attributes compare equal
+// whatever order they were set in.
+class AttrMap {
+public:
+  void Set(const AttrKey& key, const AttrValue& val) {
+    auto iter = attrs_.begin();
+    for (; iter != attrs_.end(); iter++) {
+      if (iter->first == key) {
+        iter->second = val;
+        return;
+      }
+      if (iter->first.id() > key.id()) break;
+    }
+    attrs_.insert(iter, std::make_pair(key, val));
+  }
+
+  const AttrValue* Find(const AttrKey& key) const {
+    for (auto& attr : attrs_) {
+      if (attr.first == key) return &attr.second;
+    }
+    return nullptr;
+  }
+
+  const std::vector<std::pair<AttrKey, AttrValue>>& attrs() const {
+    return attrs_;
+  }
+
+  bool operator==(const AttrMap& rhs) const { return attrs_ == rhs.attrs_; }
+
+  size_t Hash() const {
+    size_t h = attrs_.size();
+    for (auto& attr : attrs_) {
+      h ^= attr.first.id() + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+      h ^= attr.second.Hash() + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return h;
+  }
+
+private:
+  std::vector<std::pair<AttrKey, AttrValue>> attrs_;
+};
+
+#endif  // ATTR_VALUE_H_
@@ -0,0 +1,235 @@
+#ifndef BROADCAST_H_
+#define BROADCAST_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include "half.h"
+#include "tensor_shape.h"
+
+const int kMaxBroadcastDims = TensorShape::kMaxDims;
+
+// NumPy style broadcast of lhs and rhs, dims are aligned from the right and a
+// dim of size 1 stretches to the other side. Adjacent dims that broadcast the
+// same way are merged, so the common cases (same shape, bias over rows)
+// collapse to one or two dims and the innermost loop stays contiguous.
+struct BroadcastPlan {
+  int num_dims;
+  int64_t dims[kMaxBroadcastDims];
+  int64_t lhs_strides[kMaxBroadcastDims];
+  int64_t rhs_strides[kMaxBroadcastDims];
+};
+
+inline bool BroadcastShape(const TensorShape& lhs, const TensorShape& rhs,
+                           TensorShape& out_shape) {
+  int num_dims = std::max(lhs.NumDims(), rhs.NumDims());
+  out_shape = TensorShape();
+  for (int i = 0; i < num_dims; i++) {
+    int l = lhs.NumDims() - num_dims + i;
+    int r = rhs.NumDims() - num_dims + i;
+    int64_t l_dim = l >= 0 ? lhs.DimSize(l) : 1;
+    int64_t r_dim = r >= 0 ? rhs.DimSize(r) : 1;
+    if (l_dim != r_dim && l_dim != 1 && r_dim != 1) {
+      return false;
+    }
+    out_shape.AppendDim(l_dim == 1 ? r_dim : l_dim);
+  }
+  return true;
+}
+
+inline BroadcastPlan MakeBroadcastPlan(const TensorShape& lhs,
+                                       const TensorShape& rhs) {
+  int num_dims = std::max(lhs.NumDims(), rhs.NumDims());
+  assert(num_dims <= kMaxBroadcastDims);
+
+  int64_t dims[kMaxBroadcastDims];
+  int64_t lhs_strides[kMaxBroadcastDims];
+  int64_t rhs_strides[kMaxBroadcastDims];
+  int64_t lhs_stride = 1;
+  int64_t rhs_stride = 1;
+  for (int i = num_dims - 1; i >= 0; i--) {
+    int l = lhs.NumDims() - num_dims + i;
+    int r = rhs.NumDims() - num_dims + i;
+    int64_t l_dim = l >= 0 ? lhs.DimSize(l) : 1;
+    int64_t r_dim = r >= 0 ? rhs.DimSize(r) : 1;
+    assert(l_dim == r_dim || l_dim == 1 || r_dim == 1);
+    dims[i] = l_dim == 1 ? r_dim : l_dim;
+    lhs_strides[i] = l_dim == 1 ? 0 : lhs_stride;
+    rhs_strides[i] = r_dim == 1 ? 0 : rhs_stride;
+    lhs_stride *= l_dim;
+    rhs_stride *= r_dim;
+  }
+
+  // Drop unit dims and merge a dim into its inner neighbour when both inputs
+  // step through them as one contiguous (or one broadcast) range.
+  BroadcastPlan plan;
+  plan.num_dims = 0;
+  for (int i = 0; i < num_dims; i++) {
+    if (dims[i] == 1) continue;
+    int last = plan.num_dims - 1;
+    if (last >= 0 &&
+        plan.lhs_strides[last] == lhs_strides[i] * dims[i] &&
+        plan.rhs_strides[last] == rhs_strides[i] * dims[i]) {
+      plan.dims[last] *= dims[i];
+      plan.lhs_strides[last] = lhs_strides[i];
+      plan.rhs_strides[last] = rhs_strides[i];
+    } else {
+      plan.dims[plan.num_dims] = dims[i];
+      plan.lhs_strides[plan.num_dims] = lhs_strides[i];
+      plan.rhs_strides[plan.num_dims] = rhs_strides[i];
+      plan.num_dims++;
+    }
+  }
+  if (plan.num_dims == 0) {
+    plan.num_dims = 1;
+    plan.dims[0] = 1;
+    plan.lhs_strides[0] = 0;
+    plan.rhs_strides[0] = 0;
+  }
+  return plan;
+}
+
+// Walks the outer dims of a plan, calling fn(lhs_offset, rhs_offset, row)
+// for every innermost row.
+template <typename Fn>
+inline void ForEachBroadcastRow(const BroadcastPlan& plan, Fn fn) {
+  int inner = plan.num_dims - 1;
+  int64_t num_rows = 1;
+  for (int i = 0; i < inner; i++) {
+    num_rows *= plan.dims[i];
+  }
+
+  int64_t index[kMaxBroadcastDims] = {0};
+  int64_t lhs_offset = 0;
+  int64_t rhs_offset = 0;
+  for (int64_t row = 0; row < num_rows; row++) {
+    fn(lhs_offset, rhs_offset, row);
+    for (int d = inner - 1; d >= 0; d--) {
+      index[d]++;
+      lhs_offset += plan.lhs_strides[d];
+      rhs_offset += plan.rhs_strides[d];
+      if (index[d] < plan.dims[d]) break;
+      lhs_offset -= plan.lhs_strides[d] * plan.dims[d];
+      rhs_offset -= plan.rhs_strides[d] * plan.dims[d];
+      index[d] = 0;
+    }
+  }
+}
+
+// c[i] = f(a[i], b[i]) for i in [0, n), where a and b hold a single value
+// unless a_vec or b_vec is set.
+template <typename Functor>
+inline void BinaryRow(const float* a, bool a_vec, const float* b, bool b_vec,
+                      float* c, int64_t n, Functor f) {
+  if (a_vec && b_vec) {
+    for (int64_t i = 0; i < n; i++) c[i] = f(a[i], b[i]);
+  } else if (a_vec) {
+    const float b_val = b[0];
+    for (int64_t i = 0; i < n; i++) c[i] = f(a[i], b_val);
+  } else if (b_vec) {
+    const float a_val = a[0];
+    for (int64_t i = 0; i < n; i++) c[i] = f(a_val, b[i]);
+  } else {
+    const float val = f(a[0], b[0]);
+    for (int64_t i = 0; i < n; i++) c[i] = val;
+  }
+}
+
+// The 16 bit types are converted to float in blocks, so the functor runs on
+// floats and the conversions vectorize.
+template <typename T, typename Functor>
+inline void BinaryRow(const T* a, bool a_vec, const T* b, bool b_vec,
+                      T* c, int64_t n, Functor f) {
+  const int64_t kBlock = 256;
+  float a_buf[kBlock];
+  float b_buf[kBlock];
+  float c_buf[kBlock];
+  if (!a_vec) a_buf[0] = a[0];
+  if (!b_vec) b_buf[0] = b[0];
+  for (int64_t i = 0; i < n; i += kBlock) {
+    int64_t len = std::min(kBlock, n - i);
+    if (a_vec) ConvertToFloat(a + i, len, a_buf);
+    if (b_vec) ConvertToFloat(b + i, len, b_buf);
+    BinaryRow(a_buf, a_vec, b_buf, b_vec, c_buf, len, f);
+    ConvertFromFloat(c_buf, len, c + i);
+  }
+}
+
+// out = f(lhs, rhs) with lhs and rhs broadcast to the shape of out.
+template <typename T, typename Functor>
+void BroadcastBinary(const BroadcastPlan& plan,
+                     const T* lhs, const T* rhs, T* out, Functor f) {
+  int inner = plan.num_dims - 1;
+  const int64_t n = plan.dims[inner];
+  const bool lhs_vec = plan.lhs_strides[inner] != 0;
+  const bool rhs_vec = plan.rhs_strides[inner] != 0;
+
+  ForEachBroadcastRow(plan, [&](int64_t lhs_offset, int64_t rhs_offset,
+                                int64_t row) {
+    BinaryRow(lhs + lhs_offset, lhs_vec, rhs + rhs_offset, rhs_vec,
+              out + row * n, n, f);
+  });
+}
+
+// Copies in (of in_shape) into out, broadcasting it to out_shape.
+inline void BroadcastTo(const float* in, const TensorShape& in_shape,
+                        float* out, const TensorShape& out_shape) {
+  BroadcastPlan plan = MakeBroadcastPlan(in_shape, out_shape);
+  int inner = plan.num_dims - 1;
+  const int64_t n = plan.dims[inner];
+  const bool in_vec = plan.lhs_strides[inner] != 0;
+
+  ForEachBroadcastRow(plan, [&](int64_t in_offset, int64_t, int64_t row) {
+    if (in_vec) {
+      memcpy(out + row * n, in + in_offset, n * sizeof(float));
+    } else {
+      const float val = in[in_offset];
+      for (int64_t i = 0; i < n; i++) out[row * n + i] = val;
+    }
+  });
+}
+
+// dst[i] += src[i] for i in [0, n) when out_vec is set, else dst[0] += the
+// sum of src[0, n).
+inline void ReduceRow(const float* src, int64_t n, bool out_vec,
+                      float* dst) {
+  if (out_vec) {
+    for (int64_t i = 0; i < n; i++) dst[i] += src[i];
+  } else {
+    float sum = 0.0;
+    for (int64_t i = 0; i < n; i++) sum += src[i];
+    dst[0] += sum;
+  }
+}
+
+template <typename T>
+inline void ReduceRow(const T* src, int64_t n, bool out_vec, float* dst) {
+  const int64_t kBlock = 256;
+  float buf[kBlock];
+  for (int64_t i = 0; i < n; i += kBlock) {
+    int64_t len = std::min(kBlock, n - i);
+    ConvertToFloat(src + i, len, buf);
+    ReduceRow(buf, len, out_vec, out_vec ? dst + i : dst);
+  }
+}
+
+// Sums in (of in_shape) over the dims that out_shape broadcasts along, the
+// inverse of BroadcastTo. Used by the gradients of the broadcasting ops.
+// The sums are fp32 whatever the type of in.
+template <typename T>
+inline void ReduceToShape(const T* in, const TensorShape& in_shape,
+                          float* out, const TensorShape& out_shape) {
+  BroadcastPlan plan = MakeBroadcastPlan(out_shape, in_shape);
+  int inner = plan.num_dims - 1;
+  const int64_t n = plan.dims[inner];
+  const bool out_vec = plan.lhs_strides[inner] != 0;
+
+  memset(out, 0, out_shape.NumElements() * sizeof(float));
+  ForEachBroadcastRow(plan, [&](int64_t out_offset, int64_t in_offset,
+                                int64_t) {
+    ReduceRow(in + in_offset, n, out_vec, out + out_offset);
+  });
+}
+
+#endif  // BROADCAST_H_
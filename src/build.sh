@@ -1 +1,2 @@
-g++ -std=c++11 main.cc tensor.cc operator.cc node.cc op.cc -o main
+g++ -std=c++11 -O3 -march=native -pthread main.cc tensor.cc operator.cc node.cc op.cc -o main
+g++ -std=c++11 -O3 -march=native -pthread op_test.cc tensor.cc operator.cc node.cc op.cc -o op_test
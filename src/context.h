@@ -1,6 +1,33 @@
 #ifndef CONTEXT_H_
 #define CONTEXT_H_
 
+enum class DeviceType {
+  kCPU,
+  kGPU
+};
+
+class Context {
+ public:
+  Context(DeviceType device_type = DeviceType::kCPU, int device_id = 0)
+      : device_type_(device_type), device_id_(device_id) {}
+
+  static Context cpu(int device_id = 0) {
+    return Context(DeviceType::kCPU, device_id);
+  }
+
+  static Context gpu(int device_id = 0) {
+    return Context(DeviceType::kGPU, device_id);
+  }
+
+  DeviceType device_type() const { return device_type_; }
+
+  int device_id() const { return device_id_; }
+
+ private:
+  DeviceType device_type_;
+  int device_id_;
+};
+
 class CPUContext {
  public:
   explicit CPUContext(int device_id = 0) : device_id_(device_id) {};
@@ -0,0 +1,417 @@
+#ifndef CONV_H_
+#define CONV_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "gemm.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+// 2-D convolution kernels. Data is NCHW with OIHW filters, or NHWC with HWIO
+// filters, the pairings that make the filter a plain matrix for the GEMM.
+//
+// The general path lowers the convolution to GEMM with im2col. The patch
+// matrix is built for a tile of output pixels at a time, at most
+// kConvColElements floats, so its size does not grow with the image. 3x3
+// stride 1 convolutions without dilation run Winograd F(4x4, 3x3), or
+// F(2x2, 3x3) for small outputs, which needs 4x or 2.25x fewer
+// multiplications.
+
+const int64_t kConvColElements = 1 << 20;
+
+struct Conv2DParams {
+  bool nhwc;
+  int64_t batch, in_c, in_h, in_w;
+  int64_t out_c, out_h, out_w;
+  int64_t kernel_h, kernel_w;
+  int64_t stride_h, stride_w;
+  int64_t pad_h, pad_w;
+  int64_t dilation_h, dilation_w;
+
+  // Patch length, ordered (kh, kw, c) for NHWC and (c, kh, kw) for NCHW.
+  int64_t PatchSize() const { return kernel_h * kernel_w * in_c; }
+
+  int64_t NumPixels() const { return batch * out_h * out_w; }
+
+  // Output pixels per im2col tile.
+  int64_t TilePixels() const {
+    return std::max<int64_t>(1, kConvColElements / PatchSize());
+  }
+};
+
+// Rows [q0, q0 + t) of the [pixels, PatchSize()] patch matrix of NHWC x.
+// Every (kh, kw) step copies in_c contiguous channels.
+inline void Im2ColRows(const float* x, const Conv2DParams& p, int64_t q0,
+                       int64_t t, float* col) {
+  const int64_t k = p.PatchSize();
+  ThreadPool::Global()->ParallelFor(t, [&](int64_t j) {
+    int64_t q = q0 + j;
+    int64_t n = q / (p.out_h * p.out_w);
+    int64_t oh = q / p.out_w % p.out_h;
+    int64_t ow = q % p.out_w;
+    float* dst = col + j * k;
+    for (int64_t kh = 0; kh < p.kernel_h; kh++) {
+      int64_t ih = oh * p.stride_h - p.pad_h + kh * p.dilation_h;
+      for (int64_t kw = 0; kw < p.kernel_w; kw++) {
+        int64_t iw = ow * p.stride_w - p.pad_w + kw * p.dilation_w;
+        if (ih < 0 || ih >= p.in_h || iw < 0 || iw >= p.in_w) {
+          std::fill(dst, dst + p.in_c, 0.0f);
+        } else {
+          memcpy(dst, x + ((n * p.in_h + ih) * p.in_w + iw) * p.in_c,
+                 p.in_c * sizeof(float));
+        }
+        dst += p.in_c;
+      }
+    }
+  });
+}
+
+// Adds rows [q0, q0 + t) of a patch matrix back into NHWC dx. Patches of
+// different images never overlap, so images are summed in parallel.
+inline void Col2ImRows(const float* col, const Conv2DParams& p, int64_t q0,
+                       int64_t t, float* dx) {
+  const int64_t k = p.PatchSize();
+  const int64_t pixels = p.out_h * p.out_w;
+  const int64_t first = q0 / pixels;
+  const int64_t last = (q0 + t - 1) / pixels;
+  ThreadPool::Global()->ParallelFor(last - first + 1, [&](int64_t i) {
+    int64_t n = first + i;
+    int64_t begin = std::max(q0, n * pixels);
+    int64_t end = std::min(q0 + t, (n + 1) * pixels);
+    for (int64_t q = begin; q < end; q++) {
+      int64_t oh = q / p.out_w % p.out_h;
+      int64_t ow = q % p.out_w;
+      const float* src = col + (q - q0) * k;
+      for (int64_t kh = 0; kh < p.kernel_h; kh++) {
+        int64_t ih = oh * p.stride_h - p.pad_h + kh * p.dilation_h;
+        for (int64_t kw = 0; kw < p.kernel_w; kw++) {
+          int64_t iw = ow * p.stride_w - p.pad_w + kw * p.dilation_w;
+          if (ih >= 0 && ih < p.in_h && iw >= 0 && iw < p.in_w) {
+            SimdAccumulate(dx + ((n * p.in_h + ih) * p.in_w + iw) * p.in_c,
+                           src, p.in_c);
+          }
+          src += p.in_c;
+        }
+      }
+    }
+  });
+}
+
+// Cols [q0, q0 + t) of the [PatchSize(), pixels] patch matrix of NCHW x,
+// stored as a [PatchSize(), t] matrix.
+inline void Im2ColCols(const float* x, const Conv2DParams& p, int64_t q0,
+                       int64_t t, float* col) {
+  ThreadPool::Global()->ParallelFor(p.PatchSize(), [&](int64_t r) {
+    int64_t c = r / (p.kernel_h * p.kernel_w);
+    int64_t kh = r / p.kernel_w % p.kernel_h;
+    int64_t kw = r % p.kernel_w;
+    float* dst = col + r * t;
+    for (int64_t j = 0; j < t; j++) {
+      int64_t q = q0 + j;
+      int64_t n = q / (p.out_h * p.out_w);
+      int64_t ih = q / p.out_w % p.out_h * p.stride_h - p.pad_h +
+                   kh * p.dilation_h;
+      int64_t iw = q % p.out_w * p.stride_w - p.pad_w + kw * p.dilation_w;
+      dst[j] = ih < 0 || ih >= p.in_h || iw < 0 || iw >= p.in_w ? 0.0f :
+          x[((n * p.in_c + c) * p.in_h + ih) * p.in_w + iw];
+    }
+  });
+}
+
+// Adds a [PatchSize(), t] patch matrix back into NCHW dx. The rows of one
+// channel only touch that channel, so channels are summed in parallel.
+inline void Col2ImCols(const float* col, const Conv2DParams& p, int64_t q0,
+                       int64_t t, float* dx) {
+  const int64_t window = p.kernel_h * p.kernel_w;
+  ThreadPool::Global()->ParallelFor(p.in_c, [&](int64_t c) {
+    for (int64_t r = c * window; r < (c + 1) * window; r++) {
+      int64_t kh = r / p.kernel_w % p.kernel_h;
+      int64_t kw = r % p.kernel_w;
+      const float* src = col + r * t;
+      for (int64_t j = 0; j < t; j++) {
+        int64_t q = q0 + j;
+        int64_t n = q / (p.out_h * p.out_w);
+        int64_t ih = q / p.out_w % p.out_h * p.stride_h - p.pad_h +
+                     kh * p.dilation_h;
+        int64_t iw = q % p.out_w * p.stride_w - p.pad_w + kw * p.dilation_w;
+        if (ih >= 0 && ih < p.in_h && iw >= 0 && iw < p.in_w) {
+          dx[((n * p.in_c + c) * p.in_h + ih) * p.in_w + iw] += src[j];
+        }
+      }
+    }
+  });
+}
+
+// Moves pixels [q0, q0 + t) of NCHW y to or from a [out_c, t] matrix.
+inline void GatherPixels(const float* y, const Conv2DParams& p, int64_t q0,
+                         int64_t t, float* tile) {
+  const int64_t pixels = p.out_h * p.out_w;
+  ThreadPool::Global()->ParallelFor(p.out_c, [&](int64_t c) {
+    for (int64_t q = q0; q < q0 + t;) {
+      int64_t n = q / pixels;
+      int64_t len = std::min(q0 + t, (n + 1) * pixels) - q;
+      const float* src = y + (n * p.out_c + c) * pixels + q % pixels;
+      memcpy(tile + c * t + (q - q0), src, len * sizeof(float));
+      q += len;
+    }
+  });
+}
+
+inline void ScatterPixels(const float* tile, const Conv2DParams& p,
+                          int64_t q0, int64_t t, float* y) {
+  const int64_t pixels = p.out_h * p.out_w;
+  ThreadPool::Global()->ParallelFor(p.out_c, [&](int64_t c) {
+    for (int64_t q = q0; q < q0 + t;) {
+      int64_t n = q / pixels;
+      int64_t len = std::min(q0 + t, (n + 1) * pixels) - q;
+      float* dst = y + (n * p.out_c + c) * pixels + q % pixels;
+      memcpy(dst, tile + c * t + (q - q0), len * sizeof(float));
+      q += len;
+    }
+  });
+}
+
+inline bool UseWinograd(const Conv2DParams& p) {
+  return p.kernel_h == 3 && p.kernel_w == 3 && p.stride_h == 1 &&
+         p.stride_w == 1 && p.dilation_h == 1 && p.dilation_w == 1;
+}
+
+// Winograd F(m x m, 3 x 3): y = A^T [(G g G^T) . (B^T d B)] A over input
+// tiles d of a x a = (m + 2) x (m + 2) that step by m.
+struct WinogradTransform {
+  int m;
+  int a;
+  const float* bt;  // a x a
+  const float* g;   // a x 3
+  const float* at;  // m x a
+};
+
+inline WinogradTransform WinogradF2x3() {
+  static const float bt[] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1
+  };
+  static const float g[] = {
+    1,    0,    0,
+    0.5,  0.5,  0.5,
+    0.5, -0.5,  0.5,
+    0,    0,    1
+  };
+  static const float at[] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1
+  };
+  return WinogradTransform{2, 4, bt, g, at};
+}
+
+inline WinogradTransform WinogradF4x3() {
+  static const float bt[] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1
+  };
+  static const float g[] = {
+    1.0f / 4,   0,          0,
+    -1.0f / 6,  -1.0f / 6,  -1.0f / 6,
+    -1.0f / 6,  1.0f / 6,   -1.0f / 6,
+    1.0f / 24,  1.0f / 12,  1.0f / 6,
+    1.0f / 24,  -1.0f / 12, 1.0f / 6,
+    0,          0,          1
+  };
+  static const float at[] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1
+  };
+  return WinogradTransform{4, 6, bt, g, at};
+}
+
+// out (rows x rows) = l (rows x cols) * x (cols x cols) * l^T.
+inline void WinogradSandwich(const float* l, int rows, int cols,
+                             const float* x, float* out) {
+  float tmp[6 * 6];
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      float sum = 0;
+      for (int k = 0; k < cols; k++) sum += l[i * cols + k] * x[k * cols + j];
+      tmp[i * cols + j] = sum;
+    }
+  }
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < rows; j++) {
+      float sum = 0;
+      for (int k = 0; k < cols; k++) sum += tmp[i * cols + k] * l[j * cols + k];
+      out[i * rows + j] = sum;
+    }
+  }
+}
+
+// Forward 3x3 stride 1 convolution. Filters are transformed once, then
+// chunks of tiles go through input transform, one [out_c, in_c] x
+// [in_c, tiles] GEMM per transform point, and output transform.
+inline void WinogradConv2D(const float* x, const float* w,
+                           const Conv2DParams& p, float* y) {
+  const WinogradTransform wt = std::min(p.out_h, p.out_w) >= 8 ?
+      WinogradF4x3() : WinogradF2x3();
+  const int m = wt.m;
+  const int a = wt.a;
+  const int points = a * a;
+  const int64_t tiles_h = (p.out_h + m - 1) / m;
+  const int64_t tiles_w = (p.out_w + m - 1) / m;
+  const int64_t num_tiles = p.batch * tiles_h * tiles_w;
+  ThreadPool* pool = ThreadPool::Global();
+
+  auto x_at = [&](int64_t n, int64_t c, int64_t h, int64_t v) {
+    if (h < 0 || h >= p.in_h || v < 0 || v >= p.in_w) return 0.0f;
+    return p.nhwc ? x[((n * p.in_h + h) * p.in_w + v) * p.in_c + c] :
+                    x[((n * p.in_c + c) * p.in_h + h) * p.in_w + v];
+  };
+
+  // u[point][o][c]
+  std::vector<float> u(points * p.out_c * p.in_c);
+  pool->ParallelFor(p.out_c, [&](int64_t o) {
+    float g[9], ug[6 * 6];
+    for (int64_t c = 0; c < p.in_c; c++) {
+      for (int k = 0; k < 9; k++) {
+        g[k] = p.nhwc ? w[(k * p.in_c + c) * p.out_c + o] :
+                        w[(o * p.in_c + c) * 9 + k];
+      }
+      WinogradSandwich(wt.g, a, 3, g, ug);
+      for (int e = 0; e < points; e++) {
+        u[(e * p.out_c + o) * p.in_c + c] = ug[e];
+      }
+    }
+  });
+
+  const int64_t chunk = std::max<int64_t>(
+      1, kConvColElements / (points * std::max(p.in_c, p.out_c)));
+  std::vector<float> v(points * p.in_c * std::min(chunk, num_tiles));
+  std::vector<float> prod(points * p.out_c * std::min(chunk, num_tiles));
+  for (int64_t t0 = 0; t0 < num_tiles; t0 += chunk) {
+    const int64_t t = std::min(chunk, num_tiles - t0);
+
+    // v[point][c][tile]
+    pool->ParallelFor(t, [&](int64_t j) {
+      int64_t tile = t0 + j;
+      int64_t n = tile / (tiles_h * tiles_w);
+      int64_t h0 = tile / tiles_w % tiles_h * m - p.pad_h;
+      int64_t w0 = tile % tiles_w * m - p.pad_w;
+      float d[6 * 6], vd[6 * 6];
+      for (int64_t c = 0; c < p.in_c; c++) {
+        for (int r = 0; r < a; r++) {
+          for (int s = 0; s < a; s++) d[r * a + s] = x_at(n, c, h0 + r, w0 + s);
+        }
+        WinogradSandwich(wt.bt, a, a, d, vd);
+        for (int e = 0; e < points; e++) {
+          v[(e * p.in_c + c) * t + j] = vd[e];
+        }
+      }
+    });
+
+    // Nested inside the loop over points each GEMM runs on one thread.
+    pool->ParallelFor(points, [&](int64_t e) {
+      Gemm(false, false, p.out_c, t, p.in_c, u.data() + e * p.out_c * p.in_c,
+           v.data() + e * p.in_c * t, prod.data() + e * p.out_c * t);
+    });
+
+    pool->ParallelFor(t, [&](int64_t j) {
+      int64_t tile = t0 + j;
+      int64_t n = tile / (tiles_h * tiles_w);
+      int64_t h0 = tile / tiles_w % tiles_h * m;
+      int64_t w0 = tile % tiles_w * m;
+      float mp[6 * 6], out[4 * 4];
+      for (int64_t o = 0; o < p.out_c; o++) {
+        for (int e = 0; e < points; e++) {
+          mp[e] = prod[(e * p.out_c + o) * t + j];
+        }
+        WinogradSandwich(wt.at, m, a, mp, out);
+        for (int r = 0; r < m && h0 + r < p.out_h; r++) {
+          for (int s = 0; s < m && w0 + s < p.out_w; s++) {
+            int64_t h = h0 + r, c = w0 + s;
+            float* dst = p.nhwc ?
+                y + ((n * p.out_h + h) * p.out_w + c) * p.out_c + o :
+                y + ((n * p.out_c + o) * p.out_h + h) * p.out_w + c;
+            *dst = out[r * m + s];
+          }
+        }
+      }
+    });
+  }
+}
+
+inline void Conv2DForward(const float* x, const float* w,
+                          const Conv2DParams& p, float* y) {
+  if (UseWinograd(p)) {
+    WinogradConv2D(x, w, p, y);
+    return;
+  }
+  const int64_t k = p.PatchSize();
+  const int64_t tile = std::min(p.TilePixels(), p.NumPixels());
+  std::vector<float> col(tile * k);
+  std::vector<float> out(p.nhwc ? 0 : tile * p.out_c);
+  for (int64_t q0 = 0; q0 < p.NumPixels(); q0 += tile) {
+    const int64_t t = std::min(tile, p.NumPixels() - q0);
+    if (p.nhwc) {
+      Im2ColRows(x, p, q0, t, col.data());
+      Gemm(false, false, t, p.out_c, k, col.data(), w, y + q0 * p.out_c);
+    } else {
+      Im2ColCols(x, p, q0, t, col.data());
+      Gemm(false, false, p.out_c, t, k, w, col.data(), out.data());
+      ScatterPixels(out.data(), p, q0, t, y);
+    }
+  }
+}
+
+// dx from dy, tile by tile through the transposed filter and col2im.
+inline void Conv2DBackwardInput(const float* dy, const float* w,
+                                const Conv2DParams& p, float* dx) {
+  const int64_t k = p.PatchSize();
+  const int64_t tile = std::min(p.TilePixels(), p.NumPixels());
+  std::vector<float> col(tile * k);
+  std::vector<float> grad(p.nhwc ? 0 : tile * p.out_c);
+  std::fill(dx, dx + p.batch * p.in_c * p.in_h * p.in_w, 0.0f);
+  for (int64_t q0 = 0; q0 < p.NumPixels(); q0 += tile) {
+    const int64_t t = std::min(tile, p.NumPixels() - q0);
+    if (p.nhwc) {
+      Gemm(false, true, t, k, p.out_c, dy + q0 * p.out_c, w, col.data());
+      Col2ImRows(col.data(), p, q0, t, dx);
+    } else {
+      GatherPixels(dy, p, q0, t, grad.data());
+      Gemm(true, false, k, t, p.out_c, w, grad.data(), col.data());
+      Col2ImCols(col.data(), p, q0, t, dx);
+    }
+  }
+}
+
+// dw summed over the tiles in order, so it does not depend on threads.
+inline void Conv2DBackwardFilter(const float* x, const float* dy,
+                                 const Conv2DParams& p, float* dw) {
+  const int64_t k = p.PatchSize();
+  const int64_t tile = std::min(p.TilePixels(), p.NumPixels());
+  std::vector<float> col(tile * k);
+  std::vector<float> grad(p.nhwc ? 0 : tile * p.out_c);
+  std::vector<float> partial(k * p.out_c);
+  for (int64_t q0 = 0; q0 < p.NumPixels(); q0 += tile) {
+    const int64_t t = std::min(tile, p.NumPixels() - q0);
+    float* dst = q0 == 0 ? dw : partial.data();
+    if (p.nhwc) {
+      Im2ColRows(x, p, q0, t, col.data());
+      Gemm(true, false, k, p.out_c, t, col.data(), dy + q0 * p.out_c, dst);
+    } else {
+      Im2ColCols(x, p, q0, t, col.data());
+      GatherPixels(dy, p, q0, t, grad.data());
+      Gemm(false, true, p.out_c, k, t, grad.data(), col.data(), dst);
+    }
+    if (q0 > 0) SimdAccumulate(dw, partial.data(), k * p.out_c);
+  }
+}
+
+#endif  // CONV_H_
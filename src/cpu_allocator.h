@@ -0,0 +1,474 @@
+#ifndef CPU_ALLOCATOR_H_
+#define CPU_ALLOCATOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "numa.h"
+
+struct AllocatorStats {
+  size_t bytes_in_use = 0;
+  size_t peak_bytes_in_use = 0;
+  size_t bytes_cached = 0;
+  size_t num_allocs = 0;
+  size_t num_frees = 0;
+  size_t num_cache_hits = 0;
+  size_t num_system_allocs = 0;
+  size_t num_system_frees = 0;
+  size_t num_huge_page_allocs = 0;
+};
+
+enum class HugePageMode {
+  kNone,
+  // madvise(MADV_HUGEPAGE), relies on transparent huge pages.
+  kTransparent,
+  // MAP_HUGETLB from the reserved hugetlbfs pool, falls back to kTransparent.
+  kHugeTLB
+};
+
+// CachingAllocator keeps freed blocks in size-class free lists so that the
+// identical allocations made every iteration are served without touching
+// malloc or faulting in fresh pages.
+//
+// Sizes are rounded up to classes of 2^k * {1.25, 1.5, 1.75, 2}, so at most
+// 25% of a block is wasted. Small blocks are first returned to a per-thread
+// cache, large ones go straight to the shared free lists. The thread caches
+// are registered with the allocator, so Trim and GetStats also cover the
+// blocks parked in other threads' caches. Every block is preceded by a 64
+// byte header, which keeps the user pointer 64-byte-aligned.
+//
+// Blocks of kLargeBlock bytes or more are mapped directly, aligned to 2 MB
+// and backed by huge pages when enabled. They are bound to the NUMA node of
+// the allocating thread and cached per node. ThreadPool workers set their
+// node with SetThreadNumaNode, other threads use the node they run on. Both
+// behaviors can be switched at runtime or through the DLSYS_HUGE_PAGES
+// (none, thp, hugetlb) and DLSYS_NUMA (0, 1) environment variables.
+class CachingAllocator {
+public:
+  static constexpr size_t kAlignment = 64;
+  static constexpr int kNumClasses = 1 + (48 - 6) * 4;
+  // Blocks up to this size are kept in the thread-local caches.
+  static constexpr size_t kThreadCacheMaxBlock = 256 << 10;
+  static constexpr int kThreadCacheMaxBlocks = 16;
+  static constexpr size_t kLargeBlock = 4 << 20;
+  static constexpr size_t kHugePageSize = 2 << 20;
+  static constexpr int kMaxNumaNodes = 8;
+
+  static CachingAllocator* Global() {
+    // Leaked on purpose, thread caches may flush into it during exit.
+    static CachingAllocator* allocator = new CachingAllocator();
+    return allocator;
+  }
+
+  void* Allocate(size_t size) {
+    if (size == 0) return nullptr;
+
+    int size_class = SizeToClass(size);
+    size_t class_bytes = ClassSize(size_class);
+    int node = class_bytes >= kLargeBlock ? PreferredNode() : -1;
+    void* block = nullptr;
+    if (class_bytes <= kThreadCacheMaxBlock) {
+      block = GetThreadCache().Pop(size_class);
+    }
+    if (block == nullptr) {
+      std::lock_guard<std::mutex> lock(mu_);
+      std::vector<void*>& free_list = free_lists_[ListIndex(node, size_class)];
+      if (!free_list.empty()) {
+        block = free_list.back();
+        free_list.pop_back();
+        bytes_cached_ -= class_bytes;
+      }
+    }
+
+    if (block != nullptr) {
+      num_cache_hits_++;
+    } else {
+      block = SystemAllocate(class_bytes, node);
+    }
+    Header(block)->size_class = size_class;
+
+    num_allocs_++;
+    size_t in_use = (bytes_in_use_ += class_bytes);
+    size_t peak = peak_bytes_in_use_.load();
+    while (in_use > peak &&
+           !peak_bytes_in_use_.compare_exchange_weak(peak, in_use)) {
+    }
+    return block;
+  }
+
+  void Free(void* block) {
+    if (block == nullptr) return;
+
+    int size_class = Header(block)->size_class;
+    size_t class_bytes = ClassSize(size_class);
+    num_frees_++;
+    bytes_in_use_ -= class_bytes;
+
+    if (class_bytes <= kThreadCacheMaxBlock &&
+        GetThreadCache().Push(size_class, block)) {
+      return;
+    }
+    ReturnToGlobal(size_class, block);
+  }
+
+  // Releases every cached block, of the shared free lists and of all thread
+  // caches, back to the system. Returns the number of bytes released.
+  size_t Trim() {
+    {
+      std::lock_guard<std::mutex> lock(caches_mu_);
+      for (ThreadCache* cache : thread_caches_) {
+        cache->Flush();
+      }
+    }
+    std::vector<void*> blocks;
+    size_t released = 0;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      for (auto& free_list : free_lists_) {
+        blocks.insert(blocks.end(), free_list.begin(), free_list.end());
+        free_list.clear();
+      }
+      released = bytes_cached_;
+      bytes_cached_ = 0;
+    }
+    for (void* block : blocks) {
+      SystemFree(block);
+    }
+    return released;
+  }
+
+  // Caps the bytes held by the shared free lists, blocks freed beyond the
+  // limit are released to the system.
+  void SetCacheLimit(size_t max_cached_bytes) {
+    std::lock_guard<std::mutex> lock(mu_);
+    max_cached_bytes_ = max_cached_bytes;
+  }
+
+  void SetHugePageMode(HugePageMode mode) {
+    huge_page_mode_ = static_cast<int>(mode);
+  }
+
+  HugePageMode GetHugePageMode() const {
+    return static_cast<HugePageMode>(huge_page_mode_.load());
+  }
+
+  // Only affects blocks mapped from now on, cached blocks keep their node.
+  void SetNumaAware(bool numa_aware) {
+    numa_aware_ = numa_aware;
+  }
+
+  bool IsNumaAware() const { return numa_aware_; }
+
+  // Pins the large allocations of the calling thread to the given NUMA node,
+  // -1 restores the default of using the node the thread is running on.
+  static void SetThreadNumaNode(int node) {
+    ThreadNumaNode() = node;
+  }
+
+  static int GetThreadNumaNode() { return ThreadNumaNode(); }
+
+  AllocatorStats GetStats() const {
+    AllocatorStats stats;
+    stats.bytes_in_use = bytes_in_use_;
+    stats.peak_bytes_in_use = peak_bytes_in_use_;
+    {
+      std::lock_guard<std::mutex> lock(caches_mu_);
+      for (ThreadCache* cache : thread_caches_) {
+        stats.bytes_cached += cache->Bytes();
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stats.bytes_cached += bytes_cached_;
+    }
+    stats.num_allocs = num_allocs_;
+    stats.num_frees = num_frees_;
+    stats.num_cache_hits = num_cache_hits_;
+    stats.num_system_allocs = num_system_allocs_;
+    stats.num_system_frees = num_system_frees_;
+    stats.num_huge_page_allocs = num_huge_page_allocs_;
+    return stats;
+  }
+
+  static int SizeToClass(size_t size) {
+    if (size <= 64) return 0;
+    size_t n = size - 1;
+    int k = 63 - __builtin_clzll(n);
+    int j = (n >> (k - 2)) & 3;
+    return 1 + (k - 6) * 4 + j;
+  }
+
+  static size_t ClassSize(int size_class) {
+    if (size_class == 0) return 64;
+    int k = 6 + (size_class - 1) / 4;
+    int j = (size_class - 1) % 4;
+    return (size_t(1) << k) + (j + 1) * (size_t(1) << (k - 2));
+  }
+
+private:
+  struct BlockHeader {
+    int size_class;
+    // -1 for blocks from posix_memalign, otherwise the NUMA node the mapping
+    // is bound to (or kMaxNumaNodes when no binding was requested).
+    int node;
+    void* map_base;
+    size_t map_bytes;
+  };
+
+  // Only its thread pushes and pops, mu_ is taken uncontended except when
+  // another thread trims or reads the stats.
+  class ThreadCache {
+  public:
+    explicit ThreadCache(CachingAllocator* allocator)
+        : allocator_(allocator), free_lists_(kNumClasses), bytes_(0) {
+      std::lock_guard<std::mutex> lock(allocator_->caches_mu_);
+      allocator_->thread_caches_.push_back(this);
+    }
+
+    ~ThreadCache() {
+      {
+        std::lock_guard<std::mutex> lock(allocator_->caches_mu_);
+        std::vector<ThreadCache*>& caches = allocator_->thread_caches_;
+        caches.erase(std::find(caches.begin(), caches.end(), this));
+      }
+      Flush();
+    }
+
+    void* Pop(int size_class) {
+      std::lock_guard<std::mutex> lock(mu_);
+      std::vector<void*>& free_list = free_lists_[size_class];
+      if (free_list.empty()) return nullptr;
+      void* block = free_list.back();
+      free_list.pop_back();
+      bytes_ -= ClassSize(size_class);
+      return block;
+    }
+
+    bool Push(int size_class, void* block) {
+      std::lock_guard<std::mutex> lock(mu_);
+      std::vector<void*>& free_list = free_lists_[size_class];
+      if (free_list.size() >= kThreadCacheMaxBlocks) return false;
+      free_list.push_back(block);
+      bytes_ += ClassSize(size_class);
+      return true;
+    }
+
+    // Moves the cached blocks to the shared free lists.
+    void Flush() {
+      std::lock_guard<std::mutex> lock(mu_);
+      for (int i = 0; i < kNumClasses; i++) {
+        for (void* block : free_lists_[i]) {
+          allocator_->ReturnToGlobal(i, block);
+        }
+        free_lists_[i].clear();
+      }
+      bytes_ = 0;
+    }
+
+    size_t Bytes() const {
+      std::lock_guard<std::mutex> lock(mu_);
+      return bytes_;
+    }
+
+  private:
+    CachingAllocator* allocator_;
+    mutable std::mutex mu_;
+    std::vector<std::vector<void*>> free_lists_;
+    size_t bytes_;
+  };
+
+  CachingAllocator()
+      : free_lists_((kMaxNumaNodes + 1) * kNumClasses),
+        bytes_cached_(0),
+        max_cached_bytes_(size_t(-1)),
+        bytes_in_use_(0),
+        peak_bytes_in_use_(0),
+        num_allocs_(0),
+        num_frees_(0),
+        num_cache_hits_(0),
+        num_system_allocs_(0),
+        num_system_frees_(0),
+        num_huge_page_allocs_(0),
+        huge_page_mode_(static_cast<int>(HugePageMode::kTransparent)),
+        numa_aware_(true) {
+    const char* huge_pages = getenv("DLSYS_HUGE_PAGES");
+    if (huge_pages != nullptr) {
+      if (strcmp(huge_pages, "none") == 0 || strcmp(huge_pages, "0") == 0) {
+        SetHugePageMode(HugePageMode::kNone);
+      } else if (strcmp(huge_pages, "hugetlb") == 0) {
+        SetHugePageMode(HugePageMode::kHugeTLB);
+      }
+    }
+    const char* numa = getenv("DLSYS_NUMA");
+    if (numa != nullptr && strcmp(numa, "0") == 0) {
+      SetNumaAware(false);
+    }
+  }
+
+  static int& ThreadNumaNode() {
+    static thread_local int node = -1;
+    return node;
+  }
+
+  // The node large blocks of the calling thread should live on, or -1.
+  int PreferredNode() const {
+    if (!numa_aware_) return -1;
+    int node = ThreadNumaNode();
+    if (node < 0) node = CurrentNumaNode();
+    return node < kMaxNumaNodes ? node : -1;
+  }
+
+  // Shared free lists are kept per NUMA node, slot kMaxNumaNodes holds blocks
+  // without a binding.
+  static int ListIndex(int node, int size_class) {
+    int slot = node < 0 ? kMaxNumaNodes : node;
+    return slot * kNumClasses + size_class;
+  }
+
+  ThreadCache& GetThreadCache() {
+    static thread_local ThreadCache cache(this);
+    return cache;
+  }
+
+  void ReturnToGlobal(int size_class, void* block) {
+    size_t class_bytes = ClassSize(size_class);
+    int node = Header(block)->node;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (bytes_cached_ + class_bytes <= max_cached_bytes_) {
+        int index = ListIndex(node < kMaxNumaNodes ? node : -1, size_class);
+        free_lists_[index].push_back(block);
+        bytes_cached_ += class_bytes;
+        return;
+      }
+    }
+    SystemFree(block);
+  }
+
+  static BlockHeader* Header(void* block) {
+    return reinterpret_cast<BlockHeader*>(
+        static_cast<char*>(block) - kAlignment);
+  }
+
+  void* SystemAllocate(size_t class_bytes, int node) {
+    if (class_bytes >= kLargeBlock) {
+      void* block = MapLarge(class_bytes, node);
+      if (block != nullptr) return block;
+    }
+
+    void* raw;
+    if (posix_memalign(&raw, kAlignment, class_bytes + kAlignment) != 0) {
+      // Give the cached memory back and retry once before failing.
+      Trim();
+      if (posix_memalign(&raw, kAlignment, class_bytes + kAlignment) != 0) {
+        throw std::bad_alloc();
+      }
+    }
+    num_system_allocs_++;
+    void* block = static_cast<char*>(raw) + kAlignment;
+    Header(block)->node = -1;
+    return block;
+  }
+
+  // Maps a 2 MB aligned region for a large block, the header takes the first
+  // kAlignment bytes of the mapping.
+  void* MapLarge(size_t class_bytes, int node) {
+    size_t bytes = (class_bytes + kAlignment + kHugePageSize - 1) /
+                   kHugePageSize * kHugePageSize;
+    HugePageMode mode = GetHugePageMode();
+    char* base = nullptr;
+    bool huge = false;
+#ifdef MAP_HUGETLB
+    if (mode == HugePageMode::kHugeTLB) {
+      void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (addr != MAP_FAILED) {
+        base = static_cast<char*>(addr);
+        huge = true;
+      }
+    }
+#endif
+    size_t map_bytes = bytes;
+    if (base == nullptr) {
+      // Over-map by one huge page and trim, mmap only guarantees 4 KB.
+      map_bytes = bytes + kHugePageSize;
+      void* addr = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (addr == MAP_FAILED) return nullptr;
+      char* raw = static_cast<char*>(addr);
+      char* aligned = reinterpret_cast<char*>(
+          (reinterpret_cast<uintptr_t>(raw) + kHugePageSize - 1) &
+          ~(kHugePageSize - 1));
+      if (aligned != raw) munmap(raw, aligned - raw);
+      size_t tail = (raw + map_bytes) - (aligned + bytes);
+      if (tail != 0) munmap(aligned + bytes, tail);
+      base = aligned;
+      map_bytes = bytes;
+#ifdef MADV_HUGEPAGE
+      if (mode != HugePageMode::kNone &&
+          madvise(base, map_bytes, MADV_HUGEPAGE) == 0) {
+        huge = true;
+      }
+#endif
+    }
+
+    if (node >= 0) {
+      // MPOL_PREFERRED, pages still come from other nodes when this one is
+      // exhausted. Failures (no NUMA support) are harmless.
+      const int kMpolPreferred = 1;
+      unsigned long node_mask = 1UL << node;
+      syscall(SYS_mbind, base, map_bytes, kMpolPreferred, &node_mask,
+              sizeof(node_mask) * 8, 0);
+    }
+
+    num_system_allocs_++;
+    if (huge) num_huge_page_allocs_++;
+    void* block = base + kAlignment;
+    BlockHeader* header = Header(block);
+    header->node = node < 0 ? kMaxNumaNodes : node;
+    header->map_base = base;
+    header->map_bytes = map_bytes;
+    return block;
+  }
+
+  void SystemFree(void* block) {
+    num_system_frees_++;
+    BlockHeader* header = Header(block);
+    if (header->node >= 0) {
+      munmap(header->map_base, header->map_bytes);
+    } else {
+      free(header);
+    }
+  }
+
+  // Lock order: caches_mu_, then a ThreadCache's mu_, then mu_.
+  mutable std::mutex caches_mu_;
+  std::vector<ThreadCache*> thread_caches_;
+
+  mutable std::mutex mu_;
+  std::vector<std::vector<void*>> free_lists_;
+  size_t bytes_cached_;
+  size_t max_cached_bytes_;
+
+  std::atomic<size_t> bytes_in_use_;
+  std::atomic<size_t> peak_bytes_in_use_;
+  std::atomic<size_t> num_allocs_;
+  std::atomic<size_t> num_frees_;
+  std::atomic<size_t> num_cache_hits_;
+  std::atomic<size_t> num_system_allocs_;
+  std::atomic<size_t> num_system_frees_;
+  std::atomic<size_t> num_huge_page_allocs_;
+
+  std::atomic<int> huge_page_mode_;
+  std::atomic<bool> numa_aware_;
+};
+
+#endif  // CPU_ALLOCATOR_H_
@@ -3,6 +3,8 @@
 #include <vector>
 #include <sstream>
 #include <fstream>
+#include <stdexcept>
+#include "data_type.h"
 
 class MnistReader {
  public:
@@ -24,14 +26,10 @@ class MnistReader {
   };
 
   int NextBatch(std::vector<float>& features) {
-    if (idx_ + batch_size_ >= data_.size()) {
-      idx_ = 0;
-    }
-
-    int num_samples = std::min(batch_size_, (int)data_.size() - idx_);
+    int num_samples = StartBatch();
     features.clear();
     for (int i = 0; i < num_samples; i++) {
-      for (int j = 0; j < data_[idx_].size(); j++) {
+      for (size_t j = 0; j < data_[idx_].size(); j++) {
         features.push_back(data_[idx_][j]);
       }
       idx_++;
@@ -39,7 +37,41 @@ class MnistReader {
     return num_samples;
   }
 
+  // The next batch in CSR form, only its nonzero features: those of sample
+  // i are values[row_ptr[i], row_ptr[i + 1]) at columns col_idx[...].
+  // Throws std::length_error when the offsets no longer fit in floats,
+  // past kMaxFloatIndex nonzeros.
+  int NextCsrBatch(std::vector<float>& row_ptr, std::vector<float>& col_idx,
+                   std::vector<float>& values) {
+    int num_samples = StartBatch();
+    row_ptr.assign(1, 0);
+    col_idx.clear();
+    values.clear();
+    for (int i = 0; i < num_samples; i++) {
+      for (size_t j = 0; j < data_[idx_].size(); j++) {
+        if (data_[idx_][j] == 0) continue;
+        col_idx.push_back(j);
+        values.push_back(data_[idx_][j]);
+      }
+      if (values.size() > static_cast<size_t>(kMaxFloatIndex)) {
+        throw std::length_error("CSR batch has more than 2^24 nonzeros");
+      }
+      row_ptr.push_back(values.size());
+      idx_++;
+    }
+    return num_samples;
+  }
+
  private:
+  // Starts over once less than a full batch is left, returns the batch's
+  // number of samples.
+  int StartBatch() {
+    if (idx_ + batch_size_ >= static_cast<int>(data_.size())) {
+      idx_ = 0;
+    }
+    return std::min(batch_size_, (int)data_.size() - idx_);
+  }
+
   std::vector<std::vector<float>> data_;
   int idx_;
   std::string file_path_;
@@ -0,0 +1,23 @@
+#ifndef DATA_TYPE_H_
+#define DATA_TYPE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// The element type of a tensor's storage. The 16 bit types are storage only,
+// kernels convert them to float and accumulate in fp32.
+enum class DataType {
+  kFloat32,
+  kBFloat16,
+  kFloat16
+};
+
+inline size_t DataTypeSize(DataType dtype) {
+  return dtype == DataType::kFloat32 ? 4 : 2;
+}
+
+// Index inputs of the graph, ids and CSR offsets and columns, hold integers
+// as float32, which is exact up to 2^24.
+const int64_t kMaxFloatIndex = int64_t(1) << 24;
+
+#endif  // DATA_TYPE_H_
@@ -1,66 +1,90 @@
 #ifndef DEVICE_H_
 #define DEVICE_H_
 
-#include <cuda_runtime.h>
+#include <cstring>
 #include "context.h"
+#include "cpu_allocator.h"
+
+#ifdef USE_CUDA
+#include <cuda_runtime.h>
+#endif
 
 class DeviceAPI {
 public:
-  void* Allocate(const Context& ctx, size_t size, size_t alignment) = 0;
+  virtual ~DeviceAPI() {}
 
-  void Free(const Context& ctx, void* handle) = 0;
+  virtual void* Allocate(const Context& ctx, size_t size, size_t alignment) = 0;
 
-  void Copy(void* to, const Context& ctx_to, 
-            void* from, const Context& ctx, size_t size) = 0; 
+  virtual void Free(const Context& ctx, void* handle) = 0;
+
+  virtual void Copy(void* to, const Context& ctx_to,
+                    void* from, const Context& ctx, size_t size) = 0;
 };
 
+// Allocations are served by the process wide CachingAllocator, so tensors
+// created and destroyed every iteration reuse the same blocks.
 class CPUDeviceAPI : public DeviceAPI {
 public:
+  static CPUDeviceAPI* Global() {
+    static CPUDeviceAPI device_api;
+    return &device_api;
+  }
+
   void* Allocate(const Context& ctx, size_t size, size_t alignment) final {
-    void* handle;
-    int ret = ppsix_memalign(&handle, aligment, size);
-    if (ret != 0)
+    if (alignment > CachingAllocator::kAlignment) {
       throw std::bad_alloc();
-    return handle;
+    }
+    return CachingAllocator::Global()->Allocate(size);
   }
 
   void Free(const Context& ctx, void* handle) final {
-    free(handle); 
+    CachingAllocator::Global()->Free(handle);
   }
 
   void Copy(void* to, const Context& ctx_to,
             void* from, const Context& ctx_from, size_t size) final {
-    memcpy(to, from, size); 
+    memcpy(to, from, size);
+  }
+
+  // Releases the cached blocks back to the system, returns the bytes freed.
+  size_t Trim() {
+    return CachingAllocator::Global()->Trim();
+  }
+
+  AllocatorStats GetStats() const {
+    return CachingAllocator::Global()->GetStats();
   }
 };
 
+#ifdef USE_CUDA
 class GPUDeviceAPI : public DeviceAPI {
 public:
   void* Allocate(const Context& ctx, size_t size, size_t alignment) final {
-    cudaSetDevice(ctx.DeviceId());  
+    cudaSetDevice(ctx.device_id());
     void* ret;
     cudaMalloc(&ret, size);
     return ret;
   }
 
   void Free(const Context& ctx, void* handle) final {
-    cudaSetDevice(ctx.DeviceId());  
+    cudaSetDevice(ctx.device_id());
     cudaFree(handle);
   }
 
-  void Copy(void* to, const Context& ctx_to, 
+  void Copy(void* to, const Context& ctx_to,
             void* from, const Context& ctx_from, size_t size) final {
-    if (ctx_to.DeviceType() == DeviceType::kGPU && 
-        ctx_from.DeviceType() == DeviceType::kCPU) {
+    if (ctx_to.device_type() == DeviceType::kGPU &&
+        ctx_from.device_type() == DeviceType::kCPU) {
       cudaMemcpy(to, from, size, cudaMemcpyHostToDevice);
-    } else if (ctx_to.DeviceType() == DeviceType::kGPU && 
-               ctx_from.DeviceType() == DeviceType::kGPU) {
-      cudaMemcpy(to, from, size, cudaMemcoyDeviceToDevice); 
-    } else if (ctx_to.DeviceType() == DeviceType::kCPU &&
-               ctx_from.DeviceType() == DeviceType::kGPU) {
-      cudaMemcpy(to, from, size, cudaMemcoyDeviceToHost); 
-    } 
-  } 
+    } else if (ctx_to.device_type() == DeviceType::kGPU &&
+               ctx_from.device_type() == DeviceType::kGPU) {
+      cudaMemcpy(to, from, size, cudaMemcpyDeviceToDevice);
+    } else if (ctx_to.device_type() == DeviceType::kCPU &&
+               ctx_from.device_type() == DeviceType::kGPU) {
+      cudaMemcpy(to, from, size, cudaMemcpyDeviceToHost);
+    }
+  }
 };
+#endif
 
 #endif
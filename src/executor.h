@@ -1,10 +1,16 @@
 #ifndef EXECUTOR_H_
 #define EXECUTOR_H_
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <map>
 #include <vector>
 #include <unordered_set>
 #include "context.h"
+#include "graph_rewrite.h"
 #include "node.h"
+#include "op_registry.h"
 
 class Executor {
 public:
@@ -15,9 +21,62 @@ public:
            const Node& out,
            const std::vector<Node>& node_need_grads) 
         : ctx_(ctx), out_(out), node_need_grads_(node_need_grads) {
+    // Dense layers are fused before differentiation so the backward graph
+    // is built from their fused gradients.
+    out_ = fusion_.Fuse(out_);
     // Use auto diff to complete the graph
     Gradient();
-    need_topo_order_ = true;
+  }
+
+  // Caps the forward values kept alive for the backward pass. Only the
+  // checkpoints, every sqrt(n)-th forward node when none are given, are
+  // shared with the backward graph. The other forward values it needs are
+  // recomputed from the nearest checkpoints right before their use, so at
+  // most one segment between checkpoints is alive at a time.
+  void Checkpoint(const std::vector<Node>& checkpoints = {}) {
+    GetTopoOrder({out_});
+    std::unordered_set<Node> forward(topo_orders_.begin(), topo_orders_.end());
+    std::unordered_set<Node> kept;
+    for (auto& checkpoint : checkpoints) {
+      kept.insert(fusion_.Lookup(checkpoint));
+    }
+    kept.insert(out_);
+    if (checkpoints.empty()) {
+      std::vector<Node> ops;
+      for (auto& node : topo_orders_) {
+        if (!node.IsVariable()) ops.push_back(node);
+      }
+      size_t stride = std::max<size_t>(1, std::ceil(std::sqrt(ops.size())));
+      for (size_t i = stride - 1; i < ops.size(); i += stride) {
+        kept.insert(ops[i]);
+      }
+    }
+
+    std::unordered_map<Node, Node> recomputed;
+    std::unordered_map<Node, Node> rewritten;
+    for (auto& grad : node_to_grads_) {
+      grad.second = UseRecomputed(grad.second, forward, kept, recomputed,
+                                  rewritten);
+    }
+    plans_.clear();
+  }
+
+  // Runs the ops that have bf16 or fp16 kernels in dtype, the rest in fp32.
+  // Values are converted where a kernel reads another dtype than its input
+  // was stored in, so the activations between 16 bit ops take half the
+  // memory and bandwidth, while variables stay fp32 master copies and the
+  // values and gradients Run returns are fp32. fp16 gradients below about
+  // 6e-8 flush to zero, scale the loss up and the gradients down to keep
+  // them. DataType::kFloat32 turns it off.
+  void SetMixedPrecision(DataType dtype) {
+    dtype_ = dtype;
+    plans_.clear();
+  }
+
+  // Whether the gradient Run returns for node is sparse, [n, 1 + row_size]
+  // packed rows to wrap in a SparseTensor.
+  bool IsSparseGrad(const Node& node) const {
+    return IsSparse(node_to_grads_.at(node));
   }
 
   void Run(const std::vector<Node>& out_nodes, 
@@ -28,72 +87,249 @@ public:
     // nodes represent the nodes we need to evalute, 
     // so we need to do topo sort with nodes as output first.
     std::vector<Node> nodes;
-    nodes.insert(nodes.end(), out_nodes.begin(), out_nodes.end());
+    for (auto& node : out_nodes) {
+      nodes.push_back(fusion_.Lookup(node));
+    }
     std::transform(grad_nodes.begin(), grad_nodes.end(), 
                    std::back_inserter(nodes), 
                    [this](const Node& node) { return node_to_grads_.at(node); });
 
-    if (need_topo_order_) GetTopoOrder(nodes);
+    // A plan only holds the nodes the requested values depend on, one is
+    // kept per set of requested values.
+    std::vector<int64_t> plan_key;
+    for (auto& node : nodes) {
+      plan_key.push_back(node.id());
+    }
+    auto plan_iter = plans_.find(plan_key);
+    if (plan_iter == plans_.end()) {
+      GetTopoOrder(nodes);
+      plan_iter = plans_.emplace(plan_key, BuildPlan(nodes)).first;
+    }
 
-    for (auto node : topo_orders_) {
-      std::vector<Node> in_nodes;
-      node.GetInputNodes(in_nodes);
-      if (in_nodes.size() == 0) continue;
+    std::unordered_map<Node, TensorShape> shapes;
+    // Variables converted for the 16 bit kernels, once per run.
+    std::unordered_map<Node, Tensor> casts;
+    for (auto& step : plan_iter->second) {
+      // Kernels read their inputs through views, nothing is copied.
       std::vector<Tensor> in_tensors;
       std::vector<TensorShape> in_shapes;
-      for (auto in_node : in_nodes) {
-        const Tensor& in_tensor = node_to_tensor[in_node];
-        in_tensors.push_back(in_tensor);
+      for (size_t i = 0; i < step.inputs.size(); i++) {
+        const Node& in_node = step.inputs[i];
+        auto iter = node_to_tensor.find(in_node);
+        if (step.shape_only[i]) {
+          // The value may be freed already, its shape was recorded.
+          in_tensors.push_back(Tensor());
+          in_shapes.push_back(iter != node_to_tensor.end() ?
+                              iter->second.GetTensorShape() :
+                              shapes.at(in_node));
+          continue;
+        }
+        Tensor& in_tensor = node_to_tensor[in_node];
         in_shapes.push_back(in_tensor.GetTensorShape());
+        if (in_tensor.GetDataType() == step.dtype) {
+          in_tensors.push_back(Tensor::View(in_tensor));
+        } else if (in_node.IsVariable()) {
+          auto cast = casts.find(in_node);
+          if (cast == casts.end()) {
+            cast = casts.emplace(in_node, in_tensor.Cast(step.dtype)).first;
+          }
+          in_tensors.push_back(Tensor::View(cast->second));
+        } else {
+          in_tensors.push_back(in_tensor.Cast(step.dtype));
+        }
       }
 
-
       std::vector<TensorShape> out_shapes;
-      node.GetOp()->Infer(node, in_shapes, out_shapes);
+      step.kernel->Infer(step.node, in_shapes, out_shapes);
 
-      std::vector<Tensor> out_tensors = {Tensor(out_shapes[0], Context::cpu())};
-      node.GetOp()->Compute(node, in_tensors, out_tensors);
+      // Broadcast inputs are smaller than the output and converted ones are
+      // copies, only an input of the output's shape and dtype can be
+      // written over.
+      std::vector<Tensor> out_tensors;
+      for (int input : step.inplace_inputs) {
+        const Node& dead = step.inputs[input];
+        if (in_shapes[input] == out_shapes[0] &&
+            node_to_tensor[dead].GetDataType() == step.dtype) {
+          out_tensors.push_back(std::move(node_to_tensor[dead]));
+          node_to_tensor.erase(dead);
+          break;
+        }
+      }
+      if (out_tensors.empty()) {
+        out_tensors.push_back(Tensor(out_shapes[0], ctx_, step.dtype));
+      }
+      step.kernel->Compute(step.node, in_tensors, out_tensors);
 
-      node_to_tensor[node] = out_tensors[0];
+      node_to_tensor[step.node] = std::move(out_tensors[0]);
+      shapes[step.node] = out_shapes[0];
+      for (auto& dead : step.dead_inputs) {
+        node_to_tensor.erase(dead);
+      }
     }
 
     out_vals.clear();
     for (auto node : out_nodes) {
-      out_vals.push_back(node_to_tensor[node]);
+      Node fused = fusion_.Lookup(node);
+      if (fused.id() != node.id()) {
+        node_to_tensor[node] = node_to_tensor[fused];
+      }
+      out_vals.push_back(node_to_tensor[node].Cast(DataType::kFloat32));
     }
     grad_vals.clear();
     for (auto node : grad_nodes) {
-      grad_vals.push_back(node_to_tensor[node_to_grads_[node]]);
+      grad_vals.push_back(
+          node_to_tensor[node_to_grads_[node]].Cast(DataType::kFloat32));
     }
   }
 
 
 private:
+  // One node to evaluate, with the kernel for the executor's device resolved
+  // once here instead of on every run. inplace_inputs are the inputs the
+  // output may take the buffer of: dead after this step, and neither a
+  // variable nor a requested value, so the user never sees them change.
+  // shape_only marks the inputs the kernel only reads the shape of, and
+  // dead_inputs are the values freed after this step. dtype is the one the
+  // kernel reads and writes.
+  struct Step {
+    Node node;
+    std::vector<Node> inputs;
+    Op* kernel;
+    DataType dtype;
+    std::vector<bool> shape_only;
+    std::vector<int> inplace_inputs;
+    std::vector<Node> dead_inputs;
+  };
+
+  // outs are the requested nodes, their values have to survive the run.
+  std::vector<Step> BuildPlan(const std::vector<Node>& outs) {
+    std::vector<Step> plan;
+    std::unordered_map<Node, int> last_use;
+    for (auto& node : topo_orders_) {
+      if (node.IsVariable()) continue;
+      Step step;
+      step.node = node;
+      node.GetInputNodes(step.inputs);
+      const std::string& op_type = node.GetOp()->GetOpType();
+      step.dtype = dtype_;
+      step.kernel = OpRegistry::Global()->Lookup(op_type, ctx_.device_type(),
+                                                 dtype_);
+      if (step.kernel == nullptr) {
+        step.dtype = DataType::kFloat32;
+        step.kernel = OpRegistry::Global()->Lookup(
+            op_type, ctx_.device_type(), DataType::kFloat32);
+      }
+      assert(step.kernel != nullptr);
+      step.shape_only.assign(step.inputs.size(), false);
+      for (int input : step.kernel->ShapeOnlyInputs(step.node)) {
+        step.shape_only[input] = true;
+      }
+      for (size_t i = 0; i < step.inputs.size(); i++) {
+        if (!step.shape_only[i]) last_use[step.inputs[i]] = plan.size();
+      }
+      plan.push_back(step);
+    }
+
+    // Values no later step reads are freed right after their last use.
+    std::unordered_set<Node> live_out(outs.begin(), outs.end());
+    for (int i = 0; i < static_cast<int>(plan.size()); i++) {
+      Step& step = plan[i];
+      // A value nothing reads, only its shape is used.
+      if (!live_out.count(step.node) && !last_use.count(step.node)) {
+        step.dead_inputs.push_back(step.node);
+      }
+      std::unordered_map<Node, int> uses;
+      for (size_t j = 0; j < step.inputs.size(); j++) {
+        if (step.shape_only[j]) continue;
+        const Node& input = step.inputs[j];
+        if (uses[input]++ > 0) continue;
+        if (input.IsVariable() || live_out.count(input) ||
+            last_use[input] != i) {
+          continue;
+        }
+        step.dead_inputs.push_back(input);
+      }
+      for (int input : step.kernel->InplaceInputs()) {
+        const Node& in_node = step.inputs[input];
+        bool dead = std::find_if(step.dead_inputs.begin(),
+                                 step.dead_inputs.end(),
+                                 [&in_node](const Node& node) {
+                                   return node.id() == in_node.id();
+                                 }) != step.dead_inputs.end();
+        if (dead && uses[in_node] == 1) {
+          step.inplace_inputs.push_back(input);
+        }
+      }
+    }
+    return plan;
+  }
+
+  // Builds the backward graph, simplifying it as it goes. Only nodes on a
+  // path from node_need_grads_ to out_ get gradients. Zero gradients are
+  // dropped from the sums, and nodes whose gradient is identically zero pass
+  // zeros to their inputs without building their gradient subgraph.
   void Gradient() {
     // A map for node -> grads
     std::unordered_map<Node, std::vector<Node>> node_to_grads;
 
-    auto reduce_sum_by_node = [&node_to_grads] (const Node& node) {
-      auto grads = node_to_grads.at(node);
-      if (grads.size() > 1) {
-        for (int i = 1; i < grads.size(); i++) {
-          grads[0] += grads[i];
+    // A variable whose gradients are all sparse keeps a sparse gradient, so
+    // a step costs the rows it touched. Anywhere else they are made dense.
+    auto reduce_sum_by_node = [this, &node_to_grads] (const Node& node) {
+      std::vector<Node> grads;
+      std::vector<Node> sparse_grads;
+      for (auto& grad : node_to_grads[node]) {
+        Node simplified = rewriter_.Rewrite(grad);
+        if (GraphRewriter::IsZeros(simplified)) continue;
+        if (IsSparse(simplified)) {
+          sparse_grads.push_back(simplified);
+        } else {
+          grads.push_back(simplified);
         }
       }
-      return grads[0];
+      if (!sparse_grads.empty() && grads.empty() && node.IsVariable()) {
+        if (sparse_grads.size() == 1) return sparse_grads[0];
+        return SparseConcatOperator(sparse_grads);
+      }
+      for (auto& grad : sparse_grads) {
+        grads.push_back(SparseToDenseOperator(grad, node));
+      }
+      if (grads.empty()) return rewriter_.Rewrite(ZerosOperator(node));
+      if (grads.size() == 1) return grads[0];
+      return rewriter_.Rewrite(AddNOperator(grads));
     };
 
     GetTopoOrder({out_});
+    std::unordered_set<Node> on_grad_path(node_need_grads_.begin(),
+                                          node_need_grads_.end());
+    for (auto& node : topo_orders_) {
+      std::vector<Node> inputs;
+      node.GetInputNodes(inputs);
+      for (auto& input : inputs) {
+        if (on_grad_path.count(input)) {
+          on_grad_path.insert(node);
+          break;
+        }
+      }
+    }
+
     node_to_grads[out_].push_back(OnesOperator(out_));
     for (auto iter = topo_orders_.rbegin(); iter != topo_orders_.rend(); iter++) {
+      if (iter->IsVariable() || !on_grad_path.count(*iter)) continue;
       Node in_grad = reduce_sum_by_node(*iter);
-      std::vector<Node> out_grads;
-      if (iter->GetOp() != nullptr)
-        iter->GetOp()->Gradient(*iter, in_grad, out_grads);
       std::vector<Node> inputs;
       iter->GetInputNodes(inputs);
-      for (int i = 0; i < inputs.size(); i++) {
-        node_to_grads[inputs[i]].push_back(out_grads[i]);
+      std::vector<Node> out_grads;
+      if (GraphRewriter::IsZeros(in_grad)) {
+        for (auto& input : inputs) {
+          out_grads.push_back(ZerosOperator(input));
+        }
+      } else if (iter->GetOp() != nullptr) {
+        iter->GetOp()->Gradient(*iter, in_grad, out_grads);
+      }
+      for (size_t i = 0; i < inputs.size(); i++) {
+        if (on_grad_path.count(inputs[i])) {
+          node_to_grads[inputs[i]].push_back(out_grads[i]);
+        }
       }
     }
 
@@ -102,35 +338,139 @@ private:
     }
   }
 
+  static bool IsSparse(const Node& node) {
+    return node.GetOp() != nullptr && node.GetOp()->IsSparse();
+  }
+
+  // The forward node recomputed from the kept nodes.
+  Node Recompute(const Node& node, const std::unordered_set<Node>& kept,
+                 std::unordered_map<Node, Node>& recomputed) {
+    if (node.IsVariable() || kept.count(node)) return node;
+    auto iter = recomputed.find(node);
+    if (iter != recomputed.end()) return iter->second;
+
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    for (auto& input : inputs) {
+      input = Recompute(input, kept, recomputed);
+    }
+    // Marked, so hash-consing does not merge it back into the original.
+    Node copy = node.WithInputs(inputs);
+    copy.SetAttr("recompute", true);
+    recomputed[node] = copy;
+    return copy;
+  }
+
+  // node with every forward value it reads replaced by its recomputation.
+  Node UseRecomputed(const Node& node, const std::unordered_set<Node>& forward,
+                     const std::unordered_set<Node>& kept,
+                     std::unordered_map<Node, Node>& recomputed,
+                     std::unordered_map<Node, Node>& rewritten) {
+    if (forward.count(node)) return Recompute(node, kept, recomputed);
+    if (node.IsVariable()) return node;
+    auto iter = rewritten.find(node);
+    if (iter != rewritten.end()) return iter->second;
+
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    std::vector<int> shape_only;
+    if (node.GetOp() != nullptr) {
+      shape_only = node.GetOp()->ShapeOnlyInputs(node);
+    }
+    bool changed = false;
+    for (int i = 0; i < static_cast<int>(inputs.size()); i++) {
+      // Only the shape is read, which does not need recomputing.
+      if (std::count(shape_only.begin(), shape_only.end(), i)) continue;
+      Node& input = inputs[i];
+      Node new_input = UseRecomputed(input, forward, kept, recomputed,
+                                     rewritten);
+      changed = changed || new_input.id() != input.id();
+      input = new_input;
+    }
+    Node result = changed ? node.WithInputs(inputs) : node;
+    rewritten[node] = result;
+    return result;
+  }
+
+  // Depth first from each of outs. An out whose inputs have all been placed
+  // is placed right away instead of in its turn, so the values only it
+  // reads, like the activation a weight gradient needs, die early.
   void GetTopoOrder(const std::vector<Node>& outs) {
-    need_topo_order_ = false;
     topo_orders_.clear();
     std::unordered_set<Node> visited;
+    std::vector<Node> pending = outs;
+    AppendEarlyNodes(outs, pending);
     for (auto node : outs) {
-      dfs(node, visited);
+      dfs(node, visited, pending);
     }
   }
 
-  void dfs(const Node& node, std::unordered_set<Node>& visited) {
+  // Nodes outs depend on whose ops want to be evaluated early, they are
+  // placed like outs, as soon as their inputs are.
+  void AppendEarlyNodes(const std::vector<Node>& outs,
+                        std::vector<Node>& pending) {
+    std::unordered_set<Node> seen(outs.begin(), outs.end());
+    std::vector<Node> stack = outs;
+    while (!stack.empty()) {
+      Node node = stack.back();
+      stack.pop_back();
+      if (node.GetOp() != nullptr && node.GetOp()->EvaluateEarly()) {
+        pending.push_back(node);
+      }
+      std::vector<Node> inputs;
+      node.GetInputNodes(inputs);
+      for (auto& input : inputs) {
+        if (seen.insert(input).second) stack.push_back(input);
+      }
+    }
+  }
+
+  void dfs(const Node& node, std::unordered_set<Node>& visited,
+           std::vector<Node>& pending) {
     if (visited.find(node) == visited.end()) {
       if (!node.IsVariable()) {
         std::vector<Node> input_nodes;
         node.GetInputNodes(input_nodes);
         for (auto input_node : input_nodes) {
-          dfs(input_node, visited);      
+          dfs(input_node, visited, pending);      
         } 
+        // Placed already if it is an out that became ready on the way.
+        if (visited.count(node)) return;
       }
       visited.insert(node);
       topo_orders_.push_back(node);
+      PlaceReadyOuts(visited, pending);
     } 
   };
 
+  void PlaceReadyOuts(std::unordered_set<Node>& visited,
+                      std::vector<Node>& pending) {
+    // i restarts from -1 after a node is placed, so it stays signed.
+    for (int i = 0; i < static_cast<int>(pending.size()); i++) {
+      Node out = pending[i];
+      std::vector<Node> inputs;
+      out.GetInputNodes(inputs);
+      bool ready = !visited.count(out) && !out.IsVariable();
+      for (auto& input : inputs) {
+        ready = ready && visited.count(input);
+      }
+      if (visited.count(out) || ready) {
+        pending.erase(pending.begin() + i);
+        if (ready) dfs(out, visited, pending);
+        i = -1;
+      }
+    }
+  }
+
   Context ctx_;
+  DataType dtype_ = DataType::kFloat32;
   Node out_;
   std::vector<Node> node_need_grads_;
   std::unordered_map<Node, Node> node_to_grads_; 
   std::vector<Node> topo_orders_;
-  bool need_topo_order_;
+  std::map<std::vector<int64_t>, std::vector<Step>> plans_;
+  GraphRewriter rewriter_;
+  DenseFusion fusion_;
 };
 
 #endif 
@@ -0,0 +1,232 @@
+#ifndef GEMM_H_
+#define GEMM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "half.h"
+#include "thread_pool.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+// Single precision GEMM, C = op(A) * op(B) where op(X) is X or X^T and every
+// matrix is row major.
+//
+// C is cut into kGemmMc x kGemmNc blocks that are computed in parallel. A
+// block runs over k in chunks of kGemmKc, packing its slices of A and B into
+// panels that the kGemmMr x kGemmNr register tile streams through. Once a
+// block is done its rows are passed to the epilogue while they are still in
+// cache, which is where fused ops apply bias and activation. Each element is
+// summed by one task in a fixed order, so results do not depend on the
+// number of threads.
+//
+// A and B may also be bf16 or fp16. They are converted to float while they
+// are packed, so the kernel and C stay fp32.
+
+const int kGemmMr = 6;
+const int kGemmNr = 16;
+const int64_t kGemmMc = 96;
+const int64_t kGemmNc = 256;
+const int64_t kGemmKc = 256;
+
+struct NoEpilogue {
+  void operator()(int64_t row, int64_t col, float* c, int64_t len) const {}
+};
+
+// Rows [i0, i0 + mc) and cols [p0, p0 + kc) of op(A), as panels of kGemmMr
+// rows stored column by column. Rows past the block are zero.
+template <typename T>
+inline void PackA(const T* a, int64_t lda, bool trans_a,
+                  int64_t i0, int64_t mc, int64_t p0, int64_t kc,
+                  float* packed) {
+  for (int64_t ir = 0; ir < mc; ir += kGemmMr) {
+    int rows = std::min<int64_t>(kGemmMr, mc - ir);
+    for (int64_t p = 0; p < kc; p++) {
+      for (int r = 0; r < kGemmMr; r++) {
+        int64_t i = i0 + ir + r;
+        int64_t k = p0 + p;
+        *packed++ = r >= rows ? 0.0f : static_cast<float>(
+            trans_a ? a[k * lda + i] : a[i * lda + k]);
+      }
+    }
+  }
+}
+
+// Rows [p0, p0 + kc) and cols [j0, j0 + nc) of op(B), as panels of kGemmNr
+// cols stored row by row. Cols past the block are zero.
+template <typename T>
+inline void PackB(const T* b, int64_t ldb, bool trans_b,
+                  int64_t p0, int64_t kc, int64_t j0, int64_t nc,
+                  float* packed) {
+  for (int64_t jr = 0; jr < nc; jr += kGemmNr) {
+    int cols = std::min<int64_t>(kGemmNr, nc - jr);
+    for (int64_t p = 0; p < kc; p++) {
+      int64_t k = p0 + p;
+      if (!trans_b && cols == kGemmNr) {
+        ConvertToFloat(b + k * ldb + j0 + jr, kGemmNr, packed);
+      } else {
+        for (int c = 0; c < kGemmNr; c++) {
+          int64_t j = j0 + jr + c;
+          packed[c] = c >= cols ? 0.0f : static_cast<float>(
+              trans_b ? b[j * ldb + k] : b[k * ldb + j]);
+        }
+      }
+      packed += kGemmNr;
+    }
+  }
+}
+
+// The kGemmMr x kGemmNr tile c (row stride ldc) is set to, or accumulates,
+// the product of one A panel and one B panel.
+inline void GemmMicroKernel(int64_t kc, const float* a, const float* b,
+                            float* c, int64_t ldc, bool accumulate) {
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 acc[kGemmMr][2];
+  for (int r = 0; r < kGemmMr; r++) {
+    acc[r][0] = _mm256_setzero_ps();
+    acc[r][1] = _mm256_setzero_ps();
+  }
+  for (int64_t p = 0; p < kc; p++) {
+    __m256 b0 = _mm256_loadu_ps(b);
+    __m256 b1 = _mm256_loadu_ps(b + 8);
+    for (int r = 0; r < kGemmMr; r++) {
+      __m256 a_val = _mm256_broadcast_ss(a + r);
+      acc[r][0] = _mm256_fmadd_ps(a_val, b0, acc[r][0]);
+      acc[r][1] = _mm256_fmadd_ps(a_val, b1, acc[r][1]);
+    }
+    a += kGemmMr;
+    b += kGemmNr;
+  }
+  for (int r = 0; r < kGemmMr; r++) {
+    float* row = c + r * ldc;
+    if (accumulate) {
+      acc[r][0] = _mm256_add_ps(acc[r][0], _mm256_loadu_ps(row));
+      acc[r][1] = _mm256_add_ps(acc[r][1], _mm256_loadu_ps(row + 8));
+    }
+    _mm256_storeu_ps(row, acc[r][0]);
+    _mm256_storeu_ps(row + 8, acc[r][1]);
+  }
+#else
+  float acc[kGemmMr][kGemmNr] = {};
+  for (int64_t p = 0; p < kc; p++) {
+    for (int r = 0; r < kGemmMr; r++) {
+      for (int j = 0; j < kGemmNr; j++) {
+        acc[r][j] += a[r] * b[j];
+      }
+    }
+    a += kGemmMr;
+    b += kGemmNr;
+  }
+  for (int r = 0; r < kGemmMr; r++) {
+    float* row = c + r * ldc;
+    for (int j = 0; j < kGemmNr; j++) {
+      row[j] = accumulate ? row[j] + acc[r][j] : acc[r][j];
+    }
+  }
+#endif
+}
+
+// c is m x n, op(A) is m x k and op(B) is k x n. epilogue(row, col, c, len)
+// is called once for every row segment c[0, len) of each finished block.
+// When c is null each block is summed in a buffer of its thread and only
+// the epilogue sees it, so the product is never stored as a whole.
+template <typename T, typename Epilogue>
+void Gemm(bool trans_a, bool trans_b, int64_t m, int64_t n, int64_t k,
+          const T* a, const T* b, float* c,
+          const Epilogue& epilogue) {
+  const int64_t lda = trans_a ? m : k;
+  const int64_t ldb = trans_b ? k : n;
+  const int64_t ldc = n;
+  const int64_t m_blocks = (m + kGemmMc - 1) / kGemmMc;
+  const int64_t n_blocks = (n + kGemmNc - 1) / kGemmNc;
+
+  ThreadPool::Global()->ParallelFor(m_blocks * n_blocks, [&](int64_t task) {
+    const int64_t i0 = (task / n_blocks) * kGemmMc;
+    const int64_t j0 = (task % n_blocks) * kGemmNc;
+    const int64_t mc = std::min(kGemmMc, m - i0);
+    const int64_t nc = std::min(kGemmNc, n - j0);
+
+    static thread_local std::vector<float> packed_a;
+    static thread_local std::vector<float> packed_b;
+    static thread_local std::vector<float> block_c;
+    packed_a.resize(kGemmMc * kGemmKc);
+    packed_b.resize(((kGemmNc + kGemmNr - 1) / kGemmNr) * kGemmNr * kGemmKc);
+    if (c == nullptr) block_c.resize(kGemmMc * kGemmNc);
+    float* c_block = c ? c + i0 * ldc + j0 : block_c.data();
+    const int64_t ld_block = c ? ldc : kGemmNc;
+
+    if (k == 0) {
+      for (int64_t i = 0; i < mc; i++) {
+        std::fill(c_block + i * ld_block, c_block + i * ld_block + nc, 0.0f);
+      }
+    }
+
+    for (int64_t p0 = 0; p0 < k; p0 += kGemmKc) {
+      const int64_t kc = std::min(kGemmKc, k - p0);
+      PackA(a, lda, trans_a, i0, mc, p0, kc, packed_a.data());
+      PackB(b, ldb, trans_b, p0, kc, j0, nc, packed_b.data());
+
+      for (int64_t jr = 0; jr < nc; jr += kGemmNr) {
+        const int cols = std::min<int64_t>(kGemmNr, nc - jr);
+        const float* panel_b = packed_b.data() + jr * kc;
+        for (int64_t ir = 0; ir < mc; ir += kGemmMr) {
+          const int rows = std::min<int64_t>(kGemmMr, mc - ir);
+          const float* panel_a = packed_a.data() + ir * kc;
+          float* tile = c_block + ir * ld_block + jr;
+          if (rows == kGemmMr && cols == kGemmNr) {
+            GemmMicroKernel(kc, panel_a, panel_b, tile, ld_block, p0 > 0);
+            continue;
+          }
+          float partial[kGemmMr * kGemmNr];
+          GemmMicroKernel(kc, panel_a, panel_b, partial, kGemmNr, false);
+          for (int r = 0; r < rows; r++) {
+            for (int j = 0; j < cols; j++) {
+              float val = partial[r * kGemmNr + j];
+              float* dst = tile + r * ld_block + j;
+              *dst = p0 > 0 ? *dst + val : val;
+            }
+          }
+        }
+      }
+    }
+
+    for (int64_t i = 0; i < mc; i++) {
+      epilogue(i0 + i, j0, c_block + i * ld_block, nc);
+    }
+  });
+}
+
+template <typename T>
+inline void Gemm(bool trans_a, bool trans_b, int64_t m, int64_t n, int64_t k,
+                 const T* a, const T* b, float* c) {
+  Gemm(trans_a, trans_b, m, n, k, a, b, c, NoEpilogue());
+}
+
+// c[i] = op(a[i]) * op(b[i]) for i in [0, batch), where a[i] starts at
+// a + i * a_stride and a stride of 0 broadcasts one matrix to every product.
+// When a single product has fewer blocks than the pool has threads, the
+// products run one per task and each Gemm runs on its task's thread;
+// otherwise they run in turn and each Gemm spreads its blocks over the pool.
+inline void BatchGemm(bool trans_a, bool trans_b, int64_t batch, int64_t m,
+                      int64_t n, int64_t k, const float* a, int64_t a_stride,
+                      const float* b, int64_t b_stride, float* c) {
+  const int64_t c_stride = m * n;
+  const int64_t blocks =
+      ((m + kGemmMc - 1) / kGemmMc) * ((n + kGemmNc - 1) / kGemmNc);
+  auto product = [&](int64_t i) {
+    Gemm(trans_a, trans_b, m, n, k, a + i * a_stride, b + i * b_stride,
+         c + i * c_stride);
+  };
+
+  ThreadPool* pool = ThreadPool::Global();
+  if (batch > 1 && blocks < pool->NumThreads()) {
+    pool->ParallelFor(batch, product);
+  } else {
+    for (int64_t i = 0; i < batch; i++) product(i);
+  }
+}
+
+#endif  // GEMM_H_
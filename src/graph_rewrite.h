@@ -0,0 +1,402 @@
+#ifndef GRAPH_REWRITE_H_
+#define GRAPH_REWRITE_H_
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "node.h"
+#include "operator.h"
+
+// GraphRewriter simplifies a graph bottom-up before it is planned:
+//
+//   - Zeros, Ones and Fill are constants shaped like their input, constant
+//     subexpressions over them are folded into a single Fill.
+//   - Constants only keep the node they take their shape from, and that node
+//     is moved back through shape preserving ops, so computing a constant
+//     never forces computing an otherwise unused value.
+//   - Identity ops (x * 1, x + 0, sum-to or broadcast to the same shape,
+//     single term AddN) are removed and zeros are propagated through the ops
+//     they annihilate.
+//   - x * c chains are merged and x + y * -1 becomes Minus(x, y).
+//
+// Shapes are not known while the graph is built, so a rule that changes the
+// shape of an elementwise op only fires when both sides are known to have
+// the same shape, or the constant side holds a single element.
+class GraphRewriter {
+public:
+  Node Rewrite(const Node& node) {
+    auto iter = rewritten_.find(node);
+    if (iter != rewritten_.end()) return iter->second;
+
+    Node result = node;
+    if (!node.IsVariable()) {
+      std::vector<Node> inputs;
+      node.GetInputNodes(inputs);
+      bool changed = false;
+      for (auto& input : inputs) {
+        Node new_input = Rewrite(input);
+        changed = changed || new_input.id() != input.id();
+        input = new_input;
+      }
+      if (changed) result = node.WithInputs(inputs);
+      Node simplified = Simplify(result);
+      // Inputs of the replacement are rewritten already, so this only
+      // applies the rules again until nothing changes.
+      if (simplified.id() != result.id()) result = Rewrite(simplified);
+    }
+    rewritten_[node] = result;
+    rewritten_[result] = result;
+    return result;
+  }
+
+  // Whether node is a constant, and its value.
+  static bool IsConstant(const Node& node, float& value) {
+    Node like;
+    return ConstantValue(node, value, like);
+  }
+
+  static bool IsZeros(const Node& node) {
+    float value = 0.0;
+    return IsConstant(node, value) && value == 0;
+  }
+
+private:
+  static std::string OpType(const Node& node) {
+    return node.GetOp() == nullptr ? "" : node.GetOp()->GetOpType();
+  }
+
+  static bool ConstantValue(const Node& node, float& value, Node& like) {
+    std::string op_type = OpType(node);
+    if (op_type == "Zeros") {
+      value = 0;
+    } else if (op_type == "Ones") {
+      value = 1;
+    } else if (op_type == "Fill") {
+      value = 0;
+      node.GetAttr("value", value);
+    } else {
+      return false;
+    }
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    like = inputs[0];
+    return true;
+  }
+
+  static float ConstVal(const Node& node) {
+    float const_val = 0.0;
+    node.GetAttr("const_val", const_val);
+    return const_val;
+  }
+
+  // A node with the same shape as node, found by walking back through ops
+  // whose output is shaped like one of their inputs. Nodes with the same
+  // root have the same shape.
+  Node ShapeRoot(const Node& node) {
+    auto iter = shape_roots_.find(node);
+    if (iter != shape_roots_.end()) return iter->second;
+
+    Node root = node;
+    std::string op_type = OpType(node);
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    if (op_type == "AddByConst" || op_type == "MinusByConst" ||
+        op_type == "MultiplyByConst" || op_type == "DevideByConst" ||
+        op_type == "Relu" || op_type == "Softmax" ||
+        op_type == "Zeros" || op_type == "Ones" || op_type == "Fill" ||
+        op_type == "AddN" || op_type == "ReluGrad" ||
+        op_type == "ActivationGrad" || op_type == "LayerNorm" ||
+        op_type == "BatchNorm") {
+      root = ShapeRoot(inputs[0]);
+    } else if (op_type == "ReduceSumTo" || op_type == "BroadCastTo" ||
+               op_type == "ReduceGrad" || op_type == "AvgPool2DGrad") {
+      root = ShapeRoot(inputs[1]);
+    } else if (op_type == "Conv2DBackpropInput" ||
+               op_type == "Conv2DBackpropFilter" ||
+               op_type == "MaxPool2DGrad") {
+      root = ShapeRoot(inputs[2]);
+    } else if (op_type == "Add" || op_type == "Minus" ||
+               op_type == "Multiply" || op_type == "Devide") {
+      Node lhs = ShapeRoot(inputs[0]);
+      if (lhs.id() == ShapeRoot(inputs[1]).id()) root = lhs;
+    }
+    shape_roots_[node] = root;
+    return root;
+  }
+
+  bool SameShape(const Node& lhs, const Node& rhs) {
+    return ShapeRoot(lhs).id() == ShapeRoot(rhs).id();
+  }
+
+  // Full reductions and the loss produce a single element.
+  bool IsScalar(const Node& node) {
+    Node root = ShapeRoot(node);
+    std::string op_type = OpType(root);
+    if (op_type == "SoftmaxCrossEntropy") return true;
+    if (op_type == "ReduceSum" || op_type == "ReduceMean" ||
+        op_type == "ReduceMax") {
+      std::vector<int> axes;
+      bool keepdims = false;
+      root.GetAttr("axes", axes);
+      root.GetAttr("keepdims", keepdims);
+      return axes.empty() && !keepdims;
+    }
+    return false;
+  }
+
+  Node MakeConstant(const Node& like, float value) {
+    Node root = ShapeRoot(like);
+    if (value == 0) return ZerosOperator(root);
+    if (value == 1) return OnesOperator(root);
+    return FillOperator(root, value);
+  }
+
+  static float Apply(const std::string& op_type, float lhs, float rhs) {
+    if (op_type == "Add" || op_type == "AddByConst") return lhs + rhs;
+    if (op_type == "Minus" || op_type == "MinusByConst") return lhs - rhs;
+    if (op_type == "Multiply" || op_type == "MultiplyByConst") {
+      return lhs * rhs;
+    }
+    return lhs / rhs;
+  }
+
+  Node Simplify(const Node& node) {
+    std::string op_type = OpType(node);
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    float value = 0.0;
+    Node like;
+
+    if (ConstantValue(node, value, like)) {
+      Node constant = MakeConstant(like, value);
+      return constant.id() == node.id() ? node : constant;
+    }
+
+    if (op_type == "AddByConst" || op_type == "MinusByConst" ||
+        op_type == "MultiplyByConst" || op_type == "DevideByConst") {
+      float const_val = ConstVal(node);
+      const Node& x = inputs[0];
+      if (ConstantValue(x, value, like)) {
+        return MakeConstant(like, Apply(op_type, value, const_val));
+      }
+      bool additive = op_type == "AddByConst" || op_type == "MinusByConst";
+      if ((additive && const_val == 0) || (!additive && const_val == 1)) {
+        return x;
+      }
+      if (op_type == "MultiplyByConst") {
+        if (const_val == 0) return MakeConstant(x, 0);
+        if (OpType(x) == "MultiplyByConst") {
+          std::vector<Node> x_inputs;
+          x.GetInputNodes(x_inputs);
+          return MultiplyByConstOperator(x_inputs[0],
+                                         ConstVal(x) * const_val);
+        }
+      }
+      return node;
+    }
+
+    if (op_type == "Relu" && ConstantValue(inputs[0], value, like)) {
+      return MakeConstant(like, std::max(value, 0.0f));
+    }
+
+    if (op_type == "Add" || op_type == "Minus" ||
+        op_type == "Multiply" || op_type == "Devide") {
+      return SimplifyBinary(node, op_type, inputs[0], inputs[1]);
+    }
+
+    if (op_type == "AddN") {
+      std::vector<Node> terms;
+      for (auto& input : inputs) {
+        if (!IsZeros(input)) terms.push_back(input);
+      }
+      if (terms.empty()) return MakeConstant(inputs[0], 0);
+      if (terms.size() == 1) return terms[0];
+      return terms.size() == inputs.size() ? node : AddNOperator(terms);
+    }
+
+    if (op_type == "ReduceSumTo" || op_type == "BroadCastTo") {
+      if (SameShape(inputs[0], inputs[1])) return inputs[0];
+      if (ConstantValue(inputs[0], value, like) &&
+          (value == 0 || op_type == "BroadCastTo")) {
+        return MakeConstant(inputs[1], value);
+      }
+      return node;
+    }
+
+    if (op_type == "ReduceGrad" && IsZeros(inputs[0])) {
+      return MakeConstant(inputs[1], 0);
+    }
+    return node;
+  }
+
+  Node SimplifyBinary(const Node& node, const std::string& op_type,
+                      const Node& lhs, const Node& rhs) {
+    float lhs_val = 0.0, rhs_val = 0.0;
+    Node lhs_like, rhs_like;
+    bool lhs_const = ConstantValue(lhs, lhs_val, lhs_like);
+    bool rhs_const = ConstantValue(rhs, rhs_val, rhs_like);
+
+    if (lhs_const && rhs_const && SameShape(lhs_like, rhs_like)) {
+      return MakeConstant(lhs_like, Apply(op_type, lhs_val, rhs_val));
+    }
+
+    // A constant that does not change the other side's shape turns the op
+    // into its by-const form, which the unary rules then simplify further.
+    if (rhs_const && (SameShape(lhs, rhs_like) || IsScalar(rhs_like))) {
+      if (op_type == "Add") return AddByConstOperator(lhs, rhs_val);
+      if (op_type == "Minus") return MinusByConstOperator(lhs, rhs_val);
+      if (op_type == "Multiply") return MultiplyByConstOperator(lhs, rhs_val);
+      return DevideByConstOperator(lhs, rhs_val);
+    }
+    if (lhs_const && (SameShape(rhs, lhs_like) || IsScalar(lhs_like))) {
+      if (op_type == "Add") return AddByConstOperator(rhs, lhs_val);
+      if (op_type == "Multiply") return MultiplyByConstOperator(rhs, lhs_val);
+      if (op_type == "Minus" && lhs_val == 0) {
+        return MultiplyByConstOperator(rhs, -1);
+      }
+    }
+
+    if (op_type == "Add" || op_type == "Minus") {
+      bool add = op_type == "Add";
+      if (IsNegation(rhs)) {
+        Node negated = NegationInput(rhs);
+        return add ? MinusOperator(lhs, negated) : AddOperator(lhs, negated);
+      }
+      if (add && IsNegation(lhs)) {
+        return MinusOperator(rhs, NegationInput(lhs));
+      }
+    }
+    return node;
+  }
+
+  static bool IsNegation(const Node& node) {
+    return OpType(node) == "MultiplyByConst" && ConstVal(node) == -1;
+  }
+
+  static Node NegationInput(const Node& node) {
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    return inputs[0];
+  }
+
+  std::unordered_map<Node, Node> rewritten_;
+  std::unordered_map<Node, Node> shape_roots_;
+};
+
+// DenseFusion turns the forward pattern of a dense layer, MatMul(x, w) plus a
+// bias and optionally followed by Relu, into one Dense node. The bias is a
+// variable or BroadCastTo(b, product). A product or pre-activation that any
+// other node reads is left alone, fusing it would compute it twice.
+class DenseFusion {
+public:
+  Node Fuse(const Node& root) {
+    CountUses(root);
+    return FuseNode(root);
+  }
+
+  // The node that replaced node, node itself if it was not fused.
+  Node Lookup(const Node& node) const {
+    auto iter = fused_.find(node);
+    return iter == fused_.end() ? node : iter->second;
+  }
+
+private:
+  static std::string OpType(const Node& node) {
+    return node.GetOp() == nullptr ? "" : node.GetOp()->GetOpType();
+  }
+
+  void CountUses(const Node& root) {
+    std::unordered_set<Node> visited = {root};
+    std::vector<Node> stack = {root};
+    while (!stack.empty()) {
+      Node node = stack.back();
+      stack.pop_back();
+      std::vector<Node> inputs;
+      node.GetInputNodes(inputs);
+      for (auto& input : inputs) {
+        uses_[input]++;
+        if (visited.insert(input).second) stack.push_back(input);
+      }
+    }
+  }
+
+  int Uses(const Node& node) const {
+    auto iter = uses_.find(node);
+    return iter == uses_.end() ? 0 : iter->second;
+  }
+
+  Node FuseNode(const Node& node) {
+    auto iter = fused_.find(node);
+    if (iter != fused_.end()) return iter->second;
+
+    Node result = node;
+    if (!node.IsVariable() && !Match(node, result)) {
+      std::vector<Node> inputs;
+      node.GetInputNodes(inputs);
+      bool changed = false;
+      for (auto& input : inputs) {
+        Node new_input = FuseNode(input);
+        changed = changed || new_input.id() != input.id();
+        input = new_input;
+      }
+      if (changed) result = node.WithInputs(inputs);
+    }
+    fused_[node] = result;
+    return result;
+  }
+
+  bool Match(const Node& node, Node& result) {
+    std::string op_type = OpType(node);
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+
+    if (op_type == "Relu") {
+      if (Uses(inputs[0]) != 1) return false;
+      Node pre = FuseNode(inputs[0]);
+      std::string activation;
+      pre.GetAttr("activation", activation);
+      if (OpType(pre) != "Dense" || activation != "none") return false;
+      std::vector<Node> dense_inputs;
+      pre.GetInputNodes(dense_inputs);
+      result = DenseOperator(dense_inputs[0], dense_inputs[1],
+                             dense_inputs[2], "relu");
+      return true;
+    }
+
+    if (op_type != "Add") return false;
+    for (int side = 0; side < 2; side++) {
+      const Node& product = inputs[side];
+      const Node& bias = inputs[1 - side];
+      bool trans_a = false, trans_b = false;
+      product.GetAttr("trans_a", trans_a);
+      product.GetAttr("trans_b", trans_b);
+      if (OpType(product) != "MatMul" || trans_a || trans_b) continue;
+
+      std::vector<Node> bias_inputs;
+      bias.GetInputNodes(bias_inputs);
+      Node b;
+      if (bias.IsVariable() && Uses(product) == 1) {
+        b = bias;
+      } else if (OpType(bias) == "BroadCastTo" &&
+                 bias_inputs[1].id() == product.id() &&
+                 Uses(product) == 2 && Uses(bias) == 1) {
+        b = bias_inputs[0];
+      } else {
+        continue;
+      }
+      std::vector<Node> product_inputs;
+      product.GetInputNodes(product_inputs);
+      result = DenseOperator(FuseNode(product_inputs[0]),
+                             FuseNode(product_inputs[1]), FuseNode(b));
+      return true;
+    }
+    return false;
+  }
+
+  std::unordered_map<Node, int> uses_;
+  std::unordered_map<Node, Node> fused_;
+};
+
+#endif  // GRAPH_REWRITE_H_
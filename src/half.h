@@ -0,0 +1,194 @@
+#ifndef HALF_H_
+#define HALF_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "data_type.h"
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// 16 bit floating point storage. BFloat16 is the top half of a float, with
+// its range and an 8 bit mantissa. Float16 is IEEE half precision, 11 bits of
+// mantissa but a largest value of 65504 and subnormals below 6.1e-5, so fp16
+// gradients usually need loss scaling. Both round to nearest even and are
+// converted to float for every operation.
+
+inline float BFloat16ToFloat(uint16_t bits) {
+  uint32_t u = static_cast<uint32_t>(bits) << 16;
+  float val;
+  memcpy(&val, &u, sizeof(val));
+  return val;
+}
+
+inline uint16_t FloatToBFloat16(float val) {
+  uint32_t u;
+  memcpy(&u, &val, sizeof(u));
+  // Rounding would carry a NaN's mantissa into infinity, keep it a NaN.
+  if ((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x40;
+  u += 0x7fff + ((u >> 16) & 1);
+  return u >> 16;
+}
+
+inline float Float16ToFloat(uint16_t bits) {
+#if defined(__F16C__)
+  return _cvtsh_ss(bits);
+#else
+  uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+  int32_t exp = (bits >> 10) & 0x1f;
+  uint32_t mant = bits & 0x3ff;
+  uint32_t u;
+  if (exp == 0x1f) {
+    u = sign | 0x7f800000 | (mant << 13);
+  } else if (exp == 0 && mant == 0) {
+    u = sign;
+  } else {
+    if (exp == 0) {
+      // Subnormal, normalize it.
+      exp = 1;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        exp--;
+      }
+      mant &= 0x3ff;
+    }
+    u = sign | static_cast<uint32_t>(exp + 112) << 23 | mant << 13;
+  }
+  float val;
+  memcpy(&val, &u, sizeof(val));
+  return val;
+#endif
+}
+
+inline uint16_t FloatToFloat16(float val) {
+#if defined(__F16C__)
+  return _cvtss_sh(val, _MM_FROUND_TO_NEAREST_INT);
+#else
+  uint32_t u;
+  memcpy(&u, &val, sizeof(u));
+  uint16_t sign = (u >> 16) & 0x8000;
+  uint32_t abs = u & 0x7fffffff;
+  if (abs > 0x7f800000) return sign | 0x7e00;
+  // 65520 and up round to infinity.
+  if (abs >= 0x477ff000) return sign | 0x7c00;
+  if (abs < 0x38800000) {
+    // Below 2^-14 the result is subnormal, in units of 2^-24.
+    float scaled = std::fabs(val) * 16777216.0f;
+    return sign | static_cast<uint16_t>(std::nearbyint(scaled));
+  }
+  abs += 0xfff + ((abs >> 13) & 1);
+  return sign | static_cast<uint16_t>((abs - 0x38000000) >> 13);
+#endif
+}
+
+struct BFloat16 {
+  uint16_t bits;
+
+  BFloat16() = default;
+  BFloat16(float val) : bits(FloatToBFloat16(val)) {}
+  operator float() const { return BFloat16ToFloat(bits); }
+};
+
+struct Float16 {
+  uint16_t bits;
+
+  Float16() = default;
+  Float16(float val) : bits(FloatToFloat16(val)) {}
+  operator float() const { return Float16ToFloat(bits); }
+};
+
+template <typename T>
+struct DataTypeOf;
+
+template <>
+struct DataTypeOf<float> {
+  static const DataType value = DataType::kFloat32;
+};
+
+template <>
+struct DataTypeOf<BFloat16> {
+  static const DataType value = DataType::kBFloat16;
+};
+
+template <>
+struct DataTypeOf<Float16> {
+  static const DataType value = DataType::kFloat16;
+};
+
+// Bulk conversions between float and the storage types, y[i] = x[i] for i in
+// [0, n). The float overloads copy, so templated kernels call them for every
+// element type.
+inline void ConvertToFloat(const float* x, int64_t n, float* y) {
+  memcpy(y, x, n * sizeof(float));
+}
+
+inline void ConvertFromFloat(const float* x, int64_t n, float* y) {
+  memcpy(y, x, n * sizeof(float));
+}
+
+inline void ConvertToFloat(const BFloat16* x, int64_t n, float* y) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    __m256i u = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+    _mm256_storeu_ps(y + i, _mm256_castsi256_ps(u));
+  }
+#endif
+  for (; i < n; i++) y[i] = x[i];
+}
+
+inline void ConvertFromFloat(const float* x, int64_t n, BFloat16* y) {
+  int64_t i = 0;
+#if defined(__AVX512BF16__) && defined(__AVX512VL__)
+  // Unlike the scalar rounding, this flushes fp32 subnormals to zero.
+  for (; i + 8 <= n; i += 8) {
+    __m128bh h = _mm256_cvtneps_pbh(_mm256_loadu_ps(x + i));
+    memcpy(y + i, &h, sizeof(h));
+  }
+#elif defined(__AVX2__)
+  const __m256i nan_bit = _mm256_set1_epi32(0x400000);
+  for (; i + 8 <= n; i += 8) {
+    __m256i u = _mm256_castps_si256(_mm256_loadu_ps(x + i));
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16),
+                                   _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_add_epi32(
+        u, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff)));
+    __m256i abs = _mm256_and_si256(u, _mm256_set1_epi32(0x7fffffff));
+    __m256i nan = _mm256_cmpgt_epi32(abs, _mm256_set1_epi32(0x7f800000));
+    rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(u, nan_bit), nan);
+    __m256i h = _mm256_srli_epi32(rounded, 16);
+    h = _mm256_permute4x64_epi64(_mm256_packus_epi32(h, h), 0xd8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i),
+                     _mm256_castsi256_si128(h));
+  }
+#endif
+  for (; i < n; i++) y[i] = x[i];
+}
+
+inline void ConvertToFloat(const Float16* x, int64_t n, float* y) {
+  int64_t i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; i < n; i++) y[i] = x[i];
+}
+
+inline void ConvertFromFloat(const float* x, int64_t n, Float16* y) {
+  int64_t i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(x + i),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), h);
+  }
+#endif
+  for (; i < n; i++) y[i] = x[i];
+}
+
+#endif  // HALF_H_
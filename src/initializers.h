@@ -0,0 +1,88 @@
+#ifndef INITIALIZERS_H_
+#define INITIALIZERS_H_
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include "random.h"
+#include "tensor.h"
+
+// Parameter initializers on the Philox generator of random.h. A tensor
+// initialized with a seed always gets the same values, whatever the number
+// of threads. Give each parameter its own seed, or its own stream under a
+// shared seed.
+
+inline void RandomUniform(Tensor& tensor, float low, float high,
+                          uint64_t seed, uint32_t stream = 0) {
+  PhiloxUniform(seed, stream, low, high, tensor.NumElements(),
+                tensor.GetHandle());
+}
+
+inline void RandomNormal(Tensor& tensor, float mean, float stddev,
+                         uint64_t seed, uint32_t stream = 0) {
+  PhiloxNormal(seed, stream, mean, stddev, tensor.NumElements(),
+               tensor.GetHandle());
+}
+
+// Normal, redrawn while more than two stddev from the mean.
+inline void TruncatedNormal(Tensor& tensor, float mean, float stddev,
+                            uint64_t seed, uint32_t stream = 0) {
+  PhiloxTruncatedNormal(seed, stream, mean, stddev, tensor.NumElements(),
+                        tensor.GetHandle());
+}
+
+// The fan in and fan out of a weight: [in, out] for Dense and MatMul,
+// HWIO filters for NHWC convolutions and OIHW filters for NCHW ones.
+inline void WeightFans(const TensorShape& shape,
+                       const std::string& data_format, int64_t& fan_in,
+                       int64_t& fan_out) {
+  if (shape.NumDims() == 4) {
+    bool nhwc = data_format == "NHWC";
+    assert(nhwc || data_format == "NCHW");
+    int64_t window = nhwc ? shape.DimSize(0) * shape.DimSize(1) :
+                            shape.DimSize(2) * shape.DimSize(3);
+    fan_in = window * (nhwc ? shape.DimSize(2) : shape.DimSize(1));
+    fan_out = window * (nhwc ? shape.DimSize(3) : shape.DimSize(0));
+  } else {
+    assert(shape.NumDims() == 2);
+    fan_in = shape.DimSize(0);
+    fan_out = shape.DimSize(1);
+  }
+}
+
+// Glorot and Bengio, uniform in +-sqrt(6 / (fan_in + fan_out)).
+inline void XavierUniform(Tensor& w, uint64_t seed,
+                          const std::string& data_format = "NHWC") {
+  int64_t fan_in, fan_out;
+  WeightFans(w.GetTensorShape(), data_format, fan_in, fan_out);
+  float limit = std::sqrt(6.0f / (fan_in + fan_out));
+  RandomUniform(w, -limit, limit, seed);
+}
+
+// Glorot and Bengio, normal with stddev sqrt(2 / (fan_in + fan_out)).
+inline void XavierNormal(Tensor& w, uint64_t seed,
+                         const std::string& data_format = "NHWC") {
+  int64_t fan_in, fan_out;
+  WeightFans(w.GetTensorShape(), data_format, fan_in, fan_out);
+  RandomNormal(w, 0.0f, std::sqrt(2.0f / (fan_in + fan_out)), seed);
+}
+
+// He et al. for relu layers, uniform in +-sqrt(6 / fan_in).
+inline void HeUniform(Tensor& w, uint64_t seed,
+                      const std::string& data_format = "NHWC") {
+  int64_t fan_in, fan_out;
+  WeightFans(w.GetTensorShape(), data_format, fan_in, fan_out);
+  float limit = std::sqrt(6.0f / fan_in);
+  RandomUniform(w, -limit, limit, seed);
+}
+
+// He et al. for relu layers, normal with stddev sqrt(2 / fan_in).
+inline void HeNormal(Tensor& w, uint64_t seed,
+                     const std::string& data_format = "NHWC") {
+  int64_t fan_in, fan_out;
+  WeightFans(w.GetTensorShape(), data_format, fan_in, fan_out);
+  RandomNormal(w, 0.0f, std::sqrt(2.0f / fan_in), seed);
+}
+
+#endif  // INITIALIZERS_H_
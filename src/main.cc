@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include "data_reader.h"
 #include "executor.h"
+#include "initializers.h"
 #include "operator.h"
 
 
@@ -14,7 +15,7 @@ int main() {
   Node x("x");
   Node y_("y_");
   Node z = MatMulOperator(x, weights);
-  Node logit = z + BroadCastToOperator(bias, z);
+  Node logit = z + bias;
   Node loss = SoftmaxCrossEntropyOperator(logit, y_);
   Context ctx = Context::cpu();
   Executor exec(ctx, loss, {weights, bias});
@@ -25,8 +26,7 @@ int main() {
   Tensor y_val(TensorShape(batch_size, 10), ctx);
 
   Tensor w_val(TensorShape(784, 10), ctx);
-  std::vector<float> ws(784 * 10, 0.0);
-  w_val.SyncFromVector(ws, 784 * 10);
+  XavierUniform(w_val, 1);
   
   Tensor b_val(TensorShape(10), ctx);
   std::vector<float> bs(10, 0.0);
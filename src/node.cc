@@ -1,6 +1,86 @@
+#include <mutex>
 #include "node.h"
 #include "operator.h"
 
+namespace {
+
+struct NodeKey {
+  Op* op;
+  std::vector<int64_t> input_ids;
+  AttrMap attrs;
+
+  bool operator==(const NodeKey& rhs) const {
+    return op == rhs.op && input_ids == rhs.input_ids && attrs == rhs.attrs;
+  }
+};
+
+struct NodeKeyHash {
+  size_t operator()(const NodeKey& key) const {
+    size_t h = std::hash<Op*>()(key.op);
+    for (int64_t id : key.input_ids) {
+      h ^= id + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    h ^= key.attrs.Hash() + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+// Hash-consing table handing out node ids. It only grows, but building the
+// same graph again maps onto the existing entries.
+class NodeTable {
+public:
+  static NodeTable* Global() {
+    static NodeTable* table = new NodeTable();
+    return table;
+  }
+
+  int64_t Intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto iter = variables_.find(name);
+    if (iter != variables_.end()) return iter->second;
+    return variables_[name] = next_id_++;
+  }
+
+  int64_t Intern(const NodeKey& key) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto iter = nodes_.find(key);
+    if (iter != nodes_.end()) return iter->second;
+    return nodes_[key] = next_id_++;
+  }
+
+private:
+  std::mutex mu_;
+  int64_t next_id_ = 0;
+  std::unordered_map<std::string, int64_t> variables_;
+  std::unordered_map<NodeKey, int64_t, NodeKeyHash> nodes_;
+};
+
+}  // namespace
+
+int64_t Node::InternVariable(const std::string& name) {
+  return NodeTable::Global()->Intern(name);
+}
+
+void Node::Intern() {
+  NodeKey key;
+  key.op = op_;
+  if (inputs_) {
+    for (auto& input : *inputs_) {
+      key.input_ids.push_back(input.id());
+    }
+  }
+  key.attrs = attrs_;
+  id_ = NodeTable::Global()->Intern(key);
+}
+
+Node Node::WithInputs(const std::vector<Node>& inputs) const {
+  Node node = *this;
+  node.inputs_ = std::make_shared<std::vector<Node>>(inputs);
+  node.SetName();
+  node.Intern();
+  return node;
+}
+
 Node Node::operator+(const Node& rhs) const {
   return AddOperator(*this, rhs);
 } 
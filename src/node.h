@@ -1,24 +1,30 @@
 #ifndef NODE_H_
 #define NODE_H_
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include "attr_value.h"
 #include "op.h"
 
 class Node {
 public:
   Node() = default;
 
-  explicit Node(const std::string& name) : name_(name) {}
+  // A variable, variables with the same name are the same node.
+  explicit Node(const std::string& name) 
+      : name_(name), id_(InternVariable(name)) {}
 
   Node(const Node& rhs) 
       : name_(rhs.name_), 
         inputs_(rhs.inputs_), 
         attrs_(rhs.attrs_), 
-        op_(rhs.op_) {
+        op_(rhs.op_),
+        id_(rhs.id_) {
   }
 
   Node& operator=(const Node& rhs) {
@@ -27,6 +33,7 @@ public:
       inputs_ = rhs.inputs_;
       attrs_ = rhs.attrs_;
       op_ = rhs.op_;
+      id_ = rhs.id_;
     }
     return *this;
   }
@@ -49,68 +56,96 @@ public:
   Node& operator/=(const Node& rhs);
 
   void GetInputNodes(std::vector<Node>& input_nodes) const {
-    input_nodes = inputs_;
+    if (inputs_) {
+      input_nodes = *inputs_;
+    } else {
+      input_nodes.clear();
+    }
   }
 
   template <typename T>
   void PushInput(const T& t) {
-    inputs_.push_back(t);
+    MutableInputs().push_back(t);
   }
 
   template <typename T, typename... Args>
   void PushInput(const T& t, const Args&... args) {
-    inputs_.push_back(t); 
+    MutableInputs().push_back(t); 
     if (sizeof...(args) != 0) {
       PushInput(args...);
     }
   }
 
   template <typename T>
-  void SetAttr(const std::string& key, const T& val) {
-    std::string val_str;
-    std::stringstream ss;
-    ss << val;
-    ss >> val_str;   
-    attrs_[key] = val_str;
+  void SetAttr(const AttrKey& key, const T& val) {
+    attrs_.Set(key, AttrValue(val));
+    if (op_ != nullptr) Intern();
   }
 
+  // Ops should pass keys interned once (static AttrKey), string literals
+  // work as well but pay for the interning on every call.
   template <typename T>
-  bool GetAttr(const std::string& key, T& val) const {
-    auto iter = attrs_.find(key);
-    if (iter != attrs_.end()) {
-      std::stringstream ss;
-      ss << iter->second;
-      ss >> val; 
-      return true;
-    } else {
-      return false;
-    }
+  bool GetAttr(const AttrKey& key, T& val) const {
+    const AttrValue* attr = attrs_.Find(key);
+    return attr != nullptr && attr->Get(val);
   }
 
-  void SetOp(std::shared_ptr<Op> op) {
+  const AttrMap& GetAttrs() const { return attrs_; }
+
+  void SetOp(Op* op) {
     op_ = op;
   }
 
+  // Inputs other than variables are named by id, so names stay short
+  // however deep the graph is.
   void SetName() {
     name_ = op_->GetOpType() + "(";
-    for (auto input : inputs_) {
-      name_ += (input.name() + ",");
+    if (inputs_) {
+      for (auto& input : *inputs_) {
+        name_ += input.IsVariable() ? 
+            input.name() : "#" + std::to_string(input.id());
+        name_ += ",";
+      }
     }
     name_.resize(name_.size() - 1);
     name_ += ")";
   }
 
+  // Gives the node the id of the first node built with the same op,
+  // attributes and inputs, so identical subexpressions share one id and are
+  // evaluated once.
+  void Intern();
+
+  int64_t id() const { return id_; }
+
+  // The same op and attributes applied to other inputs.
+  Node WithInputs(const std::vector<Node>& inputs) const;
+
   const std::string& name() const { return name_; }
 
-  std::shared_ptr<Op> GetOp() const { return op_; }
+  Op* GetOp() const { return op_; }
 
-  bool IsVariable() const { return inputs_.size() == 0; }
+  bool IsVariable() const { return !inputs_ || inputs_->empty(); }
 
 private:
   std::string name_;
-  std::vector<Node> inputs_;
-  std::unordered_map<std::string, std::string> attrs_;
-  std::shared_ptr<Op> op_;
+  // Shared between copies, so copying a node never copies the graph under
+  // it. Copied before the first write when shared.
+  std::shared_ptr<std::vector<Node>> inputs_;
+  AttrMap attrs_;
+  Op* op_ = nullptr;
+  int64_t id_ = -1;
+
+  static int64_t InternVariable(const std::string& name);
+
+  std::vector<Node>& MutableInputs() {
+    if (!inputs_) {
+      inputs_ = std::make_shared<std::vector<Node>>();
+    } else if (inputs_.use_count() > 1) {
+      inputs_ = std::make_shared<std::vector<Node>>(*inputs_);
+    }
+    return *inputs_;
+  }
 };
 
 Node operator+(float val, const Node& node);
@@ -122,14 +157,14 @@ namespace std {
 template <>
 struct hash<Node> {
   size_t operator()(const Node& node) const {
-    return std::hash<std::string>()(node.name());
+    return std::hash<int64_t>()(node.id());
   }
 };
 
 template <>
 struct equal_to<Node> {
   bool operator()(const Node& lhs, const Node& rhs) const {
-    return lhs.name() == rhs.name();
+    return lhs.id() == rhs.id();
   }
 };
 
@@ -0,0 +1,323 @@
+#ifndef NORM_H_
+#define NORM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "thread_pool.h"
+
+// LayerNorm and BatchNorm kernels for [rows, cols] activations. LayerNorm
+// normalizes each row, BatchNorm each column.
+//
+// Mean and variance come from a single read of x with Welford's update,
+// run on many independent accumulators at once so the loops vectorize:
+// kNormLanes interleaved lanes of a row for LayerNorm, the columns of a block
+// of rows for BatchNorm. Partial moments are merged with Chan's formula, so
+// BatchNorm reduces its row blocks in parallel and merges them in a fixed
+// order.
+//
+// The backward passes need sum(g) and sum(g * xhat) for the incoming
+// gradient g. Both follow from the mean of g and the co-moment
+// sum((x - mean) * g), which are accumulated next to the statistics of x.
+// That makes each backward pass one sweep for statistics and one writing
+// the gradient.
+
+const int kNormLanes = 32;
+
+// Rows per task of the elementwise sweeps is about this many elements.
+const int64_t kNormGrain = 1 << 14;
+
+// BatchNorm statistics use at most this many row blocks, so partials stay
+// small and results do not depend on the number of threads.
+const int64_t kNormMaxBlocks = 64;
+
+struct Moments {
+  float count;
+  float mean, m2;
+  // Mean of g and the co-moment sum((x - mean) * (g - g_mean)).
+  float g_mean, cov;
+};
+
+inline Moments MergeMoments(const Moments& a, const Moments& b) {
+  if (b.count == 0) return a;
+  if (a.count == 0) return b;
+  Moments m;
+  m.count = a.count + b.count;
+  const float weight = b.count / m.count;
+  const float delta = b.mean - a.mean;
+  const float g_delta = b.g_mean - a.g_mean;
+  m.mean = a.mean + delta * weight;
+  m.m2 = a.m2 + b.m2 + delta * delta * a.count * weight;
+  m.g_mean = a.g_mean + g_delta * weight;
+  m.cov = a.cov + b.cov + delta * g_delta * a.count * weight;
+  return m;
+}
+
+// One Welford step for n accumulators, accumulator i taking sample x[i], and
+// g[i] unless g is null. inv is 1 over the count including this sample.
+inline void WelfordStep(const float* x, const float* g, int64_t n, float inv,
+                        float* mean, float* m2, float* g_mean, float* cov) {
+  if (g == nullptr) {
+    for (int64_t i = 0; i < n; i++) {
+      const float delta = x[i] - mean[i];
+      mean[i] += delta * inv;
+      m2[i] += delta * (x[i] - mean[i]);
+    }
+    return;
+  }
+  for (int64_t i = 0; i < n; i++) {
+    const float delta = x[i] - mean[i];
+    mean[i] += delta * inv;
+    m2[i] += delta * (x[i] - mean[i]);
+    g_mean[i] += (g[i] - g_mean[i]) * inv;
+    cov[i] += delta * (g[i] - g_mean[i]);
+  }
+}
+
+// Moments of x[0, n), with those of g[0, n) unless g is null.
+template <bool kWithGrad>
+inline Moments RowMomentsImpl(const float* x, const float* g, int64_t n) {
+  float mean[kNormLanes] = {};
+  float m2[kNormLanes] = {};
+  float g_mean[kNormLanes] = {};
+  float cov[kNormLanes] = {};
+  float count = 0;
+  int64_t i = 0;
+  for (; i + kNormLanes <= n; i += kNormLanes) {
+    count += 1;
+    const float inv = 1.0f / count;
+    for (int l = 0; l < kNormLanes; l++) {
+      const float delta = x[i + l] - mean[l];
+      mean[l] += delta * inv;
+      m2[l] += delta * (x[i + l] - mean[l]);
+      if (kWithGrad) {
+        g_mean[l] += (g[i + l] - g_mean[l]) * inv;
+        cov[l] += delta * (g[i + l] - g_mean[l]);
+      }
+    }
+  }
+
+  Moments m = {0, 0, 0, 0, 0};
+  for (int l = 0; l < kNormLanes && count > 0; l++) {
+    m = MergeMoments(m, {count, mean[l], m2[l], g_mean[l], cov[l]});
+  }
+  for (; i < n; i++) {
+    m = MergeMoments(m, {1, x[i], 0, kWithGrad ? g[i] : 0, 0});
+  }
+  return m;
+}
+
+inline Moments RowMoments(const float* x, const float* g, int64_t n) {
+  return g == nullptr ? RowMomentsImpl<false>(x, g, n) :
+                        RowMomentsImpl<true>(x, g, n);
+}
+
+// Moments of every column of x [rows, cols], with those of g unless g is
+// null. moments has cols entries.
+inline void ColumnMoments(const float* x, const float* g, int64_t rows,
+                          int64_t cols, Moments* moments) {
+  const int64_t block_rows = std::max<int64_t>(
+      (rows + kNormMaxBlocks - 1) / kNormMaxBlocks,
+      std::max<int64_t>(1, kNormGrain / std::max<int64_t>(cols, 1)));
+  const int64_t blocks = (rows + block_rows - 1) / block_rows;
+  // Per block: mean, m2, g_mean and cov of every column.
+  std::vector<float> partials(blocks * 4 * cols, 0.0f);
+
+  ThreadPool::Global()->ParallelFor(blocks, [&](int64_t block) {
+    float* mean = partials.data() + block * 4 * cols;
+    float* m2 = mean + cols;
+    float* g_mean = m2 + cols;
+    float* cov = g_mean + cols;
+    const int64_t begin = block * block_rows;
+    const int64_t end = std::min(rows, begin + block_rows);
+    for (int64_t r = begin; r < end; r++) {
+      WelfordStep(x + r * cols, g == nullptr ? g : g + r * cols, cols,
+                  1.0f / (r - begin + 1), mean, m2, g_mean, cov);
+    }
+  });
+
+  ThreadPool::Global()->ParallelForRange(cols, kNormGrain / kNormMaxBlocks,
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t c = begin; c < end; c++) {
+      Moments m = {0, 0, 0, 0, 0};
+      for (int64_t block = 0; block < blocks; block++) {
+        const float* partial = partials.data() + block * 4 * cols;
+        const float count = static_cast<float>(
+            std::min(rows, (block + 1) * block_rows) - block * block_rows);
+        m = MergeMoments(m, {count, partial[c], partial[cols + c],
+                             partial[2 * cols + c], partial[3 * cols + c]});
+      }
+      moments[c] = m;
+    }
+  });
+}
+
+inline int64_t NormRowGrain(int64_t cols) {
+  return std::max<int64_t>(1, kNormGrain / std::max<int64_t>(cols, 1));
+}
+
+// y = (x - mean) / sqrt(var + epsilon) * gamma + beta over each row.
+inline void LayerNormForward(const float* x, const float* gamma,
+                             const float* beta, int64_t rows, int64_t cols,
+                             float epsilon, float* y) {
+  ThreadPool::Global()->ParallelForRange(rows, NormRowGrain(cols),
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* src = x + r * cols;
+      float* dst = y + r * cols;
+      Moments m = RowMoments(src, nullptr, cols);
+      const float rstd = 1.0f / std::sqrt(m.m2 / cols + epsilon);
+      for (int64_t c = 0; c < cols; c++) {
+        dst[c] = (src[c] - m.mean) * rstd * gamma[c] + beta[c];
+      }
+    }
+  });
+}
+
+// dx = rstd * (g - mean(g) - xhat * mean(g * xhat)) with g = dy * gamma.
+inline void LayerNormBackwardInput(const float* dy, const float* x,
+                                   const float* gamma, int64_t rows,
+                                   int64_t cols, float epsilon, float* dx) {
+  ThreadPool::Global()->ParallelForRange(rows, NormRowGrain(cols),
+                                         [&](int64_t begin, int64_t end) {
+    static thread_local std::vector<float> g;
+    g.resize(cols);
+    for (int64_t r = begin; r < end; r++) {
+      const float* src = x + r * cols;
+      const float* grad = dy + r * cols;
+      float* dst = dx + r * cols;
+      for (int64_t c = 0; c < cols; c++) {
+        g[c] = grad[c] * gamma[c];
+      }
+      Moments m = RowMoments(src, g.data(), cols);
+      const float rstd = 1.0f / std::sqrt(m.m2 / cols + epsilon);
+      const float g_xhat_mean = rstd * m.cov / cols;
+      for (int64_t c = 0; c < cols; c++) {
+        const float xhat = (src[c] - m.mean) * rstd;
+        dst[c] = rstd * (g[c] - m.g_mean - xhat * g_xhat_mean);
+      }
+    }
+  });
+}
+
+// dgamma = sum of dy * xhat over the rows. Row ranges are summed in parallel
+// into partials that are added up in order.
+inline void LayerNormBackwardGamma(const float* dy, const float* x,
+                                   int64_t rows, int64_t cols, float epsilon,
+                                   float* dgamma) {
+  const int64_t grain = std::max(NormRowGrain(cols),
+                                 (rows + kNormMaxBlocks - 1) / kNormMaxBlocks);
+  const int64_t blocks = (rows + grain - 1) / grain;
+  std::vector<float> partials(blocks * cols, 0.0f);
+  ThreadPool::Global()->ParallelForRange(rows, grain,
+                                         [&](int64_t begin, int64_t end) {
+    float* partial = partials.data() + (begin / grain) * cols;
+    for (int64_t r = begin; r < end; r++) {
+      const float* src = x + r * cols;
+      const float* grad = dy + r * cols;
+      Moments m = RowMoments(src, nullptr, cols);
+      const float rstd = 1.0f / std::sqrt(m.m2 / cols + epsilon);
+      for (int64_t c = 0; c < cols; c++) {
+        partial[c] += grad[c] * (src[c] - m.mean) * rstd;
+      }
+    }
+  });
+
+  std::fill(dgamma, dgamma + cols, 0.0f);
+  for (int64_t block = 0; block < blocks; block++) {
+    for (int64_t c = 0; c < cols; c++) {
+      dgamma[c] += partials[block * cols + c];
+    }
+  }
+}
+
+// y = x * scale + shift with per-column scale and shift.
+inline void ColumnAffine(const float* x, const float* scale,
+                         const float* shift, int64_t rows, int64_t cols,
+                         float* y) {
+  ThreadPool::Global()->ParallelForRange(rows, NormRowGrain(cols),
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* src = x + r * cols;
+      float* dst = y + r * cols;
+      for (int64_t c = 0; c < cols; c++) {
+        dst[c] = src[c] * scale[c] + shift[c];
+      }
+    }
+  });
+}
+
+// Normalizes each column of x with the given mean and variance, or with its
+// own when mean and var are null, then applies gamma and beta.
+inline void BatchNormForward(const float* x, const float* gamma,
+                             const float* beta, const float* mean,
+                             const float* var, int64_t rows, int64_t cols,
+                             float epsilon, float* y) {
+  std::vector<Moments> moments;
+  if (mean == nullptr) {
+    moments.resize(cols);
+    ColumnMoments(x, nullptr, rows, cols, moments.data());
+  }
+  std::vector<float> scale(cols);
+  std::vector<float> shift(cols);
+  for (int64_t c = 0; c < cols; c++) {
+    const float mu = mean == nullptr ? moments[c].mean : mean[c];
+    const float sigma2 = var == nullptr ? moments[c].m2 / rows : var[c];
+    scale[c] = gamma[c] / std::sqrt(sigma2 + epsilon);
+    shift[c] = beta[c] - mu * scale[c];
+  }
+  ColumnAffine(x, scale.data(), shift.data(), rows, cols, y);
+}
+
+// Gradients of BatchNormForward. With batch statistics dx = gamma * rstd *
+// (dy - mean(dy) - xhat * mean(dy * xhat)) per column; with given ones dx is
+// dy * gamma * rstd. Either of dx and dgamma may be null.
+inline void BatchNormBackward(const float* dy, const float* x,
+                              const float* gamma, const float* mean,
+                              const float* var, int64_t rows, int64_t cols,
+                              float epsilon, float* dx, float* dgamma) {
+  std::vector<Moments> moments;
+  if (mean == nullptr || dgamma != nullptr) {
+    moments.resize(cols);
+    ColumnMoments(x, dy, rows, cols, moments.data());
+  }
+
+  // dx = dy * scale + x * x_scale + shift, the terms folded per column.
+  std::vector<float> scale(cols);
+  std::vector<float> shift(cols);
+  std::vector<float> x_scale(cols);
+  for (int64_t c = 0; c < cols; c++) {
+    const float mu = mean == nullptr ? moments[c].mean : mean[c];
+    const float sigma2 = var == nullptr ? moments[c].m2 / rows : var[c];
+    const float rstd = 1.0f / std::sqrt(sigma2 + epsilon);
+    if (dgamma != nullptr) {
+      // sum(dy * (x - mu)) = cov + (mean(x) - mu) * sum(dy)
+      dgamma[c] = rstd * (moments[c].cov + (moments[c].mean - mu) * rows *
+                                               moments[c].g_mean);
+    }
+    scale[c] = gamma[c] * rstd;
+    shift[c] = 0;
+    x_scale[c] = 0;
+    if (mean == nullptr) {
+      const float g_xhat_mean = rstd * moments[c].cov / rows;
+      x_scale[c] = -scale[c] * rstd * g_xhat_mean;
+      shift[c] = -scale[c] * moments[c].g_mean - x_scale[c] * mu;
+    }
+  }
+  if (dx == nullptr) return;
+
+  ThreadPool::Global()->ParallelForRange(rows, NormRowGrain(cols),
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* src = x + r * cols;
+      const float* grad = dy + r * cols;
+      float* dst = dx + r * cols;
+      for (int64_t c = 0; c < cols; c++) {
+        dst[c] = grad[c] * scale[c] + src[c] * x_scale[c] + shift[c];
+      }
+    }
+  });
+}
+
+#endif  // NORM_H_
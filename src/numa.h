@@ -0,0 +1,123 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <sched.h>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The NUMA nodes the process can run on and their CPUs, read from
+// /sys/devices/system/node and limited to the CPUs of the process's
+// affinity mask. Nodes without such CPUs are left out. Without sysfs the
+// machine is one node of id -1 with no known CPUs, which nothing is pinned
+// to.
+class NumaTopology {
+public:
+  static const NumaTopology& Get() {
+    static NumaTopology* topology = new NumaTopology();
+    return *topology;
+  }
+
+  int NumNodes() const { return static_cast<int>(node_ids_.size()); }
+
+  // The kernel's id of the i-th node, as taken by mbind and getcpu.
+  int NodeId(int i) const { return node_ids_[i]; }
+
+  const std::vector<int>& NodeCpus(int i) const { return node_cpus_[i]; }
+
+  // The node thread of num_threads runs on. Threads are split into
+  // contiguous runs of equal size, one per node.
+  int NodeOfThread(int thread, int num_threads) const {
+    return static_cast<int>(int64_t(thread) * NumNodes() / num_threads);
+  }
+
+  // Restricts the calling thread to the CPUs of the i-th node. Returns false
+  // when the node has no known CPUs or the kernel refused.
+  bool PinThread(int i) const {
+    const std::vector<int>& cpus = node_cpus_[i];
+    if (cpus.empty()) return false;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int cpu : cpus) CPU_SET(cpu, &mask);
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+  }
+
+private:
+  NumaTopology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    const std::string root = "/sys/devices/system/node/";
+    for (int node : ParseList(ReadLine(root + "online"))) {
+      std::vector<int> cpus;
+      std::string path =
+          root + "node" + std::to_string(node) + "/cpulist";
+      for (int cpu : ParseList(ReadLine(path))) {
+        if (cpu >= CPU_SETSIZE) continue;
+        if (!masked || CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+      }
+      if (cpus.empty()) continue;
+      node_ids_.push_back(node);
+      node_cpus_.push_back(cpus);
+    }
+    if (node_ids_.empty()) {
+      node_ids_.push_back(-1);
+      node_cpus_.push_back({});
+    }
+  }
+
+  static std::string ReadLine(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+  }
+
+  // Parses a sysfs list such as "0-3,8,10-11".
+  static std::vector<int> ParseList(const std::string& list) {
+    std::vector<int> values;
+    const char* p = list.c_str();
+    while (*p >= '0' && *p <= '9') {
+      char* end;
+      long first = strtol(p, &end, 10);
+      long last = first;
+      if (*end == '-') last = strtol(end + 1, &end, 10);
+      for (long i = first; i <= last; i++) values.push_back(i);
+      if (*end != ',') break;
+      p = end + 1;
+    }
+    return values;
+  }
+
+  std::vector<int> node_ids_;
+  std::vector<std::vector<int>> node_cpus_;
+};
+
+// The node the calling thread is running on, or -1.
+inline int CurrentNumaNode() {
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return -1;
+  return static_cast<int>(node);
+}
+
+// The node holding the page at addr, or -1 when it is unknown. The page
+// has to be touched first, untouched pages are on no node yet.
+inline int PageNumaNode(const void* addr) {
+#ifdef SYS_move_pages
+  // move_pages without target nodes only reports where the pages are.
+  void* page = const_cast<void*>(addr);
+  int status = -1;
+  if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0) {
+    return -1;
+  }
+  return status >= 0 ? status : -1;
+#else
+  return -1;
+#endif
+}
+
+#endif  // NUMA_H_
@@ -1,33 +1,154 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <memory>
+#include <stdexcept>
+#include "attention.h"
+#include "broadcast.h"
+#include "conv.h"
+#include "gemm.h"
 #include "node.h"
+#include "norm.h"
 #include "op.h"
+#include "op_registry.h"
+#include "pool.h"
+#include "qgemm.h"
+#include "random.h"
+#include "reduce.h"
+#include "simd.h"
+#include "sparse_tensor.h"
+#include "spmm.h"
+#include "thread_pool.h"
+
+static const AttrKey kConstVal("const_val");
+static const AttrKey kTransA("trans_a");
+static const AttrKey kTransB("trans_b");
+static const AttrKey kAxes("axes");
+static const AttrKey kAxis("axis");
+static const AttrKey kKeepdims("keepdims");
+static const AttrKey kReduction("reduction");
+static const AttrKey kValue("value");
+static const AttrKey kActivation("activation");
+static const AttrKey kStrides("strides");
+static const AttrKey kPads("pads");
+static const AttrKey kDilations("dilations");
+static const AttrKey kDataFormat("data_format");
+static const AttrKey kKsize("ksize");
+static const AttrKey kCausal("causal");
+static const AttrKey kScale("scale");
+static const AttrKey kWrt("wrt");
+static const AttrKey kUnits("units");
+static const AttrKey kInputScale("input_scale");
+static const AttrKey kEpsilon("epsilon");
+static const AttrKey kSeed("seed");
+static const AttrKey kLow("low");
+static const AttrKey kHigh("high");
+static const AttrKey kMean("mean");
+static const AttrKey kStddev("stddev");
+static const AttrKey kRate("rate");
+
+struct AddFunctor {
+  float operator()(float a, float b) const { return a + b; }
+};
+
+struct MinusFunctor {
+  float operator()(float a, float b) const { return a - b; }
+};
+
+struct MultiplyFunctor {
+  float operator()(float a, float b) const { return a * b; }
+};
+
+struct DevideFunctor {
+  float operator()(float a, float b) const { return a / b; }
+};
+
+static void BinaryInfer(const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  TensorShape out_shape;
+  bool compatible = BroadcastShape(in_shapes[0], in_shapes[1], out_shape);
+  assert(compatible);
+  out_shapes = {out_shape};
+}
+
+template <typename Functor, typename T = float>
+static void BinaryCompute(const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  BroadcastPlan plan = MakeBroadcastPlan(in_tensors[0].GetTensorShape(),
+                                         in_tensors[1].GetTensorShape());
+  BroadcastBinary(plan, in_tensors[0].GetData<T>(),
+                  in_tensors[1].GetData<T>(), out_tensors[0].GetData<T>(),
+                  Functor());
+}
 
 void AddOp::Compute(const Node& node,
                     const std::vector<Tensor>& in_tensors, 
                     std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
-
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
-    out_tensors[0].GetHandle()[i] = 
-        in_tensors[0].GetHandle()[i] + in_tensors[1].GetHandle()[i];
-  }
+  BinaryCompute<AddFunctor>(in_tensors, out_tensors);
 }
 
 void AddOp::Infer(const Node& node,
                   const std::vector<TensorShape>& in_shapes,
                   std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
-
-  out_shapes = {in_shapes[0]};
+  BinaryInfer(in_shapes, out_shapes);
 }
 
 void AddOp::Gradient(const Node& node, 
                      const Node& in_grad, 
                      std::vector<Node>& out_grads) {
-  out_grads = {in_grad, in_grad};
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ReduceSumToOperator(in_grad, inputs[0]),
+               ReduceSumToOperator(in_grad, inputs[1])};
+}
+
+// Elements per task for the elementwise loops (AddN, activations and their
+// half versions). Small enough for AddN's output range to stay in cache
+// while every input is added into it.
+static const int64_t kElementwiseGrain = 1 << 12;
+
+void AddNOp::Compute(const Node& node,
+                     const std::vector<Tensor>& in_tensors, 
+                     std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() >= 1);
+
+  float* out = out_tensors[0].GetHandle();
+  const float* first = in_tensors[0].GetHandle();
+  ThreadPool::Global()->ParallelForRange(out_tensors[0].NumElements(),
+                                         kElementwiseGrain,
+                                         [&](int64_t begin, int64_t end) {
+    if (out != first) {
+      memcpy(out + begin, first + begin, (end - begin) * sizeof(float));
+    }
+    for (size_t k = 1; k < in_tensors.size(); k++) {
+      SimdAccumulate(out + begin, in_tensors[k].GetHandle() + begin,
+                     end - begin);
+    }
+  });
+}
+
+void AddNOp::Infer(const Node& node,
+                   const std::vector<TensorShape>& in_shapes,
+                   std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() >= 1);
+  for (auto& in_shape : in_shapes) {
+    assert(in_shape == in_shapes[0]);
+  }
+
+  out_shapes = {in_shapes[0]};
+}
+
+void AddNOp::Gradient(const Node& node, 
+                      const Node& in_grad, 
+                      std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.assign(inputs.size(), in_grad);
 }
 
 void AddByConstOp::Compute(const Node& node,
@@ -35,10 +156,10 @@ void AddByConstOp::Compute(const Node& node,
                            std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  float const_val;
-  node.GetAttr("const_val", const_val);
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = in_tensors[0].GetHandle()[i] + const_val;
   }
 }
@@ -60,27 +181,22 @@ void AddByConstOp::Gradient(const Node& node,
 void MinusOp::Compute(const Node& node,
                       const std::vector<Tensor>& in_tensors, 
                       std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
-
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
-    out_tensors[0].GetHandle()[i] = 
-        in_tensors[0].GetHandle()[i] - in_tensors[1].GetHandle()[i];
-  }
+  BinaryCompute<MinusFunctor>(in_tensors, out_tensors);
 }
 
 void MinusOp::Infer(const Node& node,
                     const std::vector<TensorShape>& in_shapes,
                     std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
-
-  out_shapes = {in_shapes[0]};
+  BinaryInfer(in_shapes, out_shapes);
 }
 
 void MinusOp::Gradient(const Node& node,
                        const Node& in_grad, 
                        std::vector<Node>& out_grads) {
-  out_grads = {in_grad, in_grad * -1};
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ReduceSumToOperator(in_grad, inputs[0]),
+               ReduceSumToOperator(in_grad * -1, inputs[1])};
 }
 
 void MinusByConstOp::Compute(const Node& node,
@@ -88,10 +204,10 @@ void MinusByConstOp::Compute(const Node& node,
                              std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  float const_val;
-  node.GetAttr("const_val", const_val);
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = in_tensors[0].GetHandle()[i] - const_val;
   }
 }
@@ -113,21 +229,13 @@ void MinusByConstOp::Gradient(const Node& node,
 void MultiplyOp::Compute(const Node& node,
                          const std::vector<Tensor>& in_tensors, 
                          std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
-
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
-    out_tensors[0].GetHandle()[i] = 
-        in_tensors[0].GetHandle()[i] * in_tensors[1].GetHandle()[i];
-  }
+  BinaryCompute<MultiplyFunctor>(in_tensors, out_tensors);
 }
 
 void MultiplyOp::Infer(const Node& node,
                        const std::vector<TensorShape>& in_shapes,
                        std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
-
-  out_shapes = {in_shapes[0]};
+  BinaryInfer(in_shapes, out_shapes);
 }
 
 void MultiplyOp::Gradient(const Node& node, 
@@ -135,7 +243,8 @@ void MultiplyOp::Gradient(const Node& node,
                           std::vector<Node>& out_grads) {
   std::vector<Node> inputs;
   node.GetInputNodes(inputs); 
-  out_grads = {in_grad * inputs[1], in_grad * inputs[0]};
+  out_grads = {ReduceSumToOperator(in_grad * inputs[1], inputs[0]),
+               ReduceSumToOperator(in_grad * inputs[0], inputs[1])};
 }
 
 void MultiplyByConstOp::Compute(const Node& node,
@@ -143,10 +252,10 @@ void MultiplyByConstOp::Compute(const Node& node,
                                 std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  float const_val;
-  node.GetAttr("const_val", const_val);
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = in_tensors[0].GetHandle()[i] * const_val;
   }
 }
@@ -162,29 +271,21 @@ void MultiplyByConstOp::Infer(const Node& node,
 void MultiplyByConstOp::Gradient(const Node& node, 
                                  const Node& in_grad, 
                                  std::vector<Node>& out_grads) {
-  float const_val;
-  node.GetAttr("const_val", const_val);
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
   out_grads = {in_grad * const_val};
 }
 
 void DevideOp::Compute(const Node& node,
                        const std::vector<Tensor>& in_tensors, 
                        std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
-
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
-    out_tensors[0].GetHandle()[i] = 
-        in_tensors[0].GetHandle()[i] / in_tensors[1].GetHandle()[i];
-  }
+  BinaryCompute<DevideFunctor>(in_tensors, out_tensors);
 }
 
 void DevideOp::Infer(const Node& node,
                      const std::vector<TensorShape>& in_shapes,
                      std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
-
-  out_shapes = {in_shapes[0]};
+  BinaryInfer(in_shapes, out_shapes);
 }
 
 void DevideOp::Gradient(const Node& node, 
@@ -192,9 +293,10 @@ void DevideOp::Gradient(const Node& node,
                         std::vector<Node>& out_grads) {
   std::vector<Node> inputs;
   node.GetInputNodes(inputs);
-  Node lhs_node = in_grad * node / inputs[1];
-  Node rhs_node = -1 * in_grad / inputs[1];
-  out_grads = {lhs_node, rhs_node};
+  Node lhs_node = in_grad / inputs[1];
+  Node rhs_node = in_grad * node / inputs[1] * -1;
+  out_grads = {ReduceSumToOperator(lhs_node, inputs[0]),
+               ReduceSumToOperator(rhs_node, inputs[1])};
 }
 
 void DevideByConstOp::Compute(const Node& node,
@@ -202,10 +304,10 @@ void DevideByConstOp::Compute(const Node& node,
                               std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  float const_val;
-  node.GetAttr("const_val", const_val);
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = in_tensors[0].GetHandle()[i] / const_val;
   }
 }
@@ -221,45 +323,39 @@ void DevideByConstOp::Infer(const Node& node,
 void DevideByConstOp::Gradient(const Node& node, 
                                const Node& in_grad, 
                                std::vector<Node>& out_grads) {
-  float const_val;
-  node.GetAttr("const_val", const_val);
+  float const_val = 0.0;
+  node.GetAttr(kConstVal, const_val);
   out_grads = {in_grad / const_val};
 }
 
-void MatMulOp::Compute(const Node& node,
-                       const std::vector<Tensor>& in_tensors, 
-                       std::vector<Tensor>& out_tensors) {
+// c [m, n] = op(a) * op(b) in fp32 for a and b of type T.
+template <typename T, typename Epilogue>
+static void MatMulCompute(const Node& node,
+                          const std::vector<Tensor>& in_tensors, float* c,
+                          const Epilogue& epilogue) {
   assert(in_tensors.size() == 2);
 
-  bool trans_a;
-  node.GetAttr("trans_a", trans_a);
-  bool trans_b;
-  node.GetAttr("trans_b", trans_b);
-
-  const float* a = in_tensors[0].GetHandle();
-  const float* b = in_tensors[1].GetHandle();
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
 
   TensorShape shape_a = in_tensors[0].GetTensorShape();
   TensorShape shape_b = in_tensors[1].GetTensorShape();
 
-  int num_m = trans_a ? shape_a.DimSize(1) : shape_a.DimSize(0);
-  int num_n = trans_b ? shape_b.DimSize(0) : shape_b.DimSize(1);
-  int num_k = trans_a ? shape_a.DimSize(0) : shape_a.DimSize(1);
+  int64_t num_m = trans_a ? shape_a.DimSize(1) : shape_a.DimSize(0);
+  int64_t num_n = trans_b ? shape_b.DimSize(0) : shape_b.DimSize(1);
+  int64_t num_k = trans_a ? shape_a.DimSize(0) : shape_a.DimSize(1);
 
-  int num_col_a = shape_a.DimSize(1);
-  int num_col_b = shape_b.DimSize(1);
+  Gemm(trans_a, trans_b, num_m, num_n, num_k, in_tensors[0].GetData<T>(),
+       in_tensors[1].GetData<T>(), c, epilogue);
+}
 
-  for(int i = 0; i < num_m; i++) {
-    for (int j = 0; j < num_n; j++) {
-      float sum = 0.0;
-      for (int k = 0; k < num_k; k++) {
-        float a_val = trans_a ? a[num_col_a * k + i] : a[num_col_a * i + k];
-        float b_val = trans_b ? b[num_col_b * j + k] : b[num_col_b * k + j];
-        sum += a_val * b_val;
-      }
-      out_tensors[0].GetHandle()[num_n * i + j] = sum;
-    }
-  }
+void MatMulOp::Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors, 
+                       std::vector<Tensor>& out_tensors) {
+  MatMulCompute<float>(node, in_tensors, out_tensors[0].GetHandle(),
+                       NoEpilogue());
 }
 
 void MatMulOp::Infer(const Node& node,
@@ -267,12 +363,16 @@ void MatMulOp::Infer(const Node& node,
                      std::vector<TensorShape>& out_shapes) {
   assert(in_shapes.size() == 2);
 
-  bool trans_a;
-  node.GetAttr("trans_a", trans_a);
-  bool trans_b;
-  node.GetAttr("trans_b", trans_b);
-  int m = trans_a ? in_shapes[0].DimSize(1) : in_shapes[0].DimSize(0);
-  int n = trans_b ? in_shapes[1].DimSize(0) : in_shapes[1].DimSize(1);
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
+  assert(in_shapes[0].NumDims() == 2 && in_shapes[1].NumDims() == 2);
+  int64_t m = trans_a ? in_shapes[0].DimSize(1) : in_shapes[0].DimSize(0);
+  int64_t n = trans_b ? in_shapes[1].DimSize(0) : in_shapes[1].DimSize(1);
+  // The Gemm would read past the smaller operand otherwise.
+  assert((trans_a ? in_shapes[0].DimSize(0) : in_shapes[0].DimSize(1)) ==
+         (trans_b ? in_shapes[1].DimSize(1) : in_shapes[1].DimSize(0)));
   out_shapes = {TensorShape(m, n)};
 }
 
@@ -281,28 +381,246 @@ void MatMulOp::Gradient(const Node& node,
                         std::vector<Node>& out_grads) {
   std::vector<Node> inputs;
   node.GetInputNodes(inputs); 
-  bool trans_a;
-  node.GetAttr("trans_a", trans_a);
-  bool trans_b;
-  node.GetAttr("trans_b", trans_a);
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
   
+  // With C = op(A) op(B), dop(A) = dC op(B)^T and dop(B) = op(A)^T dC,
+  // transposed back where an input was transposed.
+  const Node& a = inputs[0];
+  const Node& b = inputs[1];
   if (trans_a == false && trans_b == false) {
-    Node lhs_grad = MatMulOperator(in_grad, inputs[1], false, true);
-    Node rhs_grad = MatMulOperator(inputs[0], in_grad, true, false);
-    out_grads = {lhs_grad, rhs_grad};
+    out_grads = {MatMulOperator(in_grad, b, false, true),
+                 MatMulOperator(a, in_grad, true, false)};
   } else if (trans_a == true && trans_b == false) {
-    Node lhs_grad = MatMulOperator(inputs[1], in_grad, false, true);
-    Node rhs_grad = MatMulOperator(inputs[0], in_grad, true, false);
-    out_grads = {lhs_grad, rhs_grad};
+    out_grads = {MatMulOperator(b, in_grad, false, true),
+                 MatMulOperator(a, in_grad)};
   } else if (trans_a == false && trans_b == true) {
-    Node lhs_grad = MatMulOperator(in_grad, inputs[1], false, true);
-    Node rhs_grad = MatMulOperator(in_grad, inputs[0], true, false);
-    out_grads = {lhs_grad, rhs_grad};
+    out_grads = {MatMulOperator(in_grad, b),
+                 MatMulOperator(in_grad, a, true, false)};
+  } else {
+    out_grads = {MatMulOperator(b, in_grad, true, true),
+                 MatMulOperator(in_grad, a, true, true)};
+  }
+}
+
+struct BatchMatMulDims {
+  int64_t batch, a_batch, b_batch;
+  int64_t m, n, k;
+};
+
+// The last two dims of a rank 3 input are the matrix, a rank 2 input is a
+// batch of one.
+static BatchMatMulDims GetBatchMatMulDims(const Node& node,
+                                          const TensorShape& a,
+                                          const TensorShape& b) {
+  assert(a.NumDims() == 2 || a.NumDims() == 3);
+  assert(b.NumDims() == 2 || b.NumDims() == 3);
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
+
+  int a_dim = a.NumDims() - 2;
+  int b_dim = b.NumDims() - 2;
+  BatchMatMulDims dims;
+  dims.a_batch = a_dim == 0 ? 1 : a.DimSize(0);
+  dims.b_batch = b_dim == 0 ? 1 : b.DimSize(0);
+  dims.batch = std::max(dims.a_batch, dims.b_batch);
+  dims.m = a.DimSize(a_dim + (trans_a ? 1 : 0));
+  dims.k = a.DimSize(a_dim + (trans_a ? 0 : 1));
+  dims.n = b.DimSize(b_dim + (trans_b ? 0 : 1));
+  assert(dims.k == b.DimSize(b_dim + (trans_b ? 1 : 0)));
+  assert(dims.a_batch == dims.batch || dims.a_batch == 1);
+  assert(dims.b_batch == dims.batch || dims.b_batch == 1);
+  return dims;
+}
+
+void BatchMatMulOp::Compute(const Node& node,
+                            const std::vector<Tensor>& in_tensors,
+                            std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
+  BatchMatMulDims dims = GetBatchMatMulDims(
+      node, in_tensors[0].GetTensorShape(), in_tensors[1].GetTensorShape());
+
+  int64_t a_stride = dims.a_batch == 1 ? 0 : dims.m * dims.k;
+  int64_t b_stride = dims.b_batch == 1 ? 0 : dims.k * dims.n;
+  BatchGemm(trans_a, trans_b, dims.batch, dims.m, dims.n, dims.k,
+            in_tensors[0].GetHandle(), a_stride,
+            in_tensors[1].GetHandle(), b_stride,
+            out_tensors[0].GetHandle());
+}
+
+void BatchMatMulOp::Infer(const Node& node,
+                          const std::vector<TensorShape>& in_shapes,
+                          std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  BatchMatMulDims dims = GetBatchMatMulDims(node, in_shapes[0], in_shapes[1]);
+  out_shapes = {TensorShape(dims.batch, dims.m, dims.n)};
+}
+
+// The gradients are batched products with in_grad, summed back over the
+// batch for an input that was broadcast.
+void BatchMatMulOp::Gradient(const Node& node,
+                             const Node& in_grad,
+                             std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  bool trans_a = false;
+  node.GetAttr(kTransA, trans_a);
+  bool trans_b = false;
+  node.GetAttr(kTransB, trans_b);
+
+  Node lhs_grad, rhs_grad;
+  if (!trans_a && !trans_b) {
+    lhs_grad = BatchMatMulOperator(in_grad, inputs[1], false, true);
+    rhs_grad = BatchMatMulOperator(inputs[0], in_grad, true, false);
+  } else if (trans_a && !trans_b) {
+    lhs_grad = BatchMatMulOperator(inputs[1], in_grad, false, true);
+    rhs_grad = BatchMatMulOperator(inputs[0], in_grad, false, false);
+  } else if (!trans_a && trans_b) {
+    lhs_grad = BatchMatMulOperator(in_grad, inputs[1], false, false);
+    rhs_grad = BatchMatMulOperator(in_grad, inputs[0], true, false);
   } else {
-    Node lhs_grad = MatMulOperator(inputs[1], in_grad, false, true); 
-    Node rhs_grad = MatMulOperator(in_grad, inputs[0], true, false);
-    out_grads = {lhs_grad, rhs_grad};
+    lhs_grad = BatchMatMulOperator(inputs[1], in_grad, true, true);
+    rhs_grad = BatchMatMulOperator(in_grad, inputs[0], true, true);
+  }
+  out_grads = {ReduceSumToOperator(lhs_grad, inputs[0]),
+               ReduceSumToOperator(rhs_grad, inputs[1])};
+}
+
+// Adds the bias, broadcast to [m, n], to a row segment of the product and
+// applies the activation, in one pass while the segment is still in cache.
+struct DenseEpilogue {
+  const float* bias;
+  int64_t row_stride;
+  int64_t col_stride;
+  bool relu;
+
+  void operator()(int64_t row, int64_t col, float* c, int64_t len) const {
+    const float* b = bias + row * row_stride + col * col_stride;
+    if (col_stride == 0) {
+      const float val = b[0];
+      for (int64_t j = 0; j < len; j++) {
+        c[j] = relu ? std::max(c[j] + val, 0.0f) : c[j] + val;
+      }
+    } else {
+      for (int64_t j = 0; j < len; j++) {
+        c[j] = relu ? std::max(c[j] + b[j], 0.0f) : c[j] + b[j];
+      }
+    }
   }
+};
+
+static bool IsRelu(const Node& node) {
+  std::string activation;
+  node.GetAttr(kActivation, activation);
+  assert(activation.empty() || activation == "none" || activation == "relu");
+  return activation == "relu";
+}
+
+// The bias is [n], [1, n], [m, 1], [m, n] or a single element.
+static DenseEpilogue GetDenseEpilogue(const Node& node, const Tensor& bias) {
+  const TensorShape& b_shape = bias.GetTensorShape();
+  int num_dims = b_shape.NumDims();
+  int64_t b_cols = num_dims >= 1 ? b_shape.DimSize(num_dims - 1) : 1;
+  int64_t b_rows = num_dims >= 2 ? b_shape.DimSize(num_dims - 2) : 1;
+  DenseEpilogue epilogue;
+  epilogue.bias = bias.GetHandle();
+  epilogue.row_stride = b_rows == 1 ? 0 : b_cols;
+  epilogue.col_stride = b_cols == 1 ? 0 : 1;
+  epilogue.relu = IsRelu(node);
+  return epilogue;
+}
+
+void DenseOp::Compute(const Node& node,
+                      const std::vector<Tensor>& in_tensors,
+                      std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  const TensorShape& x_shape = in_tensors[0].GetTensorShape();
+  int64_t m = x_shape.DimSize(0);
+  int64_t k = x_shape.DimSize(1);
+  int64_t n = in_tensors[1].GetTensorShape().DimSize(1);
+
+  Gemm(false, false, m, n, k, in_tensors[0].GetHandle(),
+       in_tensors[1].GetHandle(), out_tensors[0].GetHandle(),
+       GetDenseEpilogue(node, in_tensors[2]));
+}
+
+void DenseOp::Infer(const Node& node,
+                    const std::vector<TensorShape>& in_shapes,
+                    std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+  assert(in_shapes[0].DimSize(1) == in_shapes[1].DimSize(0));
+
+  TensorShape out_shape(in_shapes[0].DimSize(0), in_shapes[1].DimSize(1));
+  TensorShape biased;
+  bool ok = BroadcastShape(out_shape, in_shapes[2], biased);
+  assert(ok && biased == out_shape);
+  (void)ok;
+  out_shapes = {out_shape};
+}
+
+// The activation's gradient is taken once, then both products read it and
+// the bias gradient sums it over the rows.
+void DenseOp::Gradient(const Node& node,
+                       const Node& in_grad,
+                       std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Node grad = IsRelu(node) ?
+      ActivationGradOperator(in_grad, node, "relu") : in_grad;
+  Node x_grad = MatMulOperator(grad, inputs[1], false, true);
+  Node w_grad = MatMulOperator(inputs[0], grad, true, false);
+  Node b_grad = ReduceSumToOperator(grad, inputs[2]);
+  out_grads = {x_grad, w_grad, b_grad};
+}
+
+void ActivationGradOp::Compute(const Node& node,
+                               const std::vector<Tensor>& in_tensors,
+                               std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const float* grad = in_tensors[0].GetHandle();
+  const float* out = in_tensors[1].GetHandle();
+  float* dst = out_tensors[0].GetHandle();
+  bool relu = IsRelu(node);
+  ThreadPool::Global()->ParallelForRange(out_tensors[0].NumElements(),
+                                         kElementwiseGrain,
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      dst[i] = !relu || out[i] > 0 ? grad[i] : 0.0f;
+    }
+  });
+}
+
+void ActivationGradOp::Infer(const Node& node,
+                             const std::vector<TensorShape>& in_shapes,
+                             std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[0] == in_shapes[1]);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void ActivationGradOp::Gradient(const Node& node,
+                                const Node& in_grad,
+                                std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  std::string activation;
+  node.GetAttr(kActivation, activation);
+  // act' is piecewise constant, so the output gets no gradient.
+  out_grads = {ActivationGradOperator(in_grad, inputs[1], activation),
+               ZerosOperator(inputs[1])};
 }
 
 void ZerosOp::Compute(const Node& node,
@@ -310,8 +628,8 @@ void ZerosOp::Compute(const Node& node,
                       std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = 0;
   }
 }
@@ -337,8 +655,8 @@ void OnesOp::Compute(const Node& node,
                      std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
+  int64_t num_elements = out_tensors[0].NumElements();
+  for (int64_t i = 0; i < num_elements; i++) {
     out_tensors[0].GetHandle()[i] = 1;
   }
 }
@@ -359,23 +677,42 @@ void OnesOp::Gradient(const Node& node,
   out_grads = {ZerosOperator(inputs[0])};
 }
 
+void FillOp::Compute(const Node& node,
+                     const std::vector<Tensor>& in_tensors,
+                     std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  float value = 0.0;
+  node.GetAttr(kValue, value);
+  std::fill(out_tensors[0].GetHandle(),
+            out_tensors[0].GetHandle() + out_tensors[0].NumElements(), value);
+}
+
+void FillOp::Infer(const Node& node,
+                   const std::vector<TensorShape>& in_shapes,
+                   std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void FillOp::Gradient(const Node& node,
+                      const Node& in_grad,
+                      std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs); 
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
 void ReduceSumAxisZeroOp::Compute(const Node& node,
                                   const std::vector<Tensor>& in_tensors,
                                   std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  const float* in = in_tensors[0].GetHandle();
-  int num_elements = in_tensors[0].NumElements();
-  int reduce_elements = num_elements / in_tensors[0].GetTensorShape().DimSize(0);
-  float* out = out_tensors[0].GetHandle();
-  for (int i = 0; i < num_elements; i++) {
-    int idx = i / reduce_elements;
-    if (idx == 0) {
-      out[i % reduce_elements] = in[i];
-    } else {
-      out[i % reduce_elements] += in[i];
-    }
-  }
+  int64_t num_rows = in_tensors[0].GetTensorShape().DimSize(0);
+  ReduceMiddle(in_tensors[0].GetHandle(), 1, num_rows,
+               out_tensors[0].NumElements(), ReduceKind::kSum,
+               out_tensors[0].GetHandle());
 }
 
 void ReduceSumAxisZeroOp::Infer(const Node& node,
@@ -398,183 +735,1779 @@ void ReduceSumAxisZeroOp::Gradient(const Node& node,
   out_grads = {BroadCastToOperator(in_grad, inputs[0])};
 }
 
-void BroadCastToOp::Compute(const Node& node,
-                            const std::vector<Tensor>& in_tensors,
-                            std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
+static std::vector<bool> ReducedAxes(const Node& node,
+                                     const TensorShape& in_shape) {
+  std::vector<int> axes;
+  node.GetAttr(kAxes, axes);
+  return ParseReduceAxes(axes, in_shape.NumDims());
+}
 
-  // we need to duplicate one elements n_times time
-  int n_times = in_tensors[1].GetTensorShape().DimSize(0);
-  int num_elements = in_tensors[0].NumElements();
-  
-  float* base = out_tensors[0].GetHandle();
-  for (int i = 0; i < n_times; i++) {
-    for (int j = 0; j < num_elements; j++) {
-      base[j] = in_tensors[0].GetHandle()[j];
-    } 
-    base += num_elements;
-  }
+static void ReduceInfer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  bool keepdims = false;
+  node.GetAttr(kKeepdims, keepdims);
+  std::vector<bool> reduced = ReducedAxes(node, in_shapes[0]);
+  out_shapes = {ReducedShape(in_shapes[0], reduced, keepdims)};
 }
 
-void BroadCastToOp::Infer(const Node& node,
-                          const std::vector<TensorShape>& in_shapes,
-                          std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
+void ReduceSumOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
 
-  out_shapes = {in_shapes[1]};
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  ReduceAxes(in_tensors[0].GetHandle(), in_shape,
+             ReducedAxes(node, in_shape), ReduceKind::kSum,
+             out_tensors[0].GetHandle());
 }
 
-void BroadCastToOp::Gradient(const Node& node,
-                             const Node& in_grad, 
-                             std::vector<Node>& out_grads) {
+void ReduceSumOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  ReduceInfer(node, in_shapes, out_shapes);
+}
+
+void ReduceSumOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
   std::vector<Node> inputs;
-  node.GetInputNodes(inputs); 
-  Node lhs_node = ReduceSumAxisZeroOperator(in_grad);
-  Node rhs_node = ZerosOperator(inputs[1]);
-  out_grads = {lhs_node, rhs_node};
+  node.GetInputNodes(inputs);
+  std::vector<int> axes;
+  node.GetAttr(kAxes, axes);
+  out_grads = {ReduceGradOperator(in_grad, inputs[0], "sum", axes)};
 }
 
-void SoftmaxOp::Compute(const Node& node,
-                        const std::vector<Tensor>& in_tensors,
-                        std::vector<Tensor>& out_tensors) {
+void ReduceMeanOp::Compute(const Node& node,
+                           const std::vector<Tensor>& in_tensors,
+                           std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  Tensor y = in_tensors[0];
-  int m = y.GetTensorShape().DimSize(0);
-  int n = y.GetTensorShape().DimSize(1);
-
-  for (int i = 0; i < m; i++) {
-    float sum = 0.0;
-    for (int j = 0; j < n; j++) {
-      float val = exp(y.GetHandle()[n * i + j]);
-      sum += val; 
-      out_tensors[0].GetHandle()[n * i + j] = val;
-    }
-    for (int j = 0; j < n; j++) {
-      out_tensors[0].GetHandle()[n * i + j] /= sum;
-    }
-  }
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  ReduceAxes(in_tensors[0].GetHandle(), in_shape,
+             ReducedAxes(node, in_shape), ReduceKind::kSum,
+             out_tensors[0].GetHandle());
+  int64_t num_out = out_tensors[0].NumElements();
+  float scale = (float)num_out / in_tensors[0].NumElements();
+  SimdScale(out_tensors[0].GetHandle(), scale, num_out);
 }
 
-void SoftmaxOp::Infer(const Node& node,
-                      const std::vector<TensorShape>& in_shapes,
-                      std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 1);
-
-  out_shapes = {in_shapes[0]};
+void ReduceMeanOp::Infer(const Node& node,
+                         const std::vector<TensorShape>& in_shapes,
+                         std::vector<TensorShape>& out_shapes) {
+  ReduceInfer(node, in_shapes, out_shapes);
 }
 
-void SoftmaxOp::Gradient(const Node& node,
-                         const Node& in_grad,
-                         std::vector<Node>& out_grads) {
-  std::cout << "Softmax Op has no gradient function" << std::endl;
+void ReduceMeanOp::Gradient(const Node& node,
+                            const Node& in_grad,
+                            std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  std::vector<int> axes;
+  node.GetAttr(kAxes, axes);
+  out_grads = {ReduceGradOperator(in_grad, inputs[0], "mean", axes)};
 }
 
-void SoftmaxCrossEntropyOp::Compute(const Node& node,
-                                    const std::vector<Tensor>& in_tensors,
-                                    std::vector<Tensor>& out_tensors) {
-  assert(in_tensors.size() == 2);
-
-  Tensor y = in_tensors[0];
-  Tensor y_ = in_tensors[1];
+void ReduceMaxOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
 
-  int m = y.GetTensorShape().DimSize(0);
-  int n = y.GetTensorShape().DimSize(1);
-  float total_sum = 0.0;
-  std::vector<float> tmp(n);
-  for (int i = 0; i < m; i++) {
-    float sum = 0.0;
-    for (int j = 0; j < n; j++) {
-       float val = exp(y.GetHandle()[n * i + j]);
-       tmp[j] = val;
-       sum += val;
-    }
-    for (int j = 0; j < n; j++) {
-      tmp[j] /= sum;
-      total_sum += (-y_.GetHandle()[n * i + j]) * log(tmp[j]);
-    }
-  }
-  out_tensors[0].GetHandle()[0] = (total_sum / m);
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  ReduceAxes(in_tensors[0].GetHandle(), in_shape,
+             ReducedAxes(node, in_shape), ReduceKind::kMax,
+             out_tensors[0].GetHandle());
 }
 
-void SoftmaxCrossEntropyOp::Infer(const Node& node,
-                                  const std::vector<TensorShape>& in_shapes,
-                                  std::vector<TensorShape>& out_shapes) {
-  assert(in_shapes.size() == 2);
-
-  out_shapes = {TensorShape(1)};
+void ReduceMaxOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  ReduceInfer(node, in_shapes, out_shapes);
 }
 
-void SoftmaxCrossEntropyOp::Gradient(const Node& node, 
-                                     const Node& in_grad,
-                                     std::vector<Node>& out_grads) {
+void ReduceMaxOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
   std::vector<Node> inputs;
   node.GetInputNodes(inputs);
-  Node lhs_grad = (SoftmaxOperator(inputs[0]) + inputs[1] * -1) * in_grad;
-  Node rhs_grad = ZerosOperator(inputs[1]);
-  out_grads = {lhs_grad, rhs_grad};
+  std::vector<int> axes;
+  node.GetAttr(kAxes, axes);
+  out_grads = {ReduceMaxGradOperator(in_grad, inputs[0], node, axes)};
 }
 
-void ReluOp::Compute(const Node& node,
-                     const std::vector<Tensor>& in_tensors,
-                     std::vector<Tensor>& out_tensors) {
+void ArgMaxOp::Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) {
   assert(in_tensors.size() == 1);
 
-  int num_elements = out_tensors[0].NumElements();
-  for (int i = 0; i < num_elements; i++) {
-    out_tensors[0].GetHandle()[i] = 
-        std::max(in_tensors[0].GetHandle()[i], (float)0.0);
-  }  
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  int axis = 0;
+  node.GetAttr(kAxis, axis);
+  if (axis < 0) axis += in_shape.NumDims();
+  ArgMaxAxis(in_tensors[0].GetHandle(), in_shape, axis,
+             out_tensors[0].GetHandle());
 }
 
-void ReluOp::Infer(const Node& node,
-                   const std::vector<TensorShape>& in_shapes,
-                   std::vector<TensorShape>& out_shapes) {
+void ArgMaxOp::Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) {
   assert(in_shapes.size() == 1);
 
-  out_shapes = {in_shapes[0]};
+  int axis = 0;
+  node.GetAttr(kAxis, axis);
+  bool keepdims = false;
+  node.GetAttr(kKeepdims, keepdims);
+  std::vector<bool> reduced =
+      ParseReduceAxes({axis}, in_shapes[0].NumDims());
+  out_shapes = {ReducedShape(in_shapes[0], reduced, keepdims)};
 }
 
-void ReluOp::Gradient(const Node& node, 
+void ArgMaxOp::Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
+// Inputs are (in_grad, x) for sum and mean, (in_grad, x, y) for max, where y
+// is the forward output. The gradient is routed to every maximal element.
+void ReduceGradOp::Compute(const Node& node,
+                           const std::vector<Tensor>& in_tensors,
+                           std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2 || in_tensors.size() == 3);
+
+  std::string reduction;
+  node.GetAttr(kReduction, reduction);
+  // x is only passed for sum and mean, so its shape is taken from the out.
+  const TensorShape& x_shape = out_tensors[0].GetTensorShape();
+  TensorShape keep_shape =
+      ReducedShape(x_shape, ReducedAxes(node, x_shape), true);
+  const float* grad = in_tensors[0].GetHandle();
+  float* out = out_tensors[0].GetHandle();
+
+  if (reduction != "max") {
+    BroadcastTo(grad, keep_shape, out, x_shape);
+    if (reduction == "mean") {
+      float scale = (float)in_tensors[0].NumElements() /
+                    out_tensors[0].NumElements();
+      SimdScale(out, scale, out_tensors[0].NumElements());
+    }
+    return;
+  }
+
+  const float* x = in_tensors[1].GetHandle();
+  const float* y = in_tensors[2].GetHandle();
+  BroadcastPlan plan = MakeBroadcastPlan(keep_shape, x_shape);
+  int inner = plan.num_dims - 1;
+  const int64_t n = plan.dims[inner];
+  const int64_t y_stride = plan.lhs_strides[inner];
+  // Like the pooling backward, the gradient goes to the first maximum in
+  // row-major order only, so tied elements do not each receive all of it.
+  std::vector<bool> routed(in_tensors[0].NumElements(), false);
+  ForEachBroadcastRow(plan, [&](int64_t y_offset, int64_t x_offset,
+                                int64_t row) {
+    for (int64_t i = 0; i < n; i++) {
+      int64_t y_idx = y_offset + i * y_stride;
+      bool is_max = !routed[y_idx] && x[x_offset + i] == y[y_idx];
+      if (is_max) routed[y_idx] = true;
+      out[row * n + i] = is_max ? grad[y_idx] : 0;
+    }
+  });
+}
+
+void ReduceGradOp::Infer(const Node& node,
+                         const std::vector<TensorShape>& in_shapes,
+                         std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2 || in_shapes.size() == 3);
+
+  out_shapes = {in_shapes[1]};
+}
+
+std::vector<int> ReduceGradOp::ShapeOnlyInputs(const Node& node) const {
+  std::string reduction;
+  node.GetAttr(kReduction, reduction);
+  if (reduction == "max") return {};
+  return {1};
+}
+
+void ReduceGradOp::Gradient(const Node& node,
+                            const Node& in_grad,
+                            std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void ReduceSumToOp::Compute(const Node& node,
+                            const std::vector<Tensor>& in_tensors,
+                            std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  const TensorShape& out_shape = out_tensors[0].GetTensorShape();
+  if (in_tensors[0].NumElements() == out_tensors[0].NumElements()) {
+    memcpy(out_tensors[0].GetHandle(), in_tensors[0].GetHandle(),
+           out_tensors[0].NumElements() * sizeof(float));
+  } else {
+    ReduceToShape(in_tensors[0].GetHandle(), in_shape,
+                  out_tensors[0].GetHandle(), out_shape);
+  }
+}
+
+void ReduceSumToOp::Infer(const Node& node,
+                          const std::vector<TensorShape>& in_shapes,
+                          std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  out_shapes = {in_shapes[1]};
+}
+
+void ReduceSumToOp::Gradient(const Node& node,
+                             const Node& in_grad,
+                             std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Node lhs_node = BroadCastToOperator(in_grad, inputs[0]);
+  Node rhs_node = ZerosOperator(inputs[1]);
+  out_grads = {lhs_node, rhs_node};
+}
+
+void BroadCastToOp::Compute(const Node& node,
+                            const std::vector<Tensor>& in_tensors,
+                            std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  BroadcastTo(in_tensors[0].GetHandle(), in_tensors[0].GetTensorShape(),
+              out_tensors[0].GetHandle(), out_tensors[0].GetTensorShape());
+}
+
+void BroadCastToOp::Infer(const Node& node,
+                          const std::vector<TensorShape>& in_shapes,
+                          std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  out_shapes = {in_shapes[1]};
+}
+
+void BroadCastToOp::Gradient(const Node& node,
+                             const Node& in_grad, 
+                             std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs); 
+  Node lhs_node = ReduceSumToOperator(in_grad, inputs[0]);
+  Node rhs_node = ZerosOperator(inputs[1]);
+  out_grads = {lhs_node, rhs_node};
+}
+
+void SoftmaxOp::Compute(const Node& node,
+                        const std::vector<Tensor>& in_tensors,
+                        std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  Tensor y = in_tensors[0];
+  int64_t m = y.GetTensorShape().DimSize(0);
+  int64_t n = y.GetTensorShape().DimSize(1);
+
+  for (int64_t i = 0; i < m; i++) {
+    float sum = 0.0;
+    for (int64_t j = 0; j < n; j++) {
+      float val = exp(y.GetHandle()[n * i + j]);
+      sum += val; 
+      out_tensors[0].GetHandle()[n * i + j] = val;
+    }
+    for (int64_t j = 0; j < n; j++) {
+      out_tensors[0].GetHandle()[n * i + j] /= sum;
+    }
+  }
+}
+
+void SoftmaxOp::Infer(const Node& node,
+                      const std::vector<TensorShape>& in_shapes,
+                      std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void SoftmaxOp::Gradient(const Node& node,
+                         const Node& in_grad,
+                         std::vector<Node>& out_grads) {
+  std::cout << "Softmax Op has no gradient function" << std::endl;
+}
+
+void SoftmaxCrossEntropyOp::Compute(const Node& node,
+                                    const std::vector<Tensor>& in_tensors,
+                                    std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  Tensor y = in_tensors[0];
+  Tensor y_ = in_tensors[1];
+
+  int64_t m = y.GetTensorShape().DimSize(0);
+  int64_t n = y.GetTensorShape().DimSize(1);
+  float total_sum = 0.0;
+  std::vector<float> tmp(n);
+  for (int64_t i = 0; i < m; i++) {
+    float sum = 0.0;
+    for (int64_t j = 0; j < n; j++) {
+       float val = exp(y.GetHandle()[n * i + j]);
+       tmp[j] = val;
+       sum += val;
+    }
+    for (int64_t j = 0; j < n; j++) {
+      tmp[j] /= sum;
+      total_sum += (-y_.GetHandle()[n * i + j]) * log(tmp[j]);
+    }
+  }
+  out_tensors[0].GetHandle()[0] = (total_sum / m);
+}
+
+void SoftmaxCrossEntropyOp::Infer(const Node& node,
+                                  const std::vector<TensorShape>& in_shapes,
+                                  std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  out_shapes = {TensorShape(1)};
+}
+
+void SoftmaxCrossEntropyOp::Gradient(const Node& node, 
+                                     const Node& in_grad,
+                                     std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Node lhs_grad = (SoftmaxOperator(inputs[0]) + inputs[1] * -1) * in_grad;
+  Node rhs_grad = ZerosOperator(inputs[1]);
+  out_grads = {lhs_grad, rhs_grad};
+}
+
+void ReluOp::Compute(const Node& node,
+                     const std::vector<Tensor>& in_tensors,
+                     std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  int64_t num_elements = out_tensors[0].NumElements();
+  for (int64_t i = 0; i < num_elements; i++) {
+    out_tensors[0].GetHandle()[i] = 
+        std::max(in_tensors[0].GetHandle()[i], (float)0.0);
+  }  
+}
+
+void ReluOp::Infer(const Node& node,
+                   const std::vector<TensorShape>& in_shapes,
+                   std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {in_shapes[0]};
+}
+
+// Only the mask of the input is kept for the backward pass, the input
+// itself can die with the forward Relu.
+void ReluOp::Gradient(const Node& node, 
                       const Node& in_grad,
                       std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ReluGradOperator(in_grad, ReluMaskOperator(inputs[0]))};
 }
 
-std::shared_ptr<Op> Op::Create(const std::string& name) {
-  if (name == "Add") {
-    return std::make_shared<AddOp>(name);
-  } else if (name == "AddByConst"){
-    return std::make_shared<AddByConstOp>(name);
-  } else if (name == "Minus") {
-    return std::make_shared<MinusOp>(name);
-  } else if (name == "MinusByConst"){
-    return std::make_shared<MinusByConstOp>(name);
-  } else if (name == "Multiply"){
-    return std::make_shared<MultiplyOp>(name);
-  } else if (name == "MultiplyByConst"){
-    return std::make_shared<MultiplyByConstOp>(name);
-  } else if (name == "Devide"){
-    return std::make_shared<DevideOp>(name);
-  } else if (name == "DevideByConst"){
-    return std::make_shared<MultiplyByConstOp>(name);
-  } else if (name == "MatMul") {
-    return std::make_shared<MatMulOp>(name);
-  } else if (name == "Zeros"){
-    return std::make_shared<ZerosOp>(name);
-  } else if (name == "Ones"){
-    return std::make_shared<OnesOp>(name);
-  } else if (name == "ReduceSumAxisZero"){
-    return std::make_shared<ReduceSumAxisZeroOp>(name);
-  } else if (name == "BroadCastTo"){
-    return std::make_shared<BroadCastToOp>(name);
-  } else if (name == "Softmax"){
-    return std::make_shared<SoftmaxOp>(name);
-  } else if (name == "SoftmaxCrossEntropy"){
-    return std::make_shared<SoftmaxCrossEntropyOp>(name);
-  } else if (name == "Relu") {
-    return std::make_shared<ReluOp>(name);
-  } else {
-    return std::make_shared<DevideOp>(nullptr);
+static const int64_t kMaskWordBits = 32;
+// Mask words per task, so a task covers kElementwiseGrain elements.
+static const int64_t kMaskWordGrain = kElementwiseGrain / kMaskWordBits;
+
+void ReluMaskOp::Compute(const Node& node,
+                         const std::vector<Tensor>& in_tensors,
+                         std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  const float* x = in_tensors[0].GetHandle();
+  int64_t n = in_tensors[0].NumElements();
+  uint32_t* bits = reinterpret_cast<uint32_t*>(out_tensors[0].GetHandle());
+  ThreadPool::Global()->ParallelForRange(out_tensors[0].NumElements(),
+                                         kMaskWordGrain,
+                                         [&](int64_t begin, int64_t end) {
+    int64_t first = begin * kMaskWordBits;
+    int64_t last = std::min(n, end * kMaskWordBits);
+    SimdPositiveMask(x + first, last - first, bits + begin);
+  });
+}
+
+void ReluMaskOp::Infer(const Node& node,
+                       const std::vector<TensorShape>& in_shapes,
+                       std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  int64_t n = in_shapes[0].NumElements();
+  out_shapes = {TensorShape((n + kMaskWordBits - 1) / kMaskWordBits)};
+}
+
+void ReluMaskOp::Gradient(const Node& node,
+                          const Node& in_grad,
+                          std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
+void ReluGradOp::Compute(const Node& node,
+                         const std::vector<Tensor>& in_tensors,
+                         std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const float* grad = in_tensors[0].GetHandle();
+  const uint32_t* bits =
+      reinterpret_cast<const uint32_t*>(in_tensors[1].GetHandle());
+  float* out = out_tensors[0].GetHandle();
+  int64_t n = out_tensors[0].NumElements();
+  ThreadPool::Global()->ParallelForRange(in_tensors[1].NumElements(),
+                                         kMaskWordGrain,
+                                         [&](int64_t begin, int64_t end) {
+    int64_t first = begin * kMaskWordBits;
+    int64_t last = std::min(n, end * kMaskWordBits);
+    SimdApplyMask(grad + first, bits + begin, last - first, out + first);
+  });
+}
+
+void ReluGradOp::Infer(const Node& node,
+                       const std::vector<TensorShape>& in_shapes,
+                       std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[1].NumElements() ==
+         (in_shapes[0].NumElements() + kMaskWordBits - 1) / kMaskWordBits);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void ReluGradOp::Gradient(const Node& node,
+                          const Node& in_grad,
+                          std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ReluGradOperator(in_grad, inputs[1]),
+               ZerosOperator(inputs[1])};
+}
+
+struct Conv2DAttrs {
+  std::vector<int> strides;
+  std::vector<int> pads;
+  std::vector<int> dilations;
+  std::string data_format;
+};
+
+static Conv2DAttrs GetConv2DAttrs(const Node& node) {
+  Conv2DAttrs attrs = {{1, 1}, {0, 0}, {1, 1}, "NCHW"};
+  node.GetAttr(kStrides, attrs.strides);
+  node.GetAttr(kPads, attrs.pads);
+  node.GetAttr(kDilations, attrs.dilations);
+  node.GetAttr(kDataFormat, attrs.data_format);
+  assert(attrs.strides.size() == 2 && attrs.pads.size() == 2 &&
+         attrs.dilations.size() == 2);
+  assert(attrs.data_format == "NCHW" || attrs.data_format == "NHWC");
+  return attrs;
+}
+
+static Conv2DParams GetConv2DParams(const Node& node, const TensorShape& x,
+                                    const TensorShape& w) {
+  assert(x.NumDims() == 4 && w.NumDims() == 4);
+  Conv2DAttrs attrs = GetConv2DAttrs(node);
+  Conv2DParams p;
+  p.nhwc = attrs.data_format == "NHWC";
+  p.batch = x.DimSize(0);
+  p.in_c = x.DimSize(p.nhwc ? 3 : 1);
+  p.in_h = x.DimSize(p.nhwc ? 1 : 2);
+  p.in_w = x.DimSize(p.nhwc ? 2 : 3);
+  p.out_c = w.DimSize(p.nhwc ? 3 : 0);
+  p.kernel_h = w.DimSize(p.nhwc ? 0 : 2);
+  p.kernel_w = w.DimSize(p.nhwc ? 1 : 3);
+  assert(w.DimSize(p.nhwc ? 2 : 1) == p.in_c);
+  p.stride_h = attrs.strides[0];
+  p.stride_w = attrs.strides[1];
+  p.pad_h = attrs.pads[0];
+  p.pad_w = attrs.pads[1];
+  p.dilation_h = attrs.dilations[0];
+  p.dilation_w = attrs.dilations[1];
+  p.out_h = (p.in_h + 2 * p.pad_h - p.dilation_h * (p.kernel_h - 1) - 1) /
+            p.stride_h + 1;
+  p.out_w = (p.in_w + 2 * p.pad_w - p.dilation_w * (p.kernel_w - 1) - 1) /
+            p.stride_w + 1;
+  assert(p.out_h > 0 && p.out_w > 0);
+  return p;
+}
+
+void Conv2DOp::Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  Conv2DParams p = GetConv2DParams(node, in_tensors[0].GetTensorShape(),
+                                   in_tensors[1].GetTensorShape());
+  Conv2DForward(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(), p,
+                out_tensors[0].GetHandle());
+}
+
+void Conv2DOp::Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+
+  Conv2DParams p = GetConv2DParams(node, in_shapes[0], in_shapes[1]);
+  out_shapes = {p.nhwc ? TensorShape(p.batch, p.out_h, p.out_w, p.out_c) :
+                         TensorShape(p.batch, p.out_c, p.out_h, p.out_w)};
+}
+
+void Conv2DOp::Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Conv2DAttrs attrs = GetConv2DAttrs(node);
+  Node x_grad = Conv2DBackpropInputOperator(
+      in_grad, inputs[1], inputs[0], attrs.strides, attrs.pads,
+      attrs.dilations, attrs.data_format);
+  Node w_grad = Conv2DBackpropFilterOperator(
+      inputs[0], in_grad, inputs[1], attrs.strides, attrs.pads,
+      attrs.dilations, attrs.data_format);
+  out_grads = {x_grad, w_grad};
+}
+
+void Conv2DBackpropInputOp::Compute(const Node& node,
+                                    const std::vector<Tensor>& in_tensors,
+                                    std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  Conv2DParams p = GetConv2DParams(node, out_tensors[0].GetTensorShape(),
+                                   in_tensors[1].GetTensorShape());
+  Conv2DBackwardInput(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                      p, out_tensors[0].GetHandle());
+}
+
+void Conv2DBackpropInputOp::Infer(const Node& node,
+                                  const std::vector<TensorShape>& in_shapes,
+                                  std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+
+  out_shapes = {in_shapes[2]};
+}
+
+void Conv2DBackpropInputOp::Gradient(const Node& node,
+                                     const Node& in_grad,
+                                     std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void Conv2DBackpropFilterOp::Compute(const Node& node,
+                                     const std::vector<Tensor>& in_tensors,
+                                     std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  Conv2DParams p = GetConv2DParams(node, in_tensors[0].GetTensorShape(),
+                                   out_tensors[0].GetTensorShape());
+  Conv2DBackwardFilter(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                       p, out_tensors[0].GetHandle());
+}
+
+void Conv2DBackpropFilterOp::Infer(const Node& node,
+                                   const std::vector<TensorShape>& in_shapes,
+                                   std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+
+  out_shapes = {in_shapes[2]};
+}
+
+void Conv2DBackpropFilterOp::Gradient(const Node& node,
+                                      const Node& in_grad,
+                                      std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+struct Pool2DAttrs {
+  std::vector<int> ksize;
+  std::vector<int> strides;
+  std::vector<int> pads;
+  std::string data_format;
+};
+
+static Pool2DAttrs GetPool2DAttrs(const Node& node) {
+  Pool2DAttrs attrs = {{}, {}, {0, 0}, "NCHW"};
+  node.GetAttr(kKsize, attrs.ksize);
+  node.GetAttr(kStrides, attrs.strides);
+  node.GetAttr(kPads, attrs.pads);
+  node.GetAttr(kDataFormat, attrs.data_format);
+  assert(attrs.ksize.size() == 2 && attrs.strides.size() == 2 &&
+         attrs.pads.size() == 2);
+  assert(attrs.data_format == "NCHW" || attrs.data_format == "NHWC");
+  return attrs;
+}
+
+// NCHW is pooled as batch * channels single channel images.
+static Pool2DParams GetPool2DParams(const Node& node, const TensorShape& x,
+                                    bool& nhwc) {
+  assert(x.NumDims() == 4);
+  Pool2DAttrs attrs = GetPool2DAttrs(node);
+  nhwc = attrs.data_format == "NHWC";
+  Pool2DParams p;
+  p.images = nhwc ? x.DimSize(0) : x.DimSize(0) * x.DimSize(1);
+  p.channels = nhwc ? x.DimSize(3) : 1;
+  p.in_h = x.DimSize(nhwc ? 1 : 2);
+  p.in_w = x.DimSize(nhwc ? 2 : 3);
+  p.kernel_h = attrs.ksize[0];
+  p.kernel_w = attrs.ksize[1];
+  p.stride_h = attrs.strides[0];
+  p.stride_w = attrs.strides[1];
+  p.pad_h = attrs.pads[0];
+  p.pad_w = attrs.pads[1];
+  // Every window has to hold at least one element of x.
+  assert(p.pad_h < p.kernel_h && p.pad_w < p.kernel_w);
+  p.out_h = (p.in_h + 2 * p.pad_h - p.kernel_h) / p.stride_h + 1;
+  p.out_w = (p.in_w + 2 * p.pad_w - p.kernel_w) / p.stride_w + 1;
+  assert(p.out_h > 0 && p.out_w > 0);
+  return p;
+}
+
+static Pool2DParams GetPool2DParams(const Node& node, const TensorShape& x) {
+  bool nhwc = false;
+  return GetPool2DParams(node, x, nhwc);
+}
+
+static TensorShape Pool2DOutShape(const Node& node, const TensorShape& x) {
+  bool nhwc = false;
+  Pool2DParams p = GetPool2DParams(node, x, nhwc);
+  return nhwc ? TensorShape(x.DimSize(0), p.out_h, p.out_w, x.DimSize(3)) :
+                TensorShape(x.DimSize(0), x.DimSize(1), p.out_h, p.out_w);
+}
+
+void MaxPool2DOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  Pool2DParams p = GetPool2DParams(node, in_tensors[0].GetTensorShape());
+  MaxPool2D<uint8_t>(in_tensors[0].GetHandle(), p,
+                     out_tensors[0].GetHandle(), nullptr);
+}
+
+void MaxPool2DOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {Pool2DOutShape(node, in_shapes[0])};
+}
+
+void MaxPool2DOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Pool2DAttrs attrs = GetPool2DAttrs(node);
+  Node argmax = MaxPool2DArgmaxOperator(inputs[0], attrs.ksize,
+                                        attrs.strides, attrs.pads,
+                                        attrs.data_format);
+  out_grads = {MaxPool2DGradOperator(in_grad, argmax, inputs[0],
+                                     attrs.ksize, attrs.strides, attrs.pads,
+                                     attrs.data_format)};
+}
+
+void MaxPool2DArgmaxOp::Compute(const Node& node,
+                                const std::vector<Tensor>& in_tensors,
+                                std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  Pool2DParams p = GetPool2DParams(node, in_tensors[0].GetTensorShape());
+  void* argmax = out_tensors[0].GetHandle();
+  if (p.IndexBytes() == 1) {
+    MaxPool2D(in_tensors[0].GetHandle(), p, nullptr,
+              static_cast<uint8_t*>(argmax));
+  } else {
+    MaxPool2D(in_tensors[0].GetHandle(), p, nullptr,
+              static_cast<uint16_t*>(argmax));
+  }
+}
+
+void MaxPool2DArgmaxOp::Infer(const Node& node,
+                              const std::vector<TensorShape>& in_shapes,
+                              std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  Pool2DParams p = GetPool2DParams(node, in_shapes[0]);
+  int64_t bytes = p.images * p.OutSize() * p.IndexBytes();
+  out_shapes = {TensorShape((bytes + sizeof(float) - 1) / sizeof(float))};
+}
+
+void MaxPool2DArgmaxOp::Gradient(const Node& node,
+                                 const Node& in_grad,
+                                 std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
+void MaxPool2DGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  Pool2DParams p = GetPool2DParams(node, out_tensors[0].GetTensorShape());
+  const void* argmax = in_tensors[1].GetHandle();
+  if (p.IndexBytes() == 1) {
+    MaxPool2DGrad(in_tensors[0].GetHandle(),
+                  static_cast<const uint8_t*>(argmax), p,
+                  out_tensors[0].GetHandle());
+  } else {
+    MaxPool2DGrad(in_tensors[0].GetHandle(),
+                  static_cast<const uint16_t*>(argmax), p,
+                  out_tensors[0].GetHandle());
+  }
+}
+
+void MaxPool2DGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+  assert(in_shapes[0] == Pool2DOutShape(node, in_shapes[2]));
+
+  out_shapes = {in_shapes[2]};
+}
+
+void MaxPool2DGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void AvgPool2DOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  Pool2DParams p = GetPool2DParams(node, in_tensors[0].GetTensorShape());
+  AvgPool2D(in_tensors[0].GetHandle(), p, out_tensors[0].GetHandle());
+}
+
+void AvgPool2DOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {Pool2DOutShape(node, in_shapes[0])};
+}
+
+void AvgPool2DOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Pool2DAttrs attrs = GetPool2DAttrs(node);
+  out_grads = {AvgPool2DGradOperator(in_grad, inputs[0], attrs.ksize,
+                                     attrs.strides, attrs.pads,
+                                     attrs.data_format)};
+}
+
+void AvgPool2DGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  Pool2DParams p = GetPool2DParams(node, out_tensors[0].GetTensorShape());
+  AvgPool2DGrad(in_tensors[0].GetHandle(), p, out_tensors[0].GetHandle());
+}
+
+void AvgPool2DGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[0] == Pool2DOutShape(node, in_shapes[1]));
+
+  out_shapes = {in_shapes[1]};
+}
+
+void AvgPool2DGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  Pool2DAttrs attrs = GetPool2DAttrs(node);
+  // Linear in in_grad, its adjoint is the pooling itself.
+  out_grads = {AvgPool2DOperator(in_grad, attrs.ksize, attrs.strides,
+                                 attrs.pads, attrs.data_format),
+               ZerosOperator(inputs[1])};
+}
+
+// q, k and v are [batch, len, dim], with k and v of the same length.
+static AttentionParams GetAttentionParams(const Node& node,
+                                          const TensorShape& q,
+                                          const TensorShape& k,
+                                          int64_t v_dim) {
+  assert(q.NumDims() == 3 && k.NumDims() == 3);
+  assert(k.DimSize(0) == q.DimSize(0) && k.DimSize(2) == q.DimSize(2));
+  AttentionParams p;
+  p.batch = q.DimSize(0);
+  p.q_len = q.DimSize(1);
+  p.kv_len = k.DimSize(1);
+  p.dim = q.DimSize(2);
+  p.v_dim = v_dim;
+  p.scale = 0;
+  p.causal = false;
+  node.GetAttr(kScale, p.scale);
+  node.GetAttr(kCausal, p.causal);
+  if (p.scale == 0) p.scale = 1.0f / std::sqrt(static_cast<float>(p.dim));
+  return p;
+}
+
+static AttentionParams GetAttentionParams(const Node& node,
+                                          const TensorShape& q,
+                                          const TensorShape& k,
+                                          const TensorShape& v) {
+  assert(v.NumDims() == 3 && v.DimSize(0) == k.DimSize(0) &&
+         v.DimSize(1) == k.DimSize(1));
+  return GetAttentionParams(node, q, k, v.DimSize(2));
+}
+
+void AttentionOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  AttentionParams p = GetAttentionParams(
+      node, in_tensors[0].GetTensorShape(), in_tensors[1].GetTensorShape(),
+      in_tensors[2].GetTensorShape());
+  AttentionForward(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                   in_tensors[2].GetHandle(), p, out_tensors[0].GetHandle());
+}
+
+void AttentionOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+
+  AttentionParams p = GetAttentionParams(node, in_shapes[0], in_shapes[1],
+                                         in_shapes[2]);
+  out_shapes = {TensorShape(p.batch, p.q_len, p.v_dim)};
+}
+
+void AttentionOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  bool causal = false;
+  node.GetAttr(kCausal, causal);
+  float scale = 0;
+  node.GetAttr(kScale, scale);
+
+  Node stats = AttentionStatsOperator(in_grad, node, inputs[0], inputs[1],
+                                      causal, scale);
+  out_grads.clear();
+  for (const char* wrt : {"query", "key", "value"}) {
+    out_grads.push_back(AttentionGradOperator(in_grad, inputs[0], inputs[1],
+                                              inputs[2], stats, wrt, causal,
+                                              scale));
+  }
+}
+
+void AttentionStatsOp::Compute(const Node& node,
+                               const std::vector<Tensor>& in_tensors,
+                               std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 4);
+
+  AttentionParams p = GetAttentionParams(
+      node, in_tensors[2].GetTensorShape(), in_tensors[3].GetTensorShape(),
+      in_tensors[1].GetTensorShape().DimSize(2));
+  AttentionStats(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                 in_tensors[2].GetHandle(), in_tensors[3].GetHandle(), p,
+                 out_tensors[0].GetHandle());
+}
+
+void AttentionStatsOp::Infer(const Node& node,
+                             const std::vector<TensorShape>& in_shapes,
+                             std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 4);
+  assert(in_shapes[0] == in_shapes[1]);
+
+  out_shapes = {TensorShape(in_shapes[2].DimSize(0), in_shapes[2].DimSize(1),
+                            2)};
+}
+
+void AttentionStatsOp::Gradient(const Node& node,
+                                const Node& in_grad,
+                                std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void AttentionGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 5);
+
+  AttentionParams p = GetAttentionParams(
+      node, in_tensors[1].GetTensorShape(), in_tensors[2].GetTensorShape(),
+      in_tensors[3].GetTensorShape());
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  const float* dout = in_tensors[0].GetHandle();
+  const float* q = in_tensors[1].GetHandle();
+  const float* k = in_tensors[2].GetHandle();
+  const float* v = in_tensors[3].GetHandle();
+  const float* stats = in_tensors[4].GetHandle();
+  float* grad = out_tensors[0].GetHandle();
+  if (wrt == "query") {
+    AttentionBackwardQuery(dout, q, k, v, stats, p, grad);
+  } else if (wrt == "key") {
+    AttentionBackwardKeyValue(dout, q, k, v, stats, p, grad, nullptr);
+  } else {
+    assert(wrt == "value");
+    AttentionBackwardKeyValue(dout, q, k, v, stats, p, nullptr, grad);
+  }
+}
+
+void AttentionGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 5);
+
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  if (wrt == "query") {
+    out_shapes = {in_shapes[1]};
+  } else if (wrt == "key") {
+    out_shapes = {in_shapes[2]};
+  } else {
+    out_shapes = {in_shapes[3]};
+  }
+}
+
+void AttentionGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+static float GetEpsilon(const Node& node) {
+  float epsilon = 1e-5;
+  node.GetAttr(kEpsilon, epsilon);
+  return epsilon;
+}
+
+// x is [rows, cols] and every other input [cols].
+static void CheckNormShapes(const std::vector<TensorShape>& in_shapes,
+                            int x) {
+  assert(in_shapes[x].NumDims() == 2);
+  for (size_t i = x + 1; i < in_shapes.size(); i++) {
+    assert(in_shapes[i] == TensorShape(in_shapes[x].DimSize(1)));
+  }
+}
+
+void LayerNormOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  const TensorShape& shape = in_tensors[0].GetTensorShape();
+  LayerNormForward(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                   in_tensors[2].GetHandle(), shape.DimSize(0),
+                   shape.DimSize(1), GetEpsilon(node),
+                   out_tensors[0].GetHandle());
+}
+
+void LayerNormOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+  CheckNormShapes(in_shapes, 0);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void LayerNormOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  float epsilon = GetEpsilon(node);
+  out_grads = {
+      LayerNormGradOperator(in_grad, inputs[0], inputs[1], "x", epsilon),
+      LayerNormGradOperator(in_grad, inputs[0], inputs[1], "gamma", epsilon),
+      ReduceSumToOperator(in_grad, inputs[2])};
+}
+
+void LayerNormGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  const TensorShape& shape = in_tensors[1].GetTensorShape();
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  if (wrt == "x") {
+    LayerNormBackwardInput(in_tensors[0].GetHandle(),
+                           in_tensors[1].GetHandle(),
+                           in_tensors[2].GetHandle(), shape.DimSize(0),
+                           shape.DimSize(1), GetEpsilon(node),
+                           out_tensors[0].GetHandle());
+  } else {
+    assert(wrt == "gamma");
+    LayerNormBackwardGamma(in_tensors[0].GetHandle(),
+                           in_tensors[1].GetHandle(), shape.DimSize(0),
+                           shape.DimSize(1), GetEpsilon(node),
+                           out_tensors[0].GetHandle());
+  }
+}
+
+void LayerNormGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+  assert(in_shapes[0] == in_shapes[1]);
+
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  out_shapes = {wrt == "x" ? in_shapes[1] : in_shapes[2]};
+}
+
+void LayerNormGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void BatchNormOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3 || in_tensors.size() == 5);
+
+  const TensorShape& shape = in_tensors[0].GetTensorShape();
+  bool running = in_tensors.size() == 5;
+  BatchNormForward(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                   in_tensors[2].GetHandle(),
+                   running ? in_tensors[3].GetHandle() : nullptr,
+                   running ? in_tensors[4].GetHandle() : nullptr,
+                   shape.DimSize(0), shape.DimSize(1), GetEpsilon(node),
+                   out_tensors[0].GetHandle());
+}
+
+void BatchNormOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3 || in_shapes.size() == 5);
+  CheckNormShapes(in_shapes, 0);
+
+  out_shapes = {in_shapes[0]};
+}
+
+// Running statistics are not trained, their gradients are zero.
+void BatchNormOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  float epsilon = GetEpsilon(node);
+  std::vector<Node> grad_inputs = {in_grad, inputs[0], inputs[1]};
+  grad_inputs.insert(grad_inputs.end(), inputs.begin() + 3, inputs.end());
+  out_grads = {BatchNormGradOperator(grad_inputs, "x", epsilon),
+               BatchNormGradOperator(grad_inputs, "gamma", epsilon),
+               ReduceSumToOperator(in_grad, inputs[2])};
+  for (size_t i = 3; i < inputs.size(); i++) {
+    out_grads.push_back(ZerosOperator(inputs[i]));
+  }
+}
+
+void BatchNormGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3 || in_tensors.size() == 5);
+
+  const TensorShape& shape = in_tensors[1].GetTensorShape();
+  bool running = in_tensors.size() == 5;
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  assert(wrt == "x" || wrt == "gamma");
+  float* grad = out_tensors[0].GetHandle();
+  BatchNormBackward(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(),
+                    in_tensors[2].GetHandle(),
+                    running ? in_tensors[3].GetHandle() : nullptr,
+                    running ? in_tensors[4].GetHandle() : nullptr,
+                    shape.DimSize(0), shape.DimSize(1), GetEpsilon(node),
+                    wrt == "x" ? grad : nullptr,
+                    wrt == "gamma" ? grad : nullptr);
+}
+
+void BatchNormGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3 || in_shapes.size() == 5);
+  assert(in_shapes[0] == in_shapes[1]);
+  CheckNormShapes(in_shapes, 1);
+
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  out_shapes = {wrt == "x" ? in_shapes[1] : in_shapes[2]};
+}
+
+void BatchNormGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void BatchNormStatsOp::Compute(const Node& node,
+                               const std::vector<Tensor>& in_tensors,
+                               std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  const TensorShape& shape = in_tensors[0].GetTensorShape();
+  const int64_t rows = shape.DimSize(0);
+  const int64_t cols = shape.DimSize(1);
+  std::vector<Moments> moments(cols);
+  ColumnMoments(in_tensors[0].GetHandle(), nullptr, rows, cols,
+                moments.data());
+  float* out = out_tensors[0].GetHandle();
+  for (int64_t c = 0; c < cols; c++) {
+    out[c] = moments[c].mean;
+    out[cols + c] = moments[c].m2 / rows;
+  }
+}
+
+void BatchNormStatsOp::Infer(const Node& node,
+                             const std::vector<TensorShape>& in_shapes,
+                             std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+  assert(in_shapes[0].NumDims() == 2);
+
+  out_shapes = {TensorShape(2, in_shapes[0].DimSize(1))};
+}
+
+void BatchNormStatsOp::Gradient(const Node& node,
+                                const Node& in_grad,
+                                std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
+// ids are floats, past kMaxFloatIndex rows they would silently round to
+// a neighboring row.
+static void CheckEmbeddingRows(const TensorShape& table) {
+  if (table.DimSize(0) > kMaxFloatIndex) {
+    throw std::length_error("Embedding tables hold at most 2^24 rows");
+  }
+}
+
+void EmbeddingOp::Compute(const Node& node,
+                          const std::vector<Tensor>& in_tensors,
+                          std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const TensorShape& table_shape = in_tensors[0].GetTensorShape();
+  GatherRows(in_tensors[0].GetHandle(), table_shape.DimSize(0),
+             table_shape.DimSize(1), in_tensors[1].GetHandle(),
+             in_tensors[1].NumElements(), out_tensors[0].GetHandle());
+}
+
+void EmbeddingOp::Infer(const Node& node,
+                        const std::vector<TensorShape>& in_shapes,
+                        std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[0].NumDims() == 2);
+  CheckEmbeddingRows(in_shapes[0]);
+
+  TensorShape out_shape = in_shapes[1];
+  out_shape.AppendDim(in_shapes[0].DimSize(1));
+  out_shapes = {out_shape};
+}
+
+void EmbeddingOp::Gradient(const Node& node,
+                           const Node& in_grad,
+                           std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {EmbeddingGradOperator(in_grad, inputs[1], inputs[0]),
+               ZerosOperator(inputs[1])};
+}
+
+void EmbeddingGradOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  const int64_t n = in_tensors[1].NumElements();
+  PackSparseRows(in_tensors[0].GetHandle(), in_tensors[1].GetHandle(), n,
+                 in_tensors[0].NumElements() / std::max<int64_t>(n, 1),
+                 out_tensors[0].GetHandle());
+}
+
+void EmbeddingGradOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 3);
+  assert(in_shapes[2].NumDims() == 2);
+  CheckEmbeddingRows(in_shapes[2]);
+
+  const int64_t n = in_shapes[1].NumElements();
+  const int64_t dim = in_shapes[2].DimSize(1);
+  assert(in_shapes[0].NumElements() == n * dim);
+  out_shapes = {TensorShape(n, 1 + dim)};
+}
+
+void EmbeddingGradOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void SparseConcatOp::Compute(const Node& node,
+                             const std::vector<Tensor>& in_tensors,
+                             std::vector<Tensor>& out_tensors) {
+  float* out = out_tensors[0].GetHandle();
+  for (auto& in_tensor : in_tensors) {
+    memcpy(out, in_tensor.GetHandle(),
+           in_tensor.NumElements() * sizeof(float));
+    out += in_tensor.NumElements();
+  }
+}
+
+void SparseConcatOp::Infer(const Node& node,
+                           const std::vector<TensorShape>& in_shapes,
+                           std::vector<TensorShape>& out_shapes) {
+  assert(!in_shapes.empty());
+
+  int64_t rows = 0;
+  for (auto& in_shape : in_shapes) {
+    assert(in_shape.NumDims() == 2);
+    assert(in_shape.DimSize(1) == in_shapes[0].DimSize(1));
+    rows += in_shape.DimSize(0);
+  }
+  out_shapes = {TensorShape(rows, in_shapes[0].DimSize(1))};
+}
+
+void SparseConcatOp::Gradient(const Node& node,
+                              const Node& in_grad,
+                              std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void SparseToDenseOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const TensorShape& shape = out_tensors[0].GetTensorShape();
+  float* out = out_tensors[0].GetHandle();
+  memset(out, 0, shape.NumElements() * sizeof(float));
+  ScatterAddSparseRows(in_tensors[0].GetHandle(),
+                       in_tensors[0].GetTensorShape().DimSize(0),
+                       shape.NumElements() / shape.DimSize(0), out);
+}
+
+void SparseToDenseOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[0].DimSize(1) ==
+         1 + in_shapes[1].NumElements() / in_shapes[1].DimSize(0));
+
+  out_shapes = {in_shapes[1]};
+}
+
+void SparseToDenseOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0]), ZerosOperator(inputs[1])};
+}
+
+// The CSR x of SparseMatMul from its (row_ptr, col_idx, values) tensors.
+static CsrMatrix GetCsrMatrix(const Tensor& row_ptr, const Tensor& col_idx,
+                              const Tensor& values, int64_t cols) {
+  CsrMatrix x;
+  x.row_ptr = row_ptr.GetHandle();
+  x.col_idx = col_idx.GetHandle();
+  x.values = values.GetHandle();
+  x.rows = row_ptr.NumElements() - 1;
+  x.cols = cols;
+  assert(x.NumNonzeros() == values.NumElements());
+  return x;
+}
+
+void SparseMatMulOp::Compute(const Node& node,
+                             const std::vector<Tensor>& in_tensors,
+                             std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 4);
+
+  const TensorShape& w_shape = in_tensors[3].GetTensorShape();
+  CsrMatrix x = GetCsrMatrix(in_tensors[0], in_tensors[1], in_tensors[2],
+                             w_shape.DimSize(0));
+  CsrMatMul(x, in_tensors[3].GetHandle(), w_shape.DimSize(1),
+            out_tensors[0].GetHandle());
+}
+
+void SparseMatMulOp::Infer(const Node& node,
+                           const std::vector<TensorShape>& in_shapes,
+                           std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 4);
+  assert(in_shapes[0].NumDims() == 1 && in_shapes[0].DimSize(0) >= 1);
+  assert(in_shapes[1].NumElements() == in_shapes[2].NumElements());
+  assert(in_shapes[3].NumDims() == 2);
+
+  out_shapes = {TensorShape(in_shapes[0].DimSize(0) - 1,
+                            in_shapes[3].DimSize(1))};
+}
+
+void SparseMatMulOp::Gradient(const Node& node,
+                              const Node& in_grad,
+                              std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0]), ZerosOperator(inputs[1]),
+               SparseMatMulGradOperator(in_grad, inputs[0], inputs[1],
+                                        inputs[2], inputs[3], "values"),
+               SparseMatMulGradOperator(in_grad, inputs[0], inputs[1],
+                                        inputs[2], inputs[3], "w")};
+}
+
+void SparseMatMulGradOp::Compute(const Node& node,
+                                 const std::vector<Tensor>& in_tensors,
+                                 std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 5);
+
+  const TensorShape& w_shape = in_tensors[4].GetTensorShape();
+  CsrMatrix x = GetCsrMatrix(in_tensors[1], in_tensors[2], in_tensors[3],
+                             w_shape.DimSize(0));
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  if (wrt == "values") {
+    CsrMatMulValuesGrad(x, in_tensors[0].GetHandle(),
+                        in_tensors[4].GetHandle(), w_shape.DimSize(1),
+                        out_tensors[0].GetHandle());
+  } else {
+    assert(wrt == "w");
+    CsrTransposeMatMul(x, in_tensors[0].GetHandle(), w_shape.DimSize(1),
+                       out_tensors[0].GetHandle());
+  }
+}
+
+void SparseMatMulGradOp::Infer(const Node& node,
+                               const std::vector<TensorShape>& in_shapes,
+                               std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 5);
+
+  std::string wrt;
+  node.GetAttr(kWrt, wrt);
+  out_shapes = {wrt == "values" ? in_shapes[3] : in_shapes[4]};
+}
+
+void SparseMatMulGradOp::Gradient(const Node& node,
+                                  const Node& in_grad,
+                                  std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+void QuantizedDenseOp::Compute(const Node& node,
+                               const std::vector<Tensor>& in_tensors,
+                               std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2 || in_tensors.size() == 3);
+
+  const TensorShape& x_shape = in_tensors[0].GetTensorShape();
+  const int64_t m = x_shape.DimSize(0);
+  const int64_t k = x_shape.DimSize(1);
+  int64_t n = 0;
+  float input_scale = 1;
+  node.GetAttr(kUnits, n);
+  node.GetAttr(kInputScale, input_scale);
+
+  std::vector<uint8_t> xq(m * 4 * QgemmGroups(k));
+  QuantizeActivations(in_tensors[0].GetHandle(), m, k, input_scale,
+                      xq.data());
+  const float* packed = in_tensors[1].GetHandle();
+  float* out = out_tensors[0].GetHandle();
+  if (in_tensors.size() == 3) {
+    Int8Gemm(m, n, k, xq.data(), input_scale, packed, out,
+             GetDenseEpilogue(node, in_tensors[2]));
+  } else {
+    assert(!IsRelu(node));
+    Int8Gemm(m, n, k, xq.data(), input_scale, packed, out, NoEpilogue());
+  }
+}
+
+void QuantizedDenseOp::Infer(const Node& node,
+                             const std::vector<TensorShape>& in_shapes,
+                             std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2 || in_shapes.size() == 3);
+  assert(in_shapes[0].NumDims() == 2);
+
+  int64_t n = 0;
+  node.GetAttr(kUnits, n);
+  const TensorShape& packed = in_shapes[1];
+  assert(packed.NumDims() == 3 && packed.DimSize(0) == QgemmPanels(n));
+  assert(packed.DimSize(1) == QgemmGroups(in_shapes[0].DimSize(1)) + 2);
+  assert(packed.DimSize(2) == kQgemmNr);
+  (void)packed;
+
+  TensorShape out_shape(in_shapes[0].DimSize(0), n);
+  if (in_shapes.size() == 3) {
+    TensorShape biased;
+    bool ok = BroadcastShape(out_shape, in_shapes[2], biased);
+    assert(ok && biased == out_shape);
+    (void)ok;
+  }
+  out_shapes = {out_shape};
+}
+
+// Quantized graphs are for inference only.
+void QuantizedDenseOp::Gradient(const Node& node,
+                                const Node& in_grad,
+                                std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads.clear();
+  for (auto input : inputs) {
+    out_grads.push_back(ZerosOperator(input));
+  }
+}
+
+static uint64_t GetSeed(const Node& node) {
+  int64_t seed = 0;
+  node.GetAttr(kSeed, seed);
+  return static_cast<uint64_t>(seed);
+}
+
+void RandomUniformOp::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  float low = 0.0, high = 1.0;
+  node.GetAttr(kLow, low);
+  node.GetAttr(kHigh, high);
+  PhiloxUniform(GetSeed(node), 0, low, high, out_tensors[0].NumElements(),
+                out_tensors[0].GetHandle());
+}
+
+void RandomUniformOp::Infer(const Node& node,
+                            const std::vector<TensorShape>& in_shapes,
+                            std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 1);
+
+  out_shapes = {in_shapes[0]};
+}
+
+void RandomUniformOp::Gradient(const Node& node,
+                               const Node& in_grad,
+                               std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  out_grads = {ZerosOperator(inputs[0])};
+}
+
+void RandomNormalOp::Compute(const Node& node,
+                             const std::vector<Tensor>& in_tensors,
+                             std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  float mean = 0.0, stddev = 1.0;
+  node.GetAttr(kMean, mean);
+  node.GetAttr(kStddev, stddev);
+  PhiloxNormal(GetSeed(node), 0, mean, stddev, out_tensors[0].NumElements(),
+               out_tensors[0].GetHandle());
+}
+
+void TruncatedNormalOp::Compute(const Node& node,
+                                const std::vector<Tensor>& in_tensors,
+                                std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  float mean = 0.0, stddev = 1.0;
+  node.GetAttr(kMean, mean);
+  node.GetAttr(kStddev, stddev);
+  PhiloxTruncatedNormal(GetSeed(node), 0, mean, stddev,
+                        out_tensors[0].NumElements(),
+                        out_tensors[0].GetHandle());
+}
+
+void DropoutOp::Compute(const Node& node,
+                        const std::vector<Tensor>& in_tensors,
+                        std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  float rate = 0.0;
+  node.GetAttr(kRate, rate);
+  assert(rate >= 0 && rate < 1);
+  uint32_t stream = static_cast<uint32_t>(in_tensors[1].GetHandle()[0]);
+  PhiloxDropout(GetSeed(node), stream, rate, in_tensors[0].GetHandle(),
+                in_tensors[0].NumElements(), out_tensors[0].GetHandle());
+}
+
+void DropoutOp::Infer(const Node& node,
+                      const std::vector<TensorShape>& in_shapes,
+                      std::vector<TensorShape>& out_shapes) {
+  assert(in_shapes.size() == 2);
+  assert(in_shapes[1].NumElements() == 1);
+
+  out_shapes = {in_shapes[0]};
+}
+
+// The same seed and step give the same mask, so the backward pass zeroes
+// and scales the gradient exactly as the forward pass did its input.
+void DropoutOp::Gradient(const Node& node,
+                         const Node& in_grad,
+                         std::vector<Node>& out_grads) {
+  std::vector<Node> inputs;
+  node.GetInputNodes(inputs);
+  float rate = 0.0;
+  node.GetAttr(kRate, rate);
+  out_grads = {DropoutOperator(in_grad, inputs[1], rate,
+                               static_cast<int64_t>(GetSeed(node))),
+               ZerosOperator(inputs[1])};
+}
+
+// The fp32 rows Gemm finished, after epilogue, are stored as T while they
+// are still in cache. Gemm is given no c, so the fp32 product only exists
+// one block at a time.
+template <typename T, typename Epilogue>
+struct ConvertEpilogue {
+  Epilogue epilogue;
+  T* out;
+  int64_t ldc;
+
+  void operator()(int64_t row, int64_t col, float* c, int64_t len) const {
+    epilogue(row, col, c, len);
+    ConvertFromFloat(c, len, out + row * ldc + col);
+  }
+};
+
+template <typename T, typename Functor, typename BinaryOp>
+void HalfBinaryOp<T, Functor, BinaryOp>::Compute(
+    const Node& node, const std::vector<Tensor>& in_tensors,
+    std::vector<Tensor>& out_tensors) {
+  BinaryCompute<Functor, T>(in_tensors, out_tensors);
+}
+
+template <typename T>
+void HalfMatMulOp<T>::Compute(const Node& node,
+                              const std::vector<Tensor>& in_tensors,
+                              std::vector<Tensor>& out_tensors) {
+  const TensorShape& shape = out_tensors[0].GetTensorShape();
+  ConvertEpilogue<T, NoEpilogue> epilogue{
+      NoEpilogue(), out_tensors[0].GetData<T>(), shape.DimSize(1)};
+  MatMulCompute<T>(node, in_tensors, nullptr, epilogue);
+}
+
+template <typename T>
+void HalfDenseOp<T>::Compute(const Node& node,
+                             const std::vector<Tensor>& in_tensors,
+                             std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 3);
+
+  const TensorShape& x_shape = in_tensors[0].GetTensorShape();
+  int64_t m = x_shape.DimSize(0);
+  int64_t k = x_shape.DimSize(1);
+  int64_t n = in_tensors[1].GetTensorShape().DimSize(1);
+
+  // The bias is one row at most, the epilogue reads it as float.
+  Tensor bias = in_tensors[2].Cast(DataType::kFloat32);
+  ConvertEpilogue<T, DenseEpilogue> epilogue{
+      GetDenseEpilogue(node, bias), out_tensors[0].GetData<T>(), n};
+  Gemm(false, false, m, n, k, in_tensors[0].GetData<T>(),
+       in_tensors[1].GetData<T>(), nullptr, epilogue);
+}
+
+template <typename T>
+void HalfReduceSumToOp<T>::Compute(const Node& node,
+                                   const std::vector<Tensor>& in_tensors,
+                                   std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const TensorShape& in_shape = in_tensors[0].GetTensorShape();
+  const TensorShape& out_shape = out_tensors[0].GetTensorShape();
+  T* out = out_tensors[0].GetData<T>();
+  if (in_tensors[0].NumElements() == out_tensors[0].NumElements()) {
+    memcpy(out, in_tensors[0].GetData<T>(), out_tensors[0].NumBytes());
+  } else {
+    std::vector<float> sums(out_shape.NumElements());
+    ReduceToShape(in_tensors[0].GetData<T>(), in_shape, sums.data(),
+                  out_shape);
+    ConvertFromFloat(sums.data(), sums.size(), out);
+  }
+}
+
+// bf16 and fp16 keep the sign in the top bit, so a value is positive
+// exactly when its bits are as a positive int16, and the relu kernels move
+// bits without converting them.
+static bool IsPositive(uint16_t bits) {
+  return static_cast<int16_t>(bits) > 0;
+}
+
+template <typename T>
+void HalfActivationGradOp<T>::Compute(const Node& node,
+                                      const std::vector<Tensor>& in_tensors,
+                                      std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 2);
+
+  const T* grad = in_tensors[0].GetData<T>();
+  const T* out = in_tensors[1].GetData<T>();
+  T* dst = out_tensors[0].GetData<T>();
+  bool relu = IsRelu(node);
+  ThreadPool::Global()->ParallelForRange(out_tensors[0].NumElements(),
+                                         kElementwiseGrain,
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      dst[i].bits = !relu || IsPositive(out[i].bits) ? grad[i].bits : 0;
+    }
+  });
+}
+
+template <typename T>
+void HalfReluOp<T>::Compute(const Node& node,
+                            const std::vector<Tensor>& in_tensors,
+                            std::vector<Tensor>& out_tensors) {
+  assert(in_tensors.size() == 1);
+
+  const T* in = in_tensors[0].GetData<T>();
+  T* out = out_tensors[0].GetData<T>();
+  ThreadPool::Global()->ParallelForRange(out_tensors[0].NumElements(),
+                                         kElementwiseGrain,
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      out[i].bits = IsPositive(in[i].bits) ? in[i].bits : 0;
+    }
+  });
+}
+
+template <typename T>
+using HalfAddOp = HalfBinaryOp<T, AddFunctor, AddOp>;
+template <typename T>
+using HalfMinusOp = HalfBinaryOp<T, MinusFunctor, MinusOp>;
+template <typename T>
+using HalfMultiplyOp = HalfBinaryOp<T, MultiplyFunctor, MultiplyOp>;
+template <typename T>
+using HalfDevideOp = HalfBinaryOp<T, DevideFunctor, DevideOp>;
+
+REGISTER_OP("Add", AddOp);
+REGISTER_OP("AddN", AddNOp);
+REGISTER_OP("AddByConst", AddByConstOp);
+REGISTER_OP("Minus", MinusOp);
+REGISTER_OP("MinusByConst", MinusByConstOp);
+REGISTER_OP("Multiply", MultiplyOp);
+REGISTER_OP("MultiplyByConst", MultiplyByConstOp);
+REGISTER_OP("Devide", DevideOp);
+REGISTER_OP("DevideByConst", DevideByConstOp);
+REGISTER_OP("MatMul", MatMulOp);
+REGISTER_OP("BatchMatMul", BatchMatMulOp);
+REGISTER_OP("Dense", DenseOp);
+REGISTER_OP("ActivationGrad", ActivationGradOp);
+REGISTER_OP("Zeros", ZerosOp);
+REGISTER_OP("Ones", OnesOp);
+REGISTER_OP("Fill", FillOp);
+REGISTER_OP("ReduceSumAxisZero", ReduceSumAxisZeroOp);
+REGISTER_OP("ReduceSum", ReduceSumOp);
+REGISTER_OP("ReduceMean", ReduceMeanOp);
+REGISTER_OP("ReduceMax", ReduceMaxOp);
+REGISTER_OP("ArgMax", ArgMaxOp);
+REGISTER_OP("ReduceGrad", ReduceGradOp);
+REGISTER_OP("ReduceSumTo", ReduceSumToOp);
+REGISTER_OP("BroadCastTo", BroadCastToOp);
+REGISTER_OP("Softmax", SoftmaxOp);
+REGISTER_OP("SoftmaxCrossEntropy", SoftmaxCrossEntropyOp);
+REGISTER_OP("Relu", ReluOp);
+REGISTER_OP("ReluMask", ReluMaskOp);
+REGISTER_OP("ReluGrad", ReluGradOp);
+REGISTER_OP("Conv2D", Conv2DOp);
+REGISTER_OP("Conv2DBackpropInput", Conv2DBackpropInputOp);
+REGISTER_OP("Conv2DBackpropFilter", Conv2DBackpropFilterOp);
+REGISTER_OP("MaxPool2D", MaxPool2DOp);
+REGISTER_OP("MaxPool2DArgmax", MaxPool2DArgmaxOp);
+REGISTER_OP("MaxPool2DGrad", MaxPool2DGradOp);
+REGISTER_OP("AvgPool2D", AvgPool2DOp);
+REGISTER_OP("AvgPool2DGrad", AvgPool2DGradOp);
+REGISTER_OP("Attention", AttentionOp);
+REGISTER_OP("AttentionStats", AttentionStatsOp);
+REGISTER_OP("AttentionGrad", AttentionGradOp);
+REGISTER_OP("LayerNorm", LayerNormOp);
+REGISTER_OP("LayerNormGrad", LayerNormGradOp);
+REGISTER_OP("BatchNorm", BatchNormOp);
+REGISTER_OP("BatchNormGrad", BatchNormGradOp);
+REGISTER_OP("BatchNormStats", BatchNormStatsOp);
+REGISTER_OP("Embedding", EmbeddingOp);
+REGISTER_OP("EmbeddingGrad", EmbeddingGradOp);
+REGISTER_OP("SparseConcat", SparseConcatOp);
+REGISTER_OP("SparseToDense", SparseToDenseOp);
+REGISTER_OP("SparseMatMul", SparseMatMulOp);
+REGISTER_OP("SparseMatMulGrad", SparseMatMulGradOp);
+REGISTER_OP("QuantizedDense", QuantizedDenseOp);
+REGISTER_OP("RandomUniform", RandomUniformOp);
+REGISTER_OP("RandomNormal", RandomNormalOp);
+REGISTER_OP("TruncatedNormal", TruncatedNormalOp);
+REGISTER_OP("Dropout", DropoutOp);
+REGISTER_HALF_KERNEL("Add", HalfAddOp);
+REGISTER_HALF_KERNEL("Minus", HalfMinusOp);
+REGISTER_HALF_KERNEL("Multiply", HalfMultiplyOp);
+REGISTER_HALF_KERNEL("Devide", HalfDevideOp);
+REGISTER_HALF_KERNEL("MatMul", HalfMatMulOp);
+REGISTER_HALF_KERNEL("Dense", HalfDenseOp);
+REGISTER_HALF_KERNEL("ReduceSumTo", HalfReduceSumToOp);
+REGISTER_HALF_KERNEL("ActivationGrad", HalfActivationGradOp);
+REGISTER_HALF_KERNEL("Relu", HalfReluOp);
+
+Op* Op::Create(const std::string& name) {
+  Op* op = OpRegistry::Global()->Lookup(name);
+  if (op == nullptr) {
+    throw std::invalid_argument("Unknown op type: " + name);
   }
+  return op;
 }
 
@@ -1,24 +1,1223 @@
 #ifndef OP_H_
 #define OP_H_
 
-#include <cassert>
+#include <memory>
+#include <iostream>
+#include <string>
 #include <vector>
-#include "../context.h"
-#include "../node.h"
-#include "../tensor.h"
+#include "tensor.h"
+#include "operator.h"
+
+class Node;
 
-template <typename T>
 class Op {
- public:
-  virtual void Compute(OpContext* context) = 0;
+public:
+  Op(const std::string& op_type) : op_type_(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors, 
+                       std::vector<Tensor>& out_tensors) = 0;
+    
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) = 0;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) = 0;
+
+  // Inputs the output may be written over, in order of preference. The
+  // Executor hands the kernel an output aliasing one of them when that input
+  // is dead after this op, so Compute must allow out_tensors[0] to share its
+  // buffer with any input listed here.
+  virtual std::vector<int> InplaceInputs() const { return {}; }
+
+  // Whether the output is a compact summary kept for the backward pass,
+  // like Relu's bit mask. The Executor evaluates such ops as soon as their
+  // inputs are ready, so those inputs are not kept alive for them.
+  virtual bool EvaluateEarly() const { return false; }
+
+  // Inputs of node only read for their shape. The Executor hands the kernel
+  // an empty tensor for them, so their values need not be kept alive for
+  // this op.
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const {
+    return {};
+  }
+
+  // Whether the output is a row-sparse value, packed as in sparse_tensor.h.
+  // Executor::Gradient keeps such gradients sparse for variables and
+  // scatters them into dense ones anywhere else.
+  virtual bool IsSparse() const { return false; }
+
+  std::string GetOpType() { return op_type_; }
+
+  // Returns the fp32 CPU kernel registered for name, which also carries the
+  // op's shape inference and gradient. Ops are stateless singletons shared
+  // by every node of their type.
+  static Op* Create(const std::string& name);
+
+private:
+  std::string op_type_;
+};
+
+class AddOp : public Op {
+public:
+  AddOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0, 1}; }
+};
+
+// Sums any number of inputs of the same shape in one pass.
+class AddNOp : public Op {
+public:
+  AddNOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class AddByConstOp : public Op {
+public:
+  AddByConstOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class MinusOp : public Op {
+public:
+  MinusOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0, 1}; }
+};
+
+class MinusByConstOp : public Op {
+public:
+  MinusByConstOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class MultiplyOp : public Op {
+public:
+  MultiplyOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0, 1}; }
+};
+
+class MultiplyByConstOp : public Op {
+public:
+  MultiplyByConstOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class DevideOp : public Op {
+public:
+  DevideOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0, 1}; }
+};
+
+class DevideByConstOp : public Op {
+public:
+  DevideByConstOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class MatMulOp : public Op {
+public:
+  MatMulOp(const std::string& op_type) : Op(op_type) {}
+
+  // TODO Matrix transpose
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+  
+};
+
+// op(a) * op(b) over a batch of matrices, [batch, m, k] x [batch, k, n] ->
+// [batch, m, n] before transposes. An input with a batch of 1, or of rank 2,
+// is broadcast over the batch of the other.
+class BatchMatMulOp : public Op {
+public:
+  BatchMatMulOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
 
   virtual void Infer(const Node& node,
                      const std::vector<TensorShape>& in_shapes,
-                     std::vector<TensorShape>& out_shapes) = 0;
+                     std::vector<TensorShape>& out_shapes) override;
 
   virtual void Gradient(const Node& node,
-                        const Node& in_node,
-                        std::vector<Node>& out_grads) = 0;
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// act(x * w + b) for x [m, k] and w [k, n]. b broadcasts to [m, n], and the
+// bias and activation ("none" or "relu") are applied to each block of the
+// product as the GEMM finishes it.
+class DenseOp : public Op {
+public:
+  DenseOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Gradient of an activation taken from its output, in_grad * act'(out).
+class ActivationGradOp : public Op {
+public:
+  ActivationGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+class ZerosOp : public Op {
+public:
+  ZerosOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {0};
+  }
+};
+
+class OnesOp : public Op {
+public:
+  OnesOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {0};
+  }
+};
+
+class FillOp : public Op {
+public:
+  FillOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {0};
+  }
+};
+
+class ReduceSumAxisZeroOp : public Op {
+public:
+  ReduceSumAxisZeroOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+  
+};
+
+class ReduceSumOp : public Op {
+public:
+  ReduceSumOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+class ReduceMeanOp : public Op {
+public:
+  ReduceMeanOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+class ReduceMaxOp : public Op {
+public:
+  ReduceMaxOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+class ArgMaxOp : public Op {
+public:
+  ArgMaxOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+class ReduceGradOp : public Op {
+public:
+  ReduceGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  // Max compares x with the forward output, sum and mean only need its
+  // shape.
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override;
+};
+
+class ReduceSumToOp : public Op {
+public:
+  ReduceSumToOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {1};
+  }
+};
+
+class BroadCastToOp : public Op {
+public:
+  BroadCastToOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {1};
+  }
+};
+
+class SoftmaxOp : public Op {
+public:
+  SoftmaxOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+
+};
+
+class SoftmaxCrossEntropyOp : public Op {
+public:
+  SoftmaxCrossEntropyOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node, 
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node, 
+                     const std::vector<TensorShape>& in_shapes, 
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& ndoe, 
+                        const Node& in_grad, 
+                        std::vector<Node>& out_grads) override;
+};
+
+class ReluOp : public Op {
+public:
+  ReluOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+// One bit per element of the input, set where it is positive, packed into
+// 32-bit words stored in a float tensor of ceil(n / 32) elements.
+class ReluMaskOp : public Op {
+public:
+  ReluMaskOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual bool EvaluateEarly() const override { return true; }
+};
+
+// in_grad with the elements whose ReluMask bit is clear zeroed.
+class ReluGradOp : public Op {
+public:
+  ReluGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+// 2-D convolution of x (NCHW, or NHWC when data_format says so) with w
+// (OIHW, or HWIO for NHWC). strides, pads and dilations are {h, w}.
+class Conv2DOp : public Op {
+public:
+  Conv2DOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Gradient of Conv2D with respect to x from (in_grad, w, x), x only gives
+// the shape.
+class Conv2DBackpropInputOp : public Op {
+public:
+  Conv2DBackpropInputOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {2};
+  }
+};
+
+// Gradient of Conv2D with respect to w from (x, in_grad, w), w only gives
+// the shape.
+class Conv2DBackpropFilterOp : public Op {
+public:
+  Conv2DBackpropFilterOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {2};
+  }
+};
+
+// Max and average pooling of x over ksize windows, NCHW or NHWC. strides,
+// pads and ksize are {h, w}, padding never wins a max and is not counted in
+// an average.
+class MaxPool2DOp : public Op {
+public:
+  MaxPool2DOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Offset of the maximum within each window of MaxPool2D, one uint8 (uint16
+// for windows over 256 elements) per output element, packed into a float
+// tensor. Taken right after x, so x is not kept for the backward pass.
+class MaxPool2DArgmaxOp : public Op {
+public:
+  MaxPool2DArgmaxOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual bool EvaluateEarly() const override { return true; }
+};
+
+// Gradient of MaxPool2D from (in_grad, argmax, x), x only gives the shape.
+class MaxPool2DGradOp : public Op {
+public:
+  MaxPool2DGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {2};
+  }
+};
+
+class AvgPool2DOp : public Op {
+public:
+  AvgPool2DOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Gradient of AvgPool2D from (in_grad, x), x only gives the shape.
+class AvgPool2DGradOp : public Op {
+public:
+  AvgPool2DGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {1};
+  }
+};
+
+// softmax(scale * q * k^T) * v for q [batch, q_len, dim], k [batch, kv_len,
+// dim] and v [batch, kv_len, v_dim], fused so the q_len x kv_len scores are
+// never stored.
+class AttentionOp : public Op {
+public:
+  AttentionOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The per-query log-sum-exp of the scores and dout . out that the attention
+// gradients share, [batch, q_len, 2] from (dout, out, q, k).
+class AttentionStatsOp : public Op {
+public:
+  AttentionStatsOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The gradient of attention with respect to its "wrt" input, "query", "key"
+// or "value", from (dout, q, k, v, stats).
+class AttentionGradOp : public Op {
+public:
+  AttentionGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// (x - mean) / sqrt(var + epsilon) * gamma + beta with the statistics of
+// each row of x [rows, cols], gamma and beta are [cols].
+class LayerNormOp : public Op {
+public:
+  LayerNormOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The gradient of LayerNorm with respect to its "wrt" input, "x" or
+// "gamma", from (dy, x, gamma).
+class LayerNormGradOp : public Op {
+public:
+  LayerNormGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// (x - mean) / sqrt(var + epsilon) * gamma + beta per column of x [rows,
+// cols]. With inputs (x, gamma, beta) the statistics are those of the batch,
+// with (x, gamma, beta, mean, var) the given running ones.
+class BatchNormOp : public Op {
+public:
+  BatchNormOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The gradient of BatchNorm with respect to its "wrt" input, "x" or
+// "gamma", from (dy, x, gamma) or (dy, x, gamma, mean, var).
+class BatchNormGradOp : public Op {
+public:
+  BatchNormGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The batch mean and biased variance of each column of x, [2, cols], for
+// updating running statistics.
+class BatchNormStatsOp : public Op {
+public:
+  BatchNormStatsOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Rows ids of table [rows, dim], [ids..., dim]. ids holds integral row
+// indices as floats. The table's gradient is sparse, one row per id.
+class EmbeddingOp : public Op {
+public:
+  EmbeddingOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The sparse gradient of Embedding's table from (dy, ids, table): row ids[i]
+// gets dy[i], as [n, 1 + dim] packed rows.
+class EmbeddingGradOp : public Op {
+public:
+  EmbeddingGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {2};
+  }
+
+  virtual bool IsSparse() const override { return true; }
+};
+
+// The sum of sparse values of one dense shape, their rows concatenated.
+class SparseConcatOp : public Op {
+public:
+  SparseConcatOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual bool IsSparse() const override { return true; }
+};
+
+// The sparse value inputs[0] scattered into a dense tensor shaped like
+// inputs[1].
+class SparseToDenseOp : public Op {
+public:
+  SparseToDenseOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {1};
+  }
+};
+
+// x * w for a CSR x given as (row_ptr, col_idx, values) and a dense w
+// [cols, n], see spmm.h.
+class SparseMatMulOp : public Op {
+public:
+  SparseMatMulOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// The gradient of SparseMatMul with respect to its "wrt" input, "values" or
+// "w", from (dy, row_ptr, col_idx, values, w).
+class SparseMatMulGradOp : public Op {
+public:
+  SparseMatMulGradOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Dense on int8 for inference: x [m, k] is quantized with the calibrated
+// "input_scale" and multiplied by weights packed with PackInt8Weights into
+// "units" channels, then dequantized with the bias and activation fused.
+// Inputs are (x, packed) or (x, packed, bias), see qgemm.h.
+class QuantizedDenseOp : public Op {
+public:
+  QuantizedDenseOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+};
+
+// Random values shaped like the input, from the Philox generator of
+// random.h. The "seed" attribute fixes the values, so a graph recomputes
+// the same tensor on every run. Uniform in ["low", "high").
+class RandomUniformOp : public Op {
+public:
+  RandomUniformOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> ShapeOnlyInputs(const Node& node) const override {
+    return {0};
+  }
+};
+
+// Normal with the "mean" and "stddev" attributes.
+class RandomNormalOp : public RandomUniformOp {
+public:
+  RandomNormalOp(const std::string& op_type) : RandomUniformOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+// Normal, with values beyond two stddev from the mean redrawn.
+class TruncatedNormalOp : public RandomUniformOp {
+public:
+  TruncatedNormalOp(const std::string& op_type) : RandomUniformOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+// Inverted dropout of x with inputs (x, step): each element is zeroed with
+// probability "rate" and the rest scaled by 1 / (1 - rate). The mask is a
+// function of ("seed", step), where step is a scalar counting training
+// steps, so every step draws a new mask. The gradient is Dropout of the
+// incoming gradient with the same seed and step, which regenerates the mask
+// instead of keeping it alive between the passes.
+class DropoutOp : public Op {
+public:
+  DropoutOp(const std::string& op_type) : Op(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+
+  virtual void Infer(const Node& node,
+                     const std::vector<TensorShape>& in_shapes,
+                     std::vector<TensorShape>& out_shapes) override;
+
+  virtual void Gradient(const Node& node,
+                        const Node& in_grad,
+                        std::vector<Node>& out_grads) override;
+
+  virtual std::vector<int> InplaceInputs() const override { return {0}; }
+};
+
+// The bf16 and fp16 kernels of the ops that carry most of the traffic when
+// training in mixed precision, see Executor::SetMixedPrecision. They keep
+// the fp32 op's shape inference and gradient and only replace Compute,
+// which converts to float as it reads and accumulates in fp32.
+template <typename T, typename Functor, typename BinaryOp>
+class HalfBinaryOp : public BinaryOp {
+public:
+  HalfBinaryOp(const std::string& op_type) : BinaryOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+template <typename T>
+class HalfMatMulOp : public MatMulOp {
+public:
+  HalfMatMulOp(const std::string& op_type) : MatMulOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+template <typename T>
+class HalfDenseOp : public DenseOp {
+public:
+  HalfDenseOp(const std::string& op_type) : DenseOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+template <typename T>
+class HalfReduceSumToOp : public ReduceSumToOp {
+public:
+  HalfReduceSumToOp(const std::string& op_type) : ReduceSumToOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+template <typename T>
+class HalfActivationGradOp : public ActivationGradOp {
+public:
+  HalfActivationGradOp(const std::string& op_type)
+      : ActivationGradOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
+};
+
+template <typename T>
+class HalfReluOp : public ReluOp {
+public:
+  HalfReluOp(const std::string& op_type) : ReluOp(op_type) {}
+
+  virtual void Compute(const Node& node,
+                       const std::vector<Tensor>& in_tensors,
+                       std::vector<Tensor>& out_tensors) override;
 };
 
-#endif // OP_H_
+#endif
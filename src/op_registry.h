@@ -0,0 +1,95 @@
+#ifndef OP_REGISTRY_H_
+#define OP_REGISTRY_H_
+
+#include <cassert>
+#include <string>
+#include <unordered_map>
+#include "context.h"
+#include "data_type.h"
+#include "half.h"
+
+class Op;
+
+// OpRegistry maps (op type, device, dtype) to a stateless kernel singleton.
+// Kernels register themselves from the file that defines them:
+//
+//   REGISTER_KERNEL("MatMul", DeviceType::kCPU, DataType::kFloat32, MatMulOp);
+//
+// so adding a specialized variant never touches the rest of the engine.
+class OpRegistry {
+public:
+  static OpRegistry* Global() {
+    static OpRegistry* registry = new OpRegistry();
+    return registry;
+  }
+
+  void Register(const std::string& op_type, DeviceType device,
+                DataType dtype, Op* op) {
+    Key key{op_type, device, dtype};
+    assert(kernels_.find(key) == kernels_.end());
+    kernels_[key] = op;
+  }
+
+  // Returns nullptr when no kernel is registered for the key.
+  Op* Lookup(const std::string& op_type, 
+             DeviceType device = DeviceType::kCPU,
+             DataType dtype = DataType::kFloat32) const {
+    auto iter = kernels_.find(Key{op_type, device, dtype});
+    return iter == kernels_.end() ? nullptr : iter->second;
+  }
+
+private:
+  struct Key {
+    std::string op_type;
+    DeviceType device;
+    DataType dtype;
+
+    bool operator==(const Key& rhs) const {
+      return op_type == rhs.op_type && device == rhs.device &&
+             dtype == rhs.dtype;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<std::string>()(key.op_type) ^
+             (static_cast<size_t>(key.device) << 8) ^
+             (static_cast<size_t>(key.dtype) << 16);
+    }
+  };
+
+  std::unordered_map<Key, Op*, KeyHash> kernels_;
+};
+
+template <typename OpType>
+class OpRegistrar {
+public:
+  OpRegistrar(const std::string& op_type, DeviceType device, DataType dtype) {
+    // Kernels live as long as the process.
+    OpRegistry::Global()->Register(op_type, device, dtype,
+                                   new OpType(op_type));
+  }
+};
+
+#define REGISTER_KERNEL_UNIQ(ctr, op_type, device, dtype, OpType) \
+  static OpRegistrar<OpType> op_registrar_##ctr(op_type, device, dtype)
+
+#define REGISTER_KERNEL_IMPL(ctr, op_type, device, dtype, OpType) \
+  REGISTER_KERNEL_UNIQ(ctr, op_type, device, dtype, OpType)
+
+#define REGISTER_KERNEL(op_type, device, dtype, OpType) \
+  REGISTER_KERNEL_IMPL(__COUNTER__, op_type, device, dtype, OpType)
+
+// Shorthand for the fp32 CPU kernel, which also defines the op's shape
+// inference and gradient for graph construction.
+#define REGISTER_OP(op_type, OpType) \
+  REGISTER_KERNEL(op_type, DeviceType::kCPU, DataType::kFloat32, OpType)
+
+// Registers the CPU kernels OpType<BFloat16> and OpType<Float16>.
+#define REGISTER_HALF_KERNEL(op_type, OpType)                            \
+  REGISTER_KERNEL(op_type, DeviceType::kCPU, DataType::kBFloat16,        \
+                  OpType<BFloat16>);                                     \
+  REGISTER_KERNEL(op_type, DeviceType::kCPU, DataType::kFloat16,         \
+                  OpType<Float16>)
+
+#endif  // OP_REGISTRY_H_
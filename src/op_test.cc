@@ -1,11 +1,60 @@
-
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include "cpu_allocator.h"
 #include "executor.h"
+#include "graph_rewrite.h"
+#include "numa.h"
 #include "operator.h"
+#include "quantize.h"
+#include "sparse_tensor.h"
+#include "thread_pool.h"
+
+static void Check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cout << "FAILED: " << what << std::endl;
+    exit(1);
+  }
+}
 
+// Asserts tensor holds expected, element by element.
+static void ExpectValues(const Tensor& tensor,
+                         const std::vector<float>& expected,
+                         float tolerance = 1e-5) {
+  Check(tensor.NumElements() == static_cast<int64_t>(expected.size()),
+        "size " + std::to_string(tensor.NumElements()) + " of " +
+        tensor.Debug());
+  Tensor values = tensor.Cast(DataType::kFloat32);
+  for (size_t i = 0; i < expected.size(); i++) {
+    Check(std::fabs(values.GetHandle()[i] - expected[i]) <= tolerance,
+          "element " + std::to_string(i) + " of " + tensor.Debug() +
+          ", expected " + std::to_string(expected[i]));
+  }
+}
+
+static void ExpectShape(const Tensor& tensor, const TensorShape& shape) {
+  Check(tensor.GetTensorShape() == shape, "shape of " + tensor.Debug());
+}
+
+// Runs out on feed and returns its value.
+static Tensor Eval(const Node& out, std::unordered_map<Node, Tensor> feed,
+                   DataType dtype = DataType::kFloat32) {
+  Executor exec(Context::cpu(), out, {});
+  exec.SetMixedPrecision(dtype);
+  std::vector<Tensor> out_vals;
+  std::vector<Tensor> grad_vals;
+  exec.Run({out}, out_vals, {}, grad_vals, feed);
+  return out_vals[0];
+}
 
 int main() {
   float* src = new float[4 * 2];
@@ -24,108 +73,120 @@ int main() {
   Node node_a("a");
   Node node_b("b");
 
-  // Test AddOperator
-  std::cout << "test add operator" << std::endl;
-  Node node_c = AddOperator(node_a, node_b);
-  Executor exec_add({node_c}, ctx);
   std::unordered_map<Node, Tensor> feed_dicts;
   feed_dicts[node_a] = tensor_a;
   feed_dicts[node_b] = tensor_b;
-  std::unordered_map<Node, Tensor> dicts = feed_dicts;
-  exec_add.Run(dicts);
-  dicts[node_c].Debug();
+  std::unordered_map<Node, Tensor> dicts;
+  const std::vector<float> twos(8, 2);
+
+  // Test AddOperator
+  std::cout << "test add operator" << std::endl;
+  Node node_c = AddOperator(node_a, node_b);
+  ExpectValues(Eval(node_c, feed_dicts), twos);
 
   // Test AddByConstOperator
   std::cout << "test add by const operator" << std::endl;
   node_c = AddByConstOperator(node_a, 2.5);
-  Executor exec_add_by_const({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_add_by_const.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 3.5));
 
-  // Test MinusOperator 
+  // Test MinusOperator
   std::cout << "test minus operator" << std::endl;
   node_c = MinusOperator(node_a, node_b);
-  Executor exec_minus({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_minus.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 0));
 
   // Test MinusByConstOperator
   std::cout << "test minus by const operator" << std::endl;
   node_c = MinusByConstOperator(node_a, 2.5);
-  Executor exec_minus_by_const({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_minus_by_const.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, -1.5));
 
   // Test MultiplyOperator
   std::cout << "test multiply operator" << std::endl;
   node_c = MultiplyOperator(node_a, node_b);
-  Executor exec_multiply({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_multiply.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 1));
 
   // Test MultiplyByConstOperator
   std::cout << "test multiply by const operator" << std::endl;
   node_c = MultiplyByConstOperator(node_a, 2.5);
-  Executor exec_multiply_by_const({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_multiply_by_const.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 2.5));
 
   // Test DevideOperator
   std::cout << "test devide operator" << std::endl;
   node_c = DevideOperator(node_a, node_b);
-  Executor exec_devide({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_devide.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 1));
 
   // Test DevideByConstOperator
-  std::cout << "test multiply by const operator" << std::endl;
+  std::cout << "test devide by const operator" << std::endl;
   node_c = DevideByConstOperator(node_a, 2.5);
-  Executor exec_devide_by_const({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_devide_by_const.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 0.4));
 
-  // Test MatMulOperator 
+  // Test MatMulOperator
   std::cout << "test matmul operator" << std::endl;
   node_c = MatMulOperator(node_a, node_b, true, false);
-  Executor exec_matmul({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_matmul.Run(dicts);
-  dicts[node_c].Debug();
+  Tensor matmul_val = Eval(node_c, feed_dicts);
+  ExpectShape(matmul_val, TensorShape(2, 2));
+  ExpectValues(matmul_val, {4, 4, 4, 4});
+
+  // Test MatMul gradients under every transposition. The loss
+  // sum(op(A) op(B) * G) is linear in each input, so central differences
+  // of a unit step are exact for these small integers.
+  std::cout << "test matmul gradients" << std::endl;
+  Node lhs("lhs");
+  Node rhs("rhs");
+  Node weights("weights");
+  const int64_t m = 3, k = 5, n = 4;
+  for (int trans = 0; trans < 4; trans++) {
+    bool trans_a = trans & 1;
+    bool trans_b = trans & 2;
+    Tensor lhs_val(trans_a ? TensorShape(k, m) : TensorShape(m, k), ctx);
+    Tensor rhs_val(trans_b ? TensorShape(n, k) : TensorShape(k, n), ctx);
+    Tensor weights_val(TensorShape(m, n), ctx);
+    for (int64_t i = 0; i < m * k; i++) lhs_val.GetHandle()[i] = i % 7 - 3;
+    for (int64_t i = 0; i < k * n; i++) rhs_val.GetHandle()[i] = i % 5 - 2;
+    for (int64_t i = 0; i < m * n; i++) weights_val.GetHandle()[i] = i % 3;
+    Node product = MatMulOperator(lhs, rhs, trans_a, trans_b);
+    Node loss = ReduceSumOperator(product * weights);
+    Executor exec_matmul_grad(ctx, loss, {lhs, rhs});
+    dicts = feed_dicts;
+    dicts[lhs] = lhs_val;
+    dicts[rhs] = rhs_val;
+    dicts[weights] = weights_val;
+    std::vector<Tensor> losses;
+    std::vector<Tensor> grads;
+    exec_matmul_grad.Run({loss}, losses, {lhs, rhs}, grads, dicts);
+    Node inputs[2] = {lhs, rhs};
+    for (int input = 0; input < 2; input++) {
+      Tensor& val = dicts[inputs[input]];
+      ExpectShape(grads[input], val.GetTensorShape());
+      std::vector<float> expected;
+      for (int64_t i = 0; i < val.NumElements(); i++) {
+        float& x = val.GetHandle()[i];
+        x += 1;
+        float plus = Eval(loss, dicts).GetHandle()[0];
+        x -= 2;
+        float minus = Eval(loss, dicts).GetHandle()[0];
+        x += 1;
+        expected.push_back((plus - minus) / 2);
+      }
+      ExpectValues(grads[input], expected, 1e-3);
+    }
+  }
 
-  // Test ZerosOperator 
+  // Test ZerosOperator
   std::cout << "test zeros operator" << std::endl;
   node_c = ZerosOperator(node_a);
-  Executor exec_zeros({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_zeros.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 0));
 
-  // Test OnesOperator 
+  // Test OnesOperator
   std::cout << "test ones operator" << std::endl;
   node_c = OnesOperator(node_a);
-  Executor exec_ones({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_ones.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 1));
 
-  // Test SoftmaxOperator 
+  // Test SoftmaxOperator
   std::cout << "test softmax operator" << std::endl;
   node_c = SoftmaxOperator(node_a);
-  Executor exec_softmax({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_softmax.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 0.5));
 
-  // Test SoftmaxCrossEntropyOperator 
-  //float* y_src = new float[6];
-  //float* y_src_ = new float[6];
+  // Test SoftmaxCrossEntropyOperator, the mean of -log softmax(y)[label]
   float y_src[6] = {1, 0, 0.5, 0.5, 0.9, 0.1};
   float y_src_[6] = {1, 0, 0, 1, 1, 0};
   Tensor y(TensorShape(3, 2), ctx);
@@ -134,27 +195,448 @@ int main() {
   y_.SyncFromCPU(y_src_, y_.NumElements());
   std::cout << "test softmax cross entropy operator" << std::endl;
   node_c = SoftmaxCrossEntropyOperator(node_a, node_b);
-  Executor exec_softmax_cross_entropy({node_c}, ctx);
+  dicts = feed_dicts;
   dicts[node_a] = y;
   dicts[node_b] = y_;
-  exec_softmax_cross_entropy.Run(dicts);
-  dicts[node_c].Debug();
+  float cross_entropy = (std::log(1 + std::exp(-1.0f)) + std::log(2.0f) +
+                         std::log(1 + std::exp(-0.8f))) / 3;
+  ExpectValues(Eval(node_c, dicts), {cross_entropy});
 
-  // Test ReduceSumAxisZeroOperator 
+  // Test ReduceSumAxisZeroOperator
   std::cout << "test reduce sum axis zero operator" << std::endl;
   node_c = ReduceSumAxisZeroOperator(node_a);
-  Executor exec_reduce_sum_axis_zero({node_c}, ctx);
-  dicts = feed_dicts;
-  exec_reduce_sum_axis_zero.Run(dicts);
-  dicts[node_c].Debug();
+  ExpectValues(Eval(node_c, feed_dicts), {4, 4});
 
-  // Test BroadCastToOperator 
+  // Test BroadCastToOperator
   std::cout << "test broad cast to operator" << std::endl;
   Node node_d = BroadCastToOperator(node_c, node_a);
-  Executor exec_broad_cast_to({node_d}, ctx);
+  Tensor broadcast_val = Eval(node_d, feed_dicts);
+  ExpectShape(broadcast_val, TensorShape(4, 2));
+  ExpectValues(broadcast_val, std::vector<float>(8, 4));
+
+  // Test AddOperator with broadcasting
+  std::cout << "test add operator with broadcasting" << std::endl;
+  Tensor tensor_row(TensorShape(2), ctx);
+  tensor_row.SyncFromCPU(src, tensor_row.NumElements());
+  node_c = AddOperator(node_a, node_b);
+  dicts = feed_dicts;
+  dicts[node_b] = tensor_row;
+  ExpectValues(Eval(node_c, dicts), twos);
+
+  // Test AddNOperator
+  std::cout << "test add n operator" << std::endl;
+  node_c = AddNOperator({node_a, node_b, node_a});
+  ExpectValues(Eval(node_c, feed_dicts), std::vector<float>(8, 3));
+
+  // Test ReduceSumToOperator
+  std::cout << "test reduce sum to operator" << std::endl;
+  node_c = ReduceSumToOperator(node_a, node_b);
+  dicts = feed_dicts;
+  dicts[node_b] = tensor_row;
+  ExpectValues(Eval(node_c, dicts), {4, 4});
+
+  // Test ReduceSumOperator
+  std::cout << "test reduce sum operator" << std::endl;
+  node_c = ReduceSumOperator(node_a, {1});
+  ExpectValues(Eval(node_c, feed_dicts), {2, 2, 2, 2});
+
+  // Test ReduceMaxOperator
+  std::cout << "test reduce max operator" << std::endl;
+  node_c = ReduceMaxOperator(node_a, {0}, true);
+  Tensor reduce_max_val = Eval(node_c, feed_dicts);
+  ExpectShape(reduce_max_val, TensorShape(1, 2));
+  ExpectValues(reduce_max_val, {1, 1});
+
+  // Test reduce gradients. Mean and the broadcast bias only read x for its
+  // shape, max routes the gradient to the first maximal element only, so
+  // the tied 4s of the second row share a single unit of gradient.
+  std::cout << "test reduce gradients" << std::endl;
+  Node reduce_x("reduce_x");
+  Node reduce_b("reduce_b");
+  float reduce_x_src[6] = {1, 5, 2, 4, 0, 4};
+  Tensor reduce_x_val(TensorShape(2, 3), ctx);
+  reduce_x_val.SyncFromCPU(reduce_x_src, reduce_x_val.NumElements());
+  Tensor reduce_b_val(TensorShape(3), ctx);
+  reduce_b_val.SyncFromCPU(src, reduce_b_val.NumElements());
+  Node reduce_loss = ReduceSumOperator(
+      ReduceMeanOperator(reduce_x + reduce_b, {1}) +
+      ReduceMaxOperator(reduce_x, {1}));
+  Executor exec_reduce_grad(ctx, reduce_loss, {reduce_x, reduce_b});
+  dicts = feed_dicts;
+  dicts[reduce_x] = reduce_x_val;
+  dicts[reduce_b] = reduce_b_val;
+  std::vector<Tensor> reduce_losses;
+  std::vector<Tensor> reduce_grads;
+  exec_reduce_grad.Run({reduce_loss}, reduce_losses, {reduce_x, reduce_b},
+                       reduce_grads, dicts);
+  float third = 1.0f / 3;
+  ExpectValues(reduce_losses[0], {9 + 22 * third});
+  ExpectValues(reduce_grads[0], {third, 1 + third, third,
+                                 1 + third, third, third});
+  ExpectValues(reduce_grads[1], {2 * third, 2 * third, 2 * third});
+
+  // Test ArgMaxOperator, ties go to the first index
+  std::cout << "test arg max operator" << std::endl;
+  node_c = ArgMaxOperator(node_a, 1);
+  ExpectValues(Eval(node_c, feed_dicts), {0, 0, 0, 0});
+
+  // Test identical nodes share one id
+  std::cout << "test common subexpression elimination" << std::endl;
+  Node sum_0 = ReduceSumOperator(node_a + node_b, {0});
+  Node sum_1 = ReduceSumOperator(node_a + node_b, {0});
+  Node sum_2 = ReduceSumOperator(node_a + node_b, {1});
+  Check(sum_0.id() == sum_1.id(), "identical nodes share an id");
+  Check(sum_0.id() != sum_2.id(), "different attrs give different ids");
+
+  // Test graph rewrite folds identities and constants
+  std::cout << "test graph rewrite" << std::endl;
+  GraphRewriter rewriter;
+  Node reduced_identity = ReduceSumToOperator(
+      node_a * 1 + ZerosOperator(node_a), node_a);
+  Node folded = rewriter.Rewrite((OnesOperator(node_a) + 2) * 3);
+  Node minus = rewriter.Rewrite(node_a + node_b * -1);
+  Check(rewriter.Rewrite(reduced_identity).id() == node_a.id(),
+        "identities fold away");
+  float folded_value = 0;
+  Check(GraphRewriter::IsConstant(folded, folded_value) &&
+        folded_value == 9, "constants fold");
+  Check(minus.GetOp()->GetOpType() == "Minus", "a + b * -1 is a - b");
+  ExpectValues(Eval(folded, feed_dicts), std::vector<float>(8, 9));
+
+  // Test BatchMatMulOperator, a [4, 2] rhs broadcast over a batch of one
+  std::cout << "test batch matmul operator" << std::endl;
+  Tensor tensor_batch(TensorShape(1, 2, 4), ctx);
+  tensor_batch.SyncFromCPU(src, tensor_batch.NumElements());
+  node_c = BatchMatMulOperator(node_a, node_b);
+  dicts = feed_dicts;
+  dicts[node_a] = tensor_batch;
+  Tensor batch_matmul_val = Eval(node_c, dicts);
+  ExpectShape(batch_matmul_val, TensorShape(1, 2, 2));
+  ExpectValues(batch_matmul_val, {4, 4, 4, 4});
+
+  // Test AttentionOperator, causal so the first query only sees itself
+  std::cout << "test attention operator" << std::endl;
+  Node query("query");
+  Tensor query_val(TensorShape(1, 2, 2), ctx);
+  float qkv[4] = {1, 0, 0, 1};
+  query_val.SyncFromCPU(qkv, query_val.NumElements());
+  node_c = AttentionOperator(query, query, query, true);
+  dicts = feed_dicts;
+  dicts[query] = query_val;
+  float attended = 1 / (1 + std::exp(-1 / std::sqrt(2.0f)));
+  ExpectValues(Eval(node_c, dicts), {1, 0, 1 - attended, attended});
+
+  // Test LayerNormOperator, constant rows normalize to beta
+  std::cout << "test layer norm operator" << std::endl;
+  Node gamma("gamma");
+  Node beta("beta");
+  node_c = LayerNormOperator(node_a, gamma, beta);
+  dicts = feed_dicts;
+  dicts[gamma] = tensor_row;
+  dicts[beta] = tensor_row;
+  ExpectValues(Eval(node_c, dicts), std::vector<float>(8, 1));
+
+  // Test BatchNormOperator, constant columns normalize to beta
+  std::cout << "test batch norm operator" << std::endl;
+  node_c = BatchNormOperator(node_a, gamma, beta);
+  ExpectValues(Eval(node_c, dicts), std::vector<float>(8, 1));
+
+  // Test MatMul, bias and Relu fuse into one Dense node
+  std::cout << "test dense fusion" << std::endl;
+  DenseFusion fusion;
+  Node kernel("kernel");
+  Tensor kernel_val(TensorShape(2, 2), ctx);
+  kernel_val.SyncFromCPU(src, kernel_val.NumElements());
+  Node layer = ReluOperator(MatMulOperator(node_a, kernel) + node_b);
+  Node dense = fusion.Fuse(layer);
+  std::string activation;
+  dense.GetAttr("activation", activation);
+  Check(dense.GetOp()->GetOpType() == "Dense" && activation == "relu",
+        "Dense relu fusion");
+  dicts = feed_dicts;
+  dicts[kernel] = kernel_val;
+  dicts[node_b] = tensor_row;
+  ExpectValues(Eval(layer, dicts), std::vector<float>(8, 3));
+
+  // Test ReluGradOperator masks the gradient with the packed input mask
+  std::cout << "test relu grad operator" << std::endl;
+  float signs[8] = {1, -1, 0, 2, -3, 4, 0.5, -0.5};
+  Tensor signs_val(TensorShape(4, 2), ctx);
+  signs_val.SyncFromCPU(signs, signs_val.NumElements());
+  node_c = ReluGradOperator(node_b, ReluMaskOperator(node_a));
+  dicts = feed_dicts;
+  dicts[node_a] = signs_val;
+  ExpectValues(Eval(node_c, dicts), {1, 0, 0, 1, 0, 1, 1, 0});
+
+  // Test Conv2DOperator, a 3x3 box filter over a 4x4 image of ones
+  std::cout << "test conv2d operator" << std::endl;
+  Node image("image");
+  Node filter("filter");
+  float ones[16] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+  Tensor image_val(TensorShape(1, 1, 4, 4), ctx);
+  image_val.SyncFromCPU(ones, image_val.NumElements());
+  Tensor filter_val(TensorShape(1, 1, 3, 3), ctx);
+  filter_val.SyncFromCPU(ones, filter_val.NumElements());
+  node_c = Conv2DOperator(image, filter, {1, 1}, {1, 1});
+  dicts = feed_dicts;
+  dicts[image] = image_val;
+  dicts[filter] = filter_val;
+  ExpectValues(Eval(node_c, dicts),
+               {4, 6, 6, 4, 6, 9, 9, 6, 6, 9, 9, 6, 4, 6, 6, 4});
+
+  // Test MaxPool2DOperator, 2x2 windows with stride 2 over a 4x4 image
+  std::cout << "test max pool operator" << std::endl;
+  float ramp[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+  Tensor ramp_val(TensorShape(1, 1, 4, 4), ctx);
+  ramp_val.SyncFromCPU(ramp, ramp_val.NumElements());
+  node_c = MaxPool2DOperator(image, {2, 2});
+  dicts = feed_dicts;
+  dicts[image] = ramp_val;
+  ExpectValues(Eval(node_c, dicts), {5, 7, 13, 15});
+
+  // Test EmbeddingOperator, rows 3, 0 and 3 of a [4, 2] table
+  std::cout << "test embedding operator" << std::endl;
+  Node table("table");
+  Node ids("ids");
+  Tensor table_val(TensorShape(4, 2), ctx);
+  table_val.SyncFromCPU(ramp, table_val.NumElements());
+  float id_vals[3] = {3, 0, 3};
+  Tensor ids_val(TensorShape(3), ctx);
+  ids_val.SyncFromCPU(id_vals, ids_val.NumElements());
+  node_c = EmbeddingOperator(table, ids);
+  dicts = feed_dicts;
+  dicts[table] = table_val;
+  dicts[ids] = ids_val;
+  ExpectValues(Eval(node_c, dicts), {6, 7, 0, 1, 6, 7});
+
+  // Test SparseToDenseOperator adds up the rows of a repeated id
+  std::cout << "test sparse to dense operator" << std::endl;
+  node_c = SparseToDenseOperator(
+      EmbeddingGradOperator(EmbeddingOperator(table, ids), ids, table), table);
+  ExpectValues(Eval(node_c, dicts), {0, 1, 0, 0, 0, 0, 12, 14});
+
+  // Test the embedding gradient stays sparse for the table
+  std::cout << "test sparse embedding gradient" << std::endl;
+  node_c = ReduceSumOperator(EmbeddingOperator(table, ids));
+  Executor exec_embedding(ctx, node_c, {table});
+  Check(exec_embedding.IsSparseGrad(table), "sparse table gradient");
+  std::vector<Tensor> out_vals;
+  std::vector<Tensor> grad_vals;
+  exec_embedding.Run({node_c}, out_vals, {table}, grad_vals, dicts);
+  ExpectValues(out_vals[0], {27});
+  SparseTensor sparse_grad(grad_vals[0], table_val.GetTensorShape());
+  ExpectValues(sparse_grad.ToDense(), {1, 1, 0, 0, 0, 0, 2, 2});
+
+  // Test SparseMatMulOperator, the CSR identity [4, 4] times a [4, 2] matrix
+  std::cout << "test sparse matmul operator" << std::endl;
+  Node row_ptr("row_ptr");
+  Node col_idx("col_idx");
+  Node values("values");
+  CsrTensor csr_identity({0, 1, 2, 3, 4}, {0, 1, 2, 3}, {1, 1, 1, 1}, 4);
+  node_c = SparseMatMulOperator(row_ptr, col_idx, values, table);
   dicts = feed_dicts;
-  exec_broad_cast_to.Run(dicts);
-  dicts[node_d].Debug();
+  dicts[row_ptr] = csr_identity.RowPtr();
+  dicts[col_idx] = csr_identity.ColIdx();
+  dicts[values] = csr_identity.Values();
+  dicts[table] = table_val;
+  ExpectValues(Eval(node_c, dicts), {0, 1, 2, 3, 4, 5, 6, 7});
+  ExpectValues(CsrTensor::FromDense(ramp, 4, 4).RowPtr(), {0, 3, 7, 11, 15});
+  bool too_wide = false;
+  try {
+    CsrTensor::FromDense(ramp, 1, kMaxFloatIndex + 1);
+  } catch (const std::length_error&) {
+    too_wide = true;
+  }
+  Check(too_wide, "columns past 2^24 are rejected");
+
+  // Test Int8Quantizer, the [4, 2] ramp times an identity in int8
+  std::cout << "test int8 quantizer" << std::endl;
+  Node weight("weight");
+  float eye[4] = {1, 0, 0, 1};
+  Tensor weight_val(TensorShape(2, 2), ctx);
+  weight_val.SyncFromCPU(eye, weight_val.NumElements());
+  dicts = feed_dicts;
+  dicts[table] = table_val;
+  dicts[weight] = weight_val;
+  Int8Quantizer quantizer(MatMulOperator(table, weight));
+  quantizer.Calibrate(dicts);
+  node_c = quantizer.Convert(dicts);
+  Check(node_c.GetOp()->GetOpType() == "QuantizedDense", "quantized node");
+  // Within half a step of the input scale, 7 / 127.
+  ExpectValues(Eval(node_c, dicts), {0, 1, 2, 3, 4, 5, 6, 7}, 0.03);
+
+  // Test Tensor::Cast, bf16 rounds 1 + 2^-9 to 1 where fp16 keeps it
+  std::cout << "test tensor cast" << std::endl;
+  float close_to_one[2] = {1.001953125f, -65504.0f};
+  Tensor fp32_val(TensorShape(2), ctx);
+  fp32_val.SyncFromCPU(close_to_one, fp32_val.NumElements());
+  ExpectValues(fp32_val.Cast(DataType::kBFloat16), {1, -65536}, 0);
+  ExpectValues(fp32_val.Cast(DataType::kFloat16), {1.001953125f, -65504}, 0);
+
+  // Test SetMixedPrecision, the ramp times an identity with bf16 kernels
+  std::cout << "test mixed precision" << std::endl;
+  node_c = ReluOperator(MatMulOperator(table, weight) + table);
+  Tensor mixed_val = Eval(node_c, dicts, DataType::kBFloat16);
+  Check(mixed_val.GetDataType() == DataType::kFloat32, "fp32 outputs");
+  ExpectValues(mixed_val, {0, 2, 4, 6, 8, 10, 12, 14});
+
+  // Test Checkpoint, recomputing forward values gives the same gradients
+  std::cout << "test checkpoint" << std::endl;
+  Node layer_w("layer_w");
+  float layer_src[4] = {0.5, -0.25, 0.75, 1};
+  Tensor layer_w_val(TensorShape(2, 2), ctx);
+  layer_w_val.SyncFromCPU(layer_src, layer_w_val.NumElements());
+  Node hidden = node_a;
+  for (int i = 0; i < 4; i++) {
+    Node z = MatMulOperator(hidden, layer_w);
+    hidden = z * 0.5 + z * z * 0.25;
+  }
+  node_c = ReduceSumOperator(hidden);
+  Executor exec_full(ctx, node_c, {node_a, layer_w});
+  Executor exec_checkpoint(ctx, node_c, {node_a, layer_w});
+  exec_checkpoint.Checkpoint();
+  dicts = feed_dicts;
+  dicts[layer_w] = layer_w_val;
+  std::vector<Tensor> full_vals;
+  std::vector<Tensor> full_grads;
+  std::vector<Tensor> checkpoint_vals;
+  std::vector<Tensor> checkpoint_grads;
+  exec_full.Run({node_c}, full_vals, {node_a, layer_w}, full_grads, dicts);
+  exec_checkpoint.Run({node_c}, checkpoint_vals, {node_a, layer_w},
+                      checkpoint_grads, dicts);
+  ExpectValues(checkpoint_vals[0], {full_vals[0].GetHandle()[0]});
+  for (int i = 0; i < 2; i++) {
+    Tensor& full_grad = full_grads[i];
+    ExpectValues(checkpoint_grads[i],
+                 std::vector<float>(full_grad.GetHandle(),
+                                    full_grad.GetHandle() +
+                                    full_grad.NumElements()));
+  }
+
+  // Test assigning to a view detaches it instead of writing through
+  std::cout << "test tensor view assignment" << std::endl;
+  Tensor parent(TensorShape(2), ctx);
+  parent.SyncFromCPU(src, parent.NumElements());
+  Tensor view = Tensor::View(parent);
+  Tensor other(TensorShape(2), ctx);
+  other.SyncFromVector(twos, other.NumElements());
+  view = other;
+  ExpectValues(view, {2, 2});
+  ExpectValues(parent, {1, 1});
+
+  // Test ThreadPool, back to back loops of different sizes run each task
+  // exactly once and return only after all of them finished
+  std::cout << "test thread pool" << std::endl;
+  ThreadPool pool(4);
+  for (int round = 0; round < 20000; round++) {
+    int64_t num_tasks = 2 + (round * 7919) % 61;
+    std::vector<std::atomic<int>> runs(num_tasks);
+    for (auto& run : runs) run = 0;
+    pool.ParallelFor(num_tasks, [&runs](int64_t task) { runs[task]++; });
+    for (auto& run : runs) {
+      Check(run == 1, "each task runs once in round " +
+            std::to_string(round));
+    }
+  }
+
+  // Test NUMA placement, workers are pinned to a node and the large blocks
+  // they allocate and touch are on that node
+  std::cout << "test numa placement" << std::endl;
+  std::atomic<int> placed(0);
+  std::atomic<int> misplaced(0);
+  pool.ParallelFor(64, [&](int64_t task) {
+    int node = CachingAllocator::GetThreadNumaNode();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    if (node < 0) return;
+    size_t bytes = CachingAllocator::kLargeBlock;
+    char* block = static_cast<char*>(CachingAllocator::Global()->Allocate(
+        bytes));
+    memset(block, 1, bytes);
+    int page_node = PageNumaNode(block + bytes / 2);
+    if (CurrentNumaNode() != node || (page_node >= 0 && page_node != node)) {
+      misplaced++;
+    }
+    placed++;
+    CachingAllocator::Global()->Free(block);
+  });
+  if (NumaTopology::Get().NodeId(0) >= 0) {
+    Check(placed > 0, "workers are bound to a node");
+  }
+  Check(misplaced == 0, "worker blocks are local");
+
+  // Test CachingAllocator, a freed block is reused, and the blocks another
+  // thread parked in its cache are counted and released by Trim
+  std::cout << "test caching allocator" << std::endl;
+  CachingAllocator* allocator = CachingAllocator::Global();
+  void* block = allocator->Allocate(1000);
+  allocator->Free(block);
+  Check(allocator->Allocate(1000) == block, "freed block reused");
+  allocator->Free(block);
+  allocator->Trim();
+  Check(allocator->GetStats().bytes_cached == 0, "Trim empties the cache");
+  std::mutex worker_mu;
+  std::condition_variable worker_cv;
+  bool freed = false;
+  bool trimmed = false;
+  std::thread worker([&] {
+    allocator->Free(allocator->Allocate(1000));
+    std::unique_lock<std::mutex> lock(worker_mu);
+    freed = true;
+    worker_cv.notify_all();
+    worker_cv.wait(lock, [&] { return trimmed; });
+  });
+  {
+    std::unique_lock<std::mutex> lock(worker_mu);
+    worker_cv.wait(lock, [&] { return freed; });
+  }
+  size_t class_bytes = CachingAllocator::ClassSize(
+      CachingAllocator::SizeToClass(1000));
+  Check(allocator->GetStats().bytes_cached == class_bytes,
+        "other threads' caches are counted");
+  Check(allocator->Trim() == class_bytes, "Trim drains other threads");
+  Check(allocator->GetStats().bytes_cached == 0, "Trim empties all caches");
+  {
+    std::lock_guard<std::mutex> lock(worker_mu);
+    trimmed = true;
+  }
+  worker_cv.notify_all();
+  worker.join();
+
+  // Test DropoutOperator, ones at rate 0.5 become 0 or 2, the backward
+  // pass regenerates the same mask
+  std::cout << "test dropout operator" << std::endl;
+  Node step("step");
+  float step_one = 1;
+  Tensor step_val(TensorShape(1), ctx);
+  step_val.SyncFromCPU(&step_one, step_val.NumElements());
+  Tensor ones_val(TensorShape(1024), ctx);
+  std::vector<float> ones_1024(1024, 1);
+  ones_val.SyncFromVector(ones_1024, ones_1024.size());
+  node_c = DropoutOperator(node_a, step, 0.5, 7);
+  Node loss = ReduceSumOperator(node_c);
+  Executor exec_dropout(ctx, loss, {node_a});
+  dicts = feed_dicts;
+  dicts[node_a] = ones_val;
+  dicts[step] = step_val;
+  exec_dropout.Run({node_c}, out_vals, {node_a}, grad_vals, dicts);
+  int kept = 0;
+  for (int i = 0; i < 1024; i++) {
+    float kept_val = out_vals[0].GetHandle()[i];
+    Check(kept_val == 0 || kept_val == 2, "dropout values");
+    Check(grad_vals[0].GetHandle()[i] == kept_val, "dropout mask");
+    kept += kept_val != 0;
+  }
+  Check(kept > 412 && kept < 612, "dropout rate");
+
+  // Test RandomNormalOperator, the same seed gives the same values
+  std::cout << "test random normal operator" << std::endl;
+  Tensor normal_0 = Eval(RandomNormalOperator(node_a, 0, 1, 7), feed_dicts);
+  Tensor normal_1 = Eval(RandomNormalOperator(node_a, 0, 1, 7), feed_dicts);
+  Tensor normal_2 = Eval(RandomNormalOperator(node_a, 0, 1, 8), feed_dicts);
+  ExpectValues(normal_1, std::vector<float>(normal_0.GetHandle(),
+                                            normal_0.GetHandle() + 8), 0);
+  Check(normal_0.GetHandle()[0] != normal_2.GetHandle()[0], "seeds differ");
 
+  std::cout << "all tests passed" << std::endl;
   delete[] src;
 }
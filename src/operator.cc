@@ -1,12 +1,8 @@
 #include "operator.h"
 #include "node.h"
 
-inline Operator::Operator(const std::string& name) {
-  std::unordered_map<std::string, std::shared_ptr<Op>> name_to_op;
-  if (name_to_op.find(name) == name_to_op.end()) {
-    name_to_op[name] = Op::Create(name);
-  }
-  op_ = name_to_op[name];
+inline Operator::Operator(const std::string& name) 
+    : op_(Op::Create(name)) {
 }
 
 template <typename T>
@@ -27,11 +23,7 @@ inline Operator Operator::PushInput(T val, Args... args) {
 
 template <typename T>
 inline Operator Operator::SetParam(const std::string& name, const T& val) {
-  std::stringstream ss;
-  ss << val;
-  std::string val_str;
-  ss >> val_str;
-  attrs_[name] = val_str;
+  attrs_.Set(name, AttrValue(val));
   return *this;
 }
 
@@ -54,7 +46,25 @@ inline Node Operator::CreateNode(Args... args) {
   Node node;
   node.SetOp(op_);
   node.PushInput(args...);
+  for (auto& attr : attrs_.attrs()) {
+    node.SetAttr(attr.first, attr.second);
+  }
   node.SetName();
+  node.Intern();
+  return node; 
+}
+
+inline Node Operator::CreateNode(const std::vector<Node>& inputs) {
+  Node node;
+  node.SetOp(op_);
+  for (auto& input : inputs) {
+    node.PushInput(input);
+  }
+  for (auto& attr : attrs_.attrs()) {
+    node.SetAttr(attr.first, attr.second);
+  }
+  node.SetName();
+  node.Intern();
   return node; 
 }
 
@@ -62,6 +72,10 @@ Node AddOperator(const Node& lhs, const Node& rhs) {
   return Operator("Add").CreateNode(lhs, rhs);
 }
 
+Node AddNOperator(const std::vector<Node>& nodes) {
+  return Operator("AddN").CreateNode(nodes);
+}
+
 Node AddByConstOperator(const Node& lhs, float const_val) {
   Node node = Operator("AddByConst").CreateNode(lhs);
   node.SetAttr("const_val", const_val);
@@ -106,6 +120,28 @@ Node MatMulOperator(const Node& lhs, const Node& rhs,
   return node;
 }
 
+Node BatchMatMulOperator(const Node& lhs, const Node& rhs,
+                         bool trans_a, bool trans_b) {
+  Node node = Operator("BatchMatMul").CreateNode(lhs, rhs);
+  node.SetAttr("trans_a", trans_a);
+  node.SetAttr("trans_b", trans_b);
+  return node;
+}
+
+Node DenseOperator(const Node& x, const Node& w, const Node& b,
+                   const std::string& activation) {
+  Node node = Operator("Dense").CreateNode(x, w, b);
+  node.SetAttr("activation", activation);
+  return node;
+}
+
+Node ActivationGradOperator(const Node& in_grad, const Node& out,
+                            const std::string& activation) {
+  Node grad = Operator("ActivationGrad").CreateNode(in_grad, out);
+  grad.SetAttr("activation", activation);
+  return grad;
+}
+
 Node SoftmaxOperator(const Node& lhs, const Node& rhs) {
   return Operator("Softmax").CreateNode(lhs, rhs);
 }
@@ -118,6 +154,12 @@ Node OnesOperator(const Node& node) {
   return Operator("Ones").CreateNode(node);
 }
 
+Node FillOperator(const Node& node, float value) {
+  Node fill = Operator("Fill").CreateNode(node);
+  fill.SetAttr("value", value);
+  return fill;
+}
+
 Node ReduceSumAxisZeroOperator(const Node& node) {
   return Operator("ReduceSumAxisZero").CreateNode(node);
 }
@@ -126,6 +168,59 @@ Node BroadCastToOperator(const Node& from, const Node& to) {
   return Operator("BroadCastTo").CreateNode(from, to);
 }
 
+Node ReduceSumOperator(const Node& node, const std::vector<int>& axes,
+                       bool keepdims) {
+  Node reduce = Operator("ReduceSum").CreateNode(node);
+  reduce.SetAttr("axes", axes);
+  reduce.SetAttr("keepdims", keepdims);
+  return reduce;
+}
+
+Node ReduceMeanOperator(const Node& node, const std::vector<int>& axes,
+                        bool keepdims) {
+  Node reduce = Operator("ReduceMean").CreateNode(node);
+  reduce.SetAttr("axes", axes);
+  reduce.SetAttr("keepdims", keepdims);
+  return reduce;
+}
+
+Node ReduceMaxOperator(const Node& node, const std::vector<int>& axes,
+                       bool keepdims) {
+  Node reduce = Operator("ReduceMax").CreateNode(node);
+  reduce.SetAttr("axes", axes);
+  reduce.SetAttr("keepdims", keepdims);
+  return reduce;
+}
+
+Node ArgMaxOperator(const Node& node, int axis, bool keepdims) {
+  Node arg_max = Operator("ArgMax").CreateNode(node);
+  arg_max.SetAttr("axis", axis);
+  arg_max.SetAttr("keepdims", keepdims);
+  return arg_max;
+}
+
+Node ReduceGradOperator(const Node& in_grad, const Node& node,
+                        const std::string& reduction,
+                        const std::vector<int>& axes) {
+  Node grad = Operator("ReduceGrad").CreateNode(in_grad, node);
+  grad.SetAttr("reduction", reduction);
+  grad.SetAttr("axes", axes);
+  return grad;
+}
+
+Node ReduceMaxGradOperator(const Node& in_grad, const Node& node,
+                           const Node& max_node,
+                           const std::vector<int>& axes) {
+  Node grad = Operator("ReduceGrad").CreateNode(in_grad, node, max_node);
+  grad.SetAttr("reduction", std::string("max"));
+  grad.SetAttr("axes", axes);
+  return grad;
+}
+
+Node ReduceSumToOperator(const Node& node, const Node& like) {
+  return Operator("ReduceSumTo").CreateNode(node, like);
+}
+
 Node SoftmaxOperator(const Node& node) {
   return Operator("Softmax").CreateNode(node);
 }
@@ -138,3 +233,256 @@ Node ReluOperator(const Node& node) {
   return Operator("Relu").CreateNode(node);
 }
 
+Node ReluMaskOperator(const Node& node) {
+  return Operator("ReluMask").CreateNode(node);
+}
+
+Node ReluGradOperator(const Node& in_grad, const Node& mask) {
+  return Operator("ReluGrad").CreateNode(in_grad, mask);
+}
+
+static void SetConv2DAttrs(Node& node, const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::vector<int>& dilations,
+                           const std::string& data_format) {
+  node.SetAttr("strides", strides);
+  node.SetAttr("pads", pads);
+  node.SetAttr("dilations", dilations);
+  node.SetAttr("data_format", data_format);
+}
+
+Node Conv2DOperator(const Node& x, const Node& w,
+                    const std::vector<int>& strides,
+                    const std::vector<int>& pads,
+                    const std::vector<int>& dilations,
+                    const std::string& data_format) {
+  Node conv = Operator("Conv2D").CreateNode(x, w);
+  SetConv2DAttrs(conv, strides, pads, dilations, data_format);
+  return conv;
+}
+
+Node Conv2DBackpropInputOperator(const Node& in_grad, const Node& w,
+                                 const Node& x,
+                                 const std::vector<int>& strides,
+                                 const std::vector<int>& pads,
+                                 const std::vector<int>& dilations,
+                                 const std::string& data_format) {
+  Node grad = Operator("Conv2DBackpropInput").CreateNode(in_grad, w, x);
+  SetConv2DAttrs(grad, strides, pads, dilations, data_format);
+  return grad;
+}
+
+Node Conv2DBackpropFilterOperator(const Node& x, const Node& in_grad,
+                                  const Node& w,
+                                  const std::vector<int>& strides,
+                                  const std::vector<int>& pads,
+                                  const std::vector<int>& dilations,
+                                  const std::string& data_format) {
+  Node grad = Operator("Conv2DBackpropFilter").CreateNode(x, in_grad, w);
+  SetConv2DAttrs(grad, strides, pads, dilations, data_format);
+  return grad;
+}
+
+static void SetPool2DAttrs(Node& node, const std::vector<int>& ksize,
+                           const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::string& data_format) {
+  node.SetAttr("ksize", ksize);
+  node.SetAttr("strides", strides.empty() ? ksize : strides);
+  node.SetAttr("pads", pads);
+  node.SetAttr("data_format", data_format);
+}
+
+Node MaxPool2DOperator(const Node& x, const std::vector<int>& ksize,
+                       const std::vector<int>& strides,
+                       const std::vector<int>& pads,
+                       const std::string& data_format) {
+  Node pool = Operator("MaxPool2D").CreateNode(x);
+  SetPool2DAttrs(pool, ksize, strides, pads, data_format);
+  return pool;
+}
+
+Node AvgPool2DOperator(const Node& x, const std::vector<int>& ksize,
+                       const std::vector<int>& strides,
+                       const std::vector<int>& pads,
+                       const std::string& data_format) {
+  Node pool = Operator("AvgPool2D").CreateNode(x);
+  SetPool2DAttrs(pool, ksize, strides, pads, data_format);
+  return pool;
+}
+
+Node MaxPool2DArgmaxOperator(const Node& x, const std::vector<int>& ksize,
+                             const std::vector<int>& strides,
+                             const std::vector<int>& pads,
+                             const std::string& data_format) {
+  Node argmax = Operator("MaxPool2DArgmax").CreateNode(x);
+  SetPool2DAttrs(argmax, ksize, strides, pads, data_format);
+  return argmax;
+}
+
+Node MaxPool2DGradOperator(const Node& in_grad, const Node& argmax,
+                           const Node& x, const std::vector<int>& ksize,
+                           const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::string& data_format) {
+  Node grad = Operator("MaxPool2DGrad").CreateNode(in_grad, argmax, x);
+  SetPool2DAttrs(grad, ksize, strides, pads, data_format);
+  return grad;
+}
+
+Node AvgPool2DGradOperator(const Node& in_grad, const Node& x,
+                           const std::vector<int>& ksize,
+                           const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::string& data_format) {
+  Node grad = Operator("AvgPool2DGrad").CreateNode(in_grad, x);
+  SetPool2DAttrs(grad, ksize, strides, pads, data_format);
+  return grad;
+}
+
+Node AttentionOperator(const Node& q, const Node& k, const Node& v,
+                       bool causal, float scale) {
+  Node node = Operator("Attention").CreateNode(q, k, v);
+  node.SetAttr("causal", causal);
+  node.SetAttr("scale", scale);
+  return node;
+}
+
+Node AttentionStatsOperator(const Node& in_grad, const Node& out,
+                            const Node& q, const Node& k, bool causal,
+                            float scale) {
+  Node node = Operator("AttentionStats").CreateNode(in_grad, out, q, k);
+  node.SetAttr("causal", causal);
+  node.SetAttr("scale", scale);
+  return node;
+}
+
+Node AttentionGradOperator(const Node& in_grad, const Node& q, const Node& k,
+                           const Node& v, const Node& stats,
+                           const std::string& wrt, bool causal, float scale) {
+  Node node =
+      Operator("AttentionGrad").CreateNode(in_grad, q, k, v, stats);
+  node.SetAttr("wrt", wrt);
+  node.SetAttr("causal", causal);
+  node.SetAttr("scale", scale);
+  return node;
+}
+
+Node LayerNormOperator(const Node& x, const Node& gamma, const Node& beta,
+                       float epsilon) {
+  Node node = Operator("LayerNorm").CreateNode(x, gamma, beta);
+  node.SetAttr("epsilon", epsilon);
+  return node;
+}
+
+Node LayerNormGradOperator(const Node& in_grad, const Node& x,
+                           const Node& gamma, const std::string& wrt,
+                           float epsilon) {
+  Node node = Operator("LayerNormGrad").CreateNode(in_grad, x, gamma);
+  node.SetAttr("wrt", wrt);
+  node.SetAttr("epsilon", epsilon);
+  return node;
+}
+
+Node BatchNormOperator(const Node& x, const Node& gamma, const Node& beta,
+                       float epsilon) {
+  Node node = Operator("BatchNorm").CreateNode(x, gamma, beta);
+  node.SetAttr("epsilon", epsilon);
+  return node;
+}
+
+Node BatchNormInferenceOperator(const Node& x, const Node& gamma,
+                                const Node& beta, const Node& mean,
+                                const Node& var, float epsilon) {
+  Node node = Operator("BatchNorm").CreateNode(x, gamma, beta, mean, var);
+  node.SetAttr("epsilon", epsilon);
+  return node;
+}
+
+Node BatchNormGradOperator(const std::vector<Node>& inputs,
+                           const std::string& wrt, float epsilon) {
+  Node node = Operator("BatchNormGrad").CreateNode(inputs);
+  node.SetAttr("wrt", wrt);
+  node.SetAttr("epsilon", epsilon);
+  return node;
+}
+
+Node BatchNormStatsOperator(const Node& x) {
+  return Operator("BatchNormStats").CreateNode(x);
+}
+
+Node EmbeddingOperator(const Node& table, const Node& ids) {
+  return Operator("Embedding").CreateNode(table, ids);
+}
+
+Node EmbeddingGradOperator(const Node& in_grad, const Node& ids,
+                           const Node& table) {
+  return Operator("EmbeddingGrad").CreateNode(in_grad, ids, table);
+}
+
+Node SparseConcatOperator(const std::vector<Node>& nodes) {
+  return Operator("SparseConcat").CreateNode(nodes);
+}
+
+Node SparseToDenseOperator(const Node& sparse, const Node& like) {
+  return Operator("SparseToDense").CreateNode(sparse, like);
+}
+
+Node SparseMatMulOperator(const Node& row_ptr, const Node& col_idx,
+                          const Node& values, const Node& w) {
+  return Operator("SparseMatMul").CreateNode(row_ptr, col_idx, values, w);
+}
+
+Node SparseMatMulGradOperator(const Node& in_grad, const Node& row_ptr,
+                              const Node& col_idx, const Node& values,
+                              const Node& w, const std::string& wrt) {
+  Node node = Operator("SparseMatMulGrad").CreateNode(in_grad, row_ptr,
+                                                      col_idx, values, w);
+  node.SetAttr("wrt", wrt);
+  return node;
+}
+
+Node QuantizedDenseOperator(const std::vector<Node>& inputs, int64_t units,
+                            float input_scale,
+                            const std::string& activation) {
+  Node node = Operator("QuantizedDense").CreateNode(inputs);
+  node.SetAttr("units", units);
+  node.SetAttr("input_scale", input_scale);
+  node.SetAttr("activation", activation);
+  return node;
+}
+
+Node RandomUniformOperator(const Node& like, float low, float high,
+                           int64_t seed) {
+  Node node = Operator("RandomUniform").CreateNode(like);
+  node.SetAttr("low", low);
+  node.SetAttr("high", high);
+  node.SetAttr("seed", seed);
+  return node;
+}
+
+Node RandomNormalOperator(const Node& like, float mean, float stddev,
+                          int64_t seed) {
+  Node node = Operator("RandomNormal").CreateNode(like);
+  node.SetAttr("mean", mean);
+  node.SetAttr("stddev", stddev);
+  node.SetAttr("seed", seed);
+  return node;
+}
+
+Node TruncatedNormalOperator(const Node& like, float mean, float stddev,
+                             int64_t seed) {
+  Node node = Operator("TruncatedNormal").CreateNode(like);
+  node.SetAttr("mean", mean);
+  node.SetAttr("stddev", stddev);
+  node.SetAttr("seed", seed);
+  return node;
+}
+
+Node DropoutOperator(const Node& x, const Node& step, float rate,
+                     int64_t seed) {
+  Node node = Operator("Dropout").CreateNode(x, step);
+  node.SetAttr("rate", rate);
+  node.SetAttr("seed", seed);
+  return node;
+}
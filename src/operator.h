@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include "attr_value.h"
 
 class Op;
 class Node;
@@ -25,14 +26,19 @@ public:
   template <typename... Args>
   Node CreateNode(Args... args);
 
+  Node CreateNode(const std::vector<Node>& inputs);
+
 private:
   std::vector<Node> inputs_;
-  std::unordered_map<std::string, std::string> attrs_;
-  std::shared_ptr<Op> op_;
+  AttrMap attrs_;
+  Op* op_;
 };
 
 Node AddOperator(const Node& lhs, const Node& rhs);
 
+// Sum of nodes that all have the same shape.
+Node AddNOperator(const std::vector<Node>& nodes);
+
 Node AddByConstOperator(const Node& lhs, float const_val);
 
 Node MinusOperator(const Node& lhs, const Node& rhs);
@@ -50,20 +56,197 @@ Node DevideByConstOperator(const Node& lhs, float const_val);
 Node MatMulOperator(const Node& lhs, const Node& rhs, 
                     bool trans_a = false, bool trans_b = false);
 
+// [batch, m, k] x [batch, k, n], a rank 2 or batch 1 side is broadcast.
+Node BatchMatMulOperator(const Node& lhs, const Node& rhs,
+                         bool trans_a = false, bool trans_b = false);
+
+// activation(x * w + b) as a single op, activation is "none" or "relu".
+Node DenseOperator(const Node& x, const Node& w, const Node& b,
+                   const std::string& activation = "none");
+
+Node ActivationGradOperator(const Node& in_grad, const Node& out,
+                            const std::string& activation);
+
 Node SoftmaxOperator(const Node& lhs, const Node& rhs);
 
 Node ZerosOperator(const Node& node);
 
 Node OnesOperator(const Node& node);
 
+// A tensor shaped like node with every element set to value.
+Node FillOperator(const Node& node, float value);
+
 Node ReduceSumAxisZeroOperator(const Node& node);
 
 Node BroadCastToOperator(const Node& from, const Node& to);
 
+// Reductions over axes, an empty axes list reduces over every axis.
+Node ReduceSumOperator(const Node& node,
+                       const std::vector<int>& axes = {},
+                       bool keepdims = false);
+
+Node ReduceMeanOperator(const Node& node,
+                        const std::vector<int>& axes = {},
+                        bool keepdims = false);
+
+Node ReduceMaxOperator(const Node& node,
+                       const std::vector<int>& axes = {},
+                       bool keepdims = false);
+
+Node ArgMaxOperator(const Node& node, int axis, bool keepdims = false);
+
+Node ReduceGradOperator(const Node& in_grad, const Node& node,
+                        const std::string& reduction,
+                        const std::vector<int>& axes);
+
+Node ReduceMaxGradOperator(const Node& in_grad, const Node& node,
+                           const Node& max_node,
+                           const std::vector<int>& axes);
+
+// Sums node over the dims it was broadcast along so it matches like's shape.
+Node ReduceSumToOperator(const Node& node, const Node& like);
+
 Node SoftmaxOperator(const Node& node);
 
 Node SoftmaxCrossEntropyOperator(const Node& lhs, const Node& rhs);
 
 Node ReluOperator(const Node& node);
 
+// Bit mask of node > 0, and in_grad masked by it.
+Node ReluMaskOperator(const Node& node);
+
+Node ReluGradOperator(const Node& in_grad, const Node& mask);
+
+// 2-D convolution, x is NCHW with an OIHW filter or NHWC with an HWIO filter.
+// strides, pads and dilations are {h, w}, pads are applied on both sides.
+Node Conv2DOperator(const Node& x, const Node& w,
+                    const std::vector<int>& strides = {1, 1},
+                    const std::vector<int>& pads = {0, 0},
+                    const std::vector<int>& dilations = {1, 1},
+                    const std::string& data_format = "NCHW");
+
+Node Conv2DBackpropInputOperator(const Node& in_grad, const Node& w,
+                                 const Node& x,
+                                 const std::vector<int>& strides,
+                                 const std::vector<int>& pads,
+                                 const std::vector<int>& dilations,
+                                 const std::string& data_format);
+
+Node Conv2DBackpropFilterOperator(const Node& x, const Node& in_grad,
+                                  const Node& w,
+                                  const std::vector<int>& strides,
+                                  const std::vector<int>& pads,
+                                  const std::vector<int>& dilations,
+                                  const std::string& data_format);
+
+// 2-D pooling, ksize, strides and pads are {h, w}. Empty strides default to
+// ksize.
+Node MaxPool2DOperator(const Node& x, const std::vector<int>& ksize,
+                       const std::vector<int>& strides = {},
+                       const std::vector<int>& pads = {0, 0},
+                       const std::string& data_format = "NCHW");
+
+Node AvgPool2DOperator(const Node& x, const std::vector<int>& ksize,
+                       const std::vector<int>& strides = {},
+                       const std::vector<int>& pads = {0, 0},
+                       const std::string& data_format = "NCHW");
+
+Node MaxPool2DArgmaxOperator(const Node& x, const std::vector<int>& ksize,
+                             const std::vector<int>& strides,
+                             const std::vector<int>& pads,
+                             const std::string& data_format);
+
+Node MaxPool2DGradOperator(const Node& in_grad, const Node& argmax,
+                           const Node& x, const std::vector<int>& ksize,
+                           const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::string& data_format);
+
+Node AvgPool2DGradOperator(const Node& in_grad, const Node& x,
+                           const std::vector<int>& ksize,
+                           const std::vector<int>& strides,
+                           const std::vector<int>& pads,
+                           const std::string& data_format);
+
+// softmax(scale * q * k^T) * v over [batch, len, dim] inputs, fused. A
+// scale of 0 means 1 / sqrt(dim). With causal set query i only sees keys
+// j <= i + kv_len - q_len.
+Node AttentionOperator(const Node& q, const Node& k, const Node& v,
+                       bool causal = false, float scale = 0);
+
+Node AttentionStatsOperator(const Node& in_grad, const Node& out,
+                            const Node& q, const Node& k, bool causal,
+                            float scale);
+
+Node AttentionGradOperator(const Node& in_grad, const Node& q, const Node& k,
+                           const Node& v, const Node& stats,
+                           const std::string& wrt, bool causal, float scale);
+
+// Normalizes each row of x [rows, cols], gamma and beta are [cols].
+Node LayerNormOperator(const Node& x, const Node& gamma, const Node& beta,
+                       float epsilon = 1e-5);
+
+Node LayerNormGradOperator(const Node& in_grad, const Node& x,
+                           const Node& gamma, const std::string& wrt,
+                           float epsilon);
+
+// Normalizes each column of x [rows, cols] with the batch statistics, for
+// training.
+Node BatchNormOperator(const Node& x, const Node& gamma, const Node& beta,
+                       float epsilon = 1e-5);
+
+// Normalizes each column of x with running statistics, for inference.
+Node BatchNormInferenceOperator(const Node& x, const Node& gamma,
+                                const Node& beta, const Node& mean,
+                                const Node& var, float epsilon = 1e-5);
+
+// inputs are (in_grad, x, gamma), followed by (mean, var) for inference.
+Node BatchNormGradOperator(const std::vector<Node>& inputs,
+                           const std::string& wrt, float epsilon);
+
+// The batch mean and variance of each column of x, [2, cols].
+Node BatchNormStatsOperator(const Node& x);
+
+// Rows ids of table [rows, dim], ids holds row indices as floats, so table
+// can have at most kMaxFloatIndex (2^24) rows.
+Node EmbeddingOperator(const Node& table, const Node& ids);
+
+Node EmbeddingGradOperator(const Node& in_grad, const Node& ids,
+                           const Node& table);
+
+Node SparseConcatOperator(const std::vector<Node>& nodes);
+
+Node SparseToDenseOperator(const Node& sparse, const Node& like);
+
+// x * w for x [rows, cols] in CSR form, row_ptr [rows + 1], col_idx and
+// values [nnz], and w [cols, n].
+Node SparseMatMulOperator(const Node& row_ptr, const Node& col_idx,
+                          const Node& values, const Node& w);
+
+Node SparseMatMulGradOperator(const Node& in_grad, const Node& row_ptr,
+                              const Node& col_idx, const Node& values,
+                              const Node& w, const std::string& wrt);
+
+// inputs are (x, packed) or (x, packed, bias), packed holds the int8
+// weights of units output channels.
+Node QuantizedDenseOperator(const std::vector<Node>& inputs, int64_t units,
+                            float input_scale,
+                            const std::string& activation = "none");
+
+// Random tensors shaped like like, the same for a given seed, see random.h.
+Node RandomUniformOperator(const Node& like, float low, float high,
+                           int64_t seed);
+
+Node RandomNormalOperator(const Node& like, float mean, float stddev,
+                          int64_t seed);
+
+// Normal with values beyond two stddev from the mean redrawn.
+Node TruncatedNormalOperator(const Node& like, float mean, float stddev,
+                             int64_t seed);
+
+// Inverted dropout of x, step is a scalar that changes the mask every
+// training step.
+Node DropoutOperator(const Node& x, const Node& step, float rate,
+                     int64_t seed);
+
 #endif
@@ -0,0 +1,171 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "simd.h"
+#include "thread_pool.h"
+
+// 2-D pooling kernels. They work on images of [h, w, channels]: NHWC data is
+// batch images of all channels, NCHW data is batch * channels images of one
+// channel, so NHWC runs every window step as one SIMD pass over the channels.
+// Images are independent and processed in parallel.
+//
+// Max pooling keeps, for each output element, the offset of the maximum
+// within its window, kh * kernel_w + kw. It fits in a uint8 for windows of up
+// to 256 elements and a uint16 otherwise, so the backward pass scatters the
+// gradient without reading the input again.
+
+struct Pool2DParams {
+  int64_t images, channels;
+  int64_t in_h, in_w;
+  int64_t out_h, out_w;
+  int64_t kernel_h, kernel_w;
+  int64_t stride_h, stride_w;
+  int64_t pad_h, pad_w;
+
+  int64_t InSize() const { return in_h * in_w * channels; }
+
+  int64_t OutSize() const { return out_h * out_w * channels; }
+
+  // Bytes of one argmax offset.
+  int IndexBytes() const { return kernel_h * kernel_w <= 256 ? 1 : 2; }
+
+  // Valid window rows [h0, h1) and cols [w0, w1) of output pixel (oh, ow).
+  void Window(int64_t oh, int64_t ow, int64_t& h0, int64_t& h1,
+              int64_t& w0, int64_t& w1) const {
+    h0 = oh * stride_h - pad_h;
+    w0 = ow * stride_w - pad_w;
+    h1 = std::min(h0 + kernel_h, in_h);
+    w1 = std::min(w0 + kernel_w, in_w);
+    h0 = std::max<int64_t>(h0, 0);
+    w0 = std::max<int64_t>(w0, 0);
+  }
+};
+
+// y[i] += alpha * x[i]
+inline void ScaledAccumulate(float* y, float alpha, const float* x,
+                             int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += alpha * x[i];
+  }
+}
+
+template <typename Index>
+void MaxPool2DImage(const float* x, const Pool2DParams& p, float* y,
+                    Index* argmax) {
+  const int64_t c = p.channels;
+  std::vector<float> best(c);
+  std::vector<Index> best_k(c);
+  for (int64_t oh = 0; oh < p.out_h; oh++) {
+    for (int64_t ow = 0; ow < p.out_w; ow++) {
+      int64_t h0, h1, w0, w1;
+      p.Window(oh, ow, h0, h1, w0, w1);
+      std::fill(best.begin(), best.end(),
+                -std::numeric_limits<float>::infinity());
+      std::fill(best_k.begin(), best_k.end(), 0);
+      for (int64_t h = h0; h < h1; h++) {
+        for (int64_t w = w0; w < w1; w++) {
+          const float* src = x + (h * p.in_w + w) * c;
+          if (argmax == nullptr) {
+            SimdMaxAccumulate(best.data(), src, c);
+            continue;
+          }
+          Index k = (h - oh * p.stride_h + p.pad_h) * p.kernel_w +
+                    (w - ow * p.stride_w + p.pad_w);
+          for (int64_t i = 0; i < c; i++) {
+            bool greater = src[i] > best[i];
+            best[i] = greater ? src[i] : best[i];
+            best_k[i] = greater ? k : best_k[i];
+          }
+        }
+      }
+      int64_t out = (oh * p.out_w + ow) * c;
+      if (y != nullptr) memcpy(y + out, best.data(), c * sizeof(float));
+      if (argmax != nullptr) {
+        std::copy(best_k.begin(), best_k.end(), argmax + out);
+      }
+    }
+  }
+}
+
+// Either output may be null. The first maximum of a window wins on ties.
+template <typename Index>
+void MaxPool2D(const float* x, const Pool2DParams& p, float* y,
+               Index* argmax) {
+  ThreadPool::Global()->ParallelFor(p.images, [&](int64_t n) {
+    int64_t out = n * p.OutSize();
+    MaxPool2DImage(x + n * p.InSize(), p, y == nullptr ? y : y + out,
+                   argmax == nullptr ? argmax : argmax + out);
+  });
+}
+
+// Adds every output gradient to the input element its argmax points at.
+template <typename Index>
+void MaxPool2DGrad(const float* dy, const Index* argmax,
+                   const Pool2DParams& p, float* dx) {
+  ThreadPool::Global()->ParallelFor(p.images, [&](int64_t n) {
+    float* dst = dx + n * p.InSize();
+    memset(dst, 0, p.InSize() * sizeof(float));
+    for (int64_t oh = 0; oh < p.out_h; oh++) {
+      for (int64_t ow = 0; ow < p.out_w; ow++) {
+        int64_t out = n * p.OutSize() + (oh * p.out_w + ow) * p.channels;
+        for (int64_t i = 0; i < p.channels; i++) {
+          int64_t k = argmax[out + i];
+          int64_t h = oh * p.stride_h - p.pad_h + k / p.kernel_w;
+          int64_t w = ow * p.stride_w - p.pad_w + k % p.kernel_w;
+          dst[(h * p.in_w + w) * p.channels + i] += dy[out + i];
+        }
+      }
+    }
+  });
+}
+
+// Averages over the valid part of each window, padding is not counted.
+inline void AvgPool2D(const float* x, const Pool2DParams& p, float* y) {
+  const int64_t c = p.channels;
+  ThreadPool::Global()->ParallelFor(p.images, [&](int64_t n) {
+    const float* src = x + n * p.InSize();
+    for (int64_t oh = 0; oh < p.out_h; oh++) {
+      for (int64_t ow = 0; ow < p.out_w; ow++) {
+        int64_t h0, h1, w0, w1;
+        p.Window(oh, ow, h0, h1, w0, w1);
+        float* dst = y + n * p.OutSize() + (oh * p.out_w + ow) * c;
+        std::fill(dst, dst + c, 0.0f);
+        for (int64_t h = h0; h < h1; h++) {
+          for (int64_t w = w0; w < w1; w++) {
+            SimdAccumulate(dst, src + (h * p.in_w + w) * c, c);
+          }
+        }
+        SimdScale(dst, 1.0f / std::max<int64_t>(1, (h1 - h0) * (w1 - w0)), c);
+      }
+    }
+  });
+}
+
+inline void AvgPool2DGrad(const float* dy, const Pool2DParams& p,
+                          float* dx) {
+  const int64_t c = p.channels;
+  ThreadPool::Global()->ParallelFor(p.images, [&](int64_t n) {
+    float* dst = dx + n * p.InSize();
+    memset(dst, 0, p.InSize() * sizeof(float));
+    for (int64_t oh = 0; oh < p.out_h; oh++) {
+      for (int64_t ow = 0; ow < p.out_w; ow++) {
+        int64_t h0, h1, w0, w1;
+        p.Window(oh, ow, h0, h1, w0, w1);
+        const float* grad = dy + n * p.OutSize() + (oh * p.out_w + ow) * c;
+        float scale = 1.0f / std::max<int64_t>(1, (h1 - h0) * (w1 - w0));
+        for (int64_t h = h0; h < h1; h++) {
+          for (int64_t w = w0; w < w1; w++) {
+            ScaledAccumulate(dst + (h * p.in_w + w) * c, scale, grad, c);
+          }
+        }
+      }
+    }
+  });
+}
+
+#endif  // POOL_H_
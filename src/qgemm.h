@@ -0,0 +1,252 @@
+#ifndef QGEMM_H_
+#define QGEMM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "simd.h"
+#include "thread_pool.h"
+
+// Int8 GEMM with int32 accumulation for quantized inference.
+//
+// Activations are quantized per tensor and symmetric, q = round(x / scale)
+// clamped to [-127, 127], and stored as the byte q + 128. Weights are
+// quantized per output channel and packed once into panels of kQgemmNr
+// channels. For every group of 4 rows of w a panel holds each channel's 4
+// weights next to each other, the layout VNNI's dpbusd multiplies against 4
+// broadcast activation bytes. After the groups come the channels' scales and
+// 128 * sum_k w[k][j], which removes the activation offset again.
+//
+// A packed [k, n] weight is QgemmPanels(n) x (QgemmGroups(k) + 2) x
+// kQgemmNr floats, a quarter of the fp32 size. Integer sums are exact, so
+// results do not depend on the instruction set or the number of threads.
+
+const int kQgemmMr = 4;
+const int kQgemmNr = 16;
+const int64_t kQgemmMc = 64;
+
+inline int64_t QgemmGroups(int64_t k) { return (k + 3) / 4; }
+
+inline int64_t QgemmPanels(int64_t n) {
+  return (n + kQgemmNr - 1) / kQgemmNr;
+}
+
+inline int64_t QgemmPanelSize(int64_t k) {
+  return (QgemmGroups(k) + 2) * kQgemmNr;
+}
+
+// Quantizes w [k, n] per column into packed, see above. Channels past n and
+// rows past k are zero.
+inline void PackInt8Weights(const float* w, int64_t k, int64_t n,
+                            float* packed) {
+  const int64_t groups = QgemmGroups(k);
+  memset(packed, 0, QgemmPanels(n) * QgemmPanelSize(k) * sizeof(float));
+  for (int64_t j = 0; j < n; j++) {
+    float max_abs = 0;
+    for (int64_t p = 0; p < k; p++) {
+      max_abs = std::max(max_abs, std::fabs(w[p * n + j]));
+    }
+    const float scale = max_abs > 0 ? max_abs / 127 : 1;
+    float* panel = packed + (j / kQgemmNr) * QgemmPanelSize(k);
+    const int64_t lane = j % kQgemmNr;
+    int8_t* quads = reinterpret_cast<int8_t*>(panel);
+    int32_t sum = 0;
+    for (int64_t p = 0; p < k; p++) {
+      float q = std::nearbyint(w[p * n + j] / scale);
+      int8_t val = static_cast<int8_t>(std::max(-127.0f, std::min(127.0f, q)));
+      quads[((p / 4) * kQgemmNr + lane) * 4 + p % 4] = val;
+      sum += val;
+    }
+    panel[groups * kQgemmNr + lane] = scale;
+    int32_t offset = 128 * sum;
+    memcpy(panel + (groups + 1) * kQgemmNr + lane, &offset, sizeof(offset));
+  }
+}
+
+// xq [m, 4 * QgemmGroups(k)] = round(x / scale) + 128, rows padded with the
+// zero point 128.
+inline void QuantizeActivations(const float* x, int64_t m, int64_t k,
+                                float scale, uint8_t* xq) {
+  const int64_t ldq = 4 * QgemmGroups(k);
+  const float inv = 1 / scale;
+  ThreadPool::Global()->ParallelForRange(
+      m, std::max<int64_t>(1, (1 << 15) / std::max<int64_t>(k, 1)),
+      [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      const float* src = x + i * k;
+      uint8_t* dst = xq + i * ldq;
+      int64_t p = 0;
+#if defined(__AVX2__)
+      const __m256 v_inv = _mm256_set1_ps(inv);
+      const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+      const __m256i lo = _mm256_set1_epi8(-127);
+      const __m256i offset = _mm256_set1_epi8(-128);
+      for (; p + 32 <= k; p += 32) {
+        __m256i q0 = _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_loadu_ps(src + p), v_inv));
+        __m256i q1 = _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_loadu_ps(src + p + 8), v_inv));
+        __m256i q2 = _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_loadu_ps(src + p + 16), v_inv));
+        __m256i q3 = _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_loadu_ps(src + p + 24), v_inv));
+        // Saturating packs clamp to [-128, 127] but interleave the 128 bit
+        // lanes, the permute restores the order.
+        __m256i q = _mm256_packs_epi16(_mm256_packs_epi32(q0, q1),
+                                       _mm256_packs_epi32(q2, q3));
+        q = _mm256_permutevar8x32_epi32(_mm256_max_epi8(q, lo), order);
+        // Adding 128 to a signed byte flips its top bit.
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + p),
+                            _mm256_xor_si256(q, offset));
+      }
+#endif
+      for (; p < k; p++) {
+        float q = std::nearbyint(src[p] * inv);
+        dst[p] = static_cast<uint8_t>(
+            std::max(-127.0f, std::min(127.0f, q)) + 128);
+      }
+      memset(dst + k, 128, ldq - k);
+    }
+  });
+}
+
+// acc [rows, kQgemmNr] = the int32 products of rows of xq (row stride ldq)
+// with one weight panel.
+inline void QgemmMicroKernel(int64_t groups, const uint8_t* a, int64_t ldq,
+                             int rows, const float* panel, int32_t* acc) {
+  const int32_t* w = reinterpret_cast<const int32_t*>(panel);
+#if defined(__AVXVNNI__) || \
+    (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+  __m256i c[kQgemmMr][2];
+  for (int r = 0; r < kQgemmMr; r++) {
+    c[r][0] = _mm256_setzero_si256();
+    c[r][1] = _mm256_setzero_si256();
+  }
+  for (int64_t g = 0; g < groups; g++) {
+    __m256i b0 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(w + g * kQgemmNr));
+    __m256i b1 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(w + g * kQgemmNr + 8));
+    for (int r = 0; r < kQgemmMr; r++) {
+      int32_t quad;
+      memcpy(&quad, a + r * ldq + g * 4, sizeof(quad));
+      __m256i a_r = _mm256_set1_epi32(quad);
+#if defined(__AVXVNNI__)
+      c[r][0] = _mm256_dpbusd_avx_epi32(c[r][0], a_r, b0);
+      c[r][1] = _mm256_dpbusd_avx_epi32(c[r][1], a_r, b1);
+#else
+      c[r][0] = _mm256_dpbusd_epi32(c[r][0], a_r, b0);
+      c[r][1] = _mm256_dpbusd_epi32(c[r][1], a_r, b1);
+#endif
+    }
+  }
+  for (int r = 0; r < rows; r++) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + r * kQgemmNr),
+                        c[r][0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + r * kQgemmNr + 8),
+                        c[r][1]);
+  }
+#elif defined(__AVX2__)
+  // Without VNNI, maddubs multiplies |a| by w with a's sign, where a = q is
+  // the activation without its offset. Both are at most 127, so its pair
+  // sums cannot saturate, and madd against ones adds the pairs into the
+  // same lanes dpbusd fills. The offset is added back at the end.
+  const __m256i flip = _mm256_set1_epi8(-128);
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i c[kQgemmMr][2];
+  for (int r = 0; r < kQgemmMr; r++) {
+    c[r][0] = _mm256_setzero_si256();
+    c[r][1] = _mm256_setzero_si256();
+  }
+  for (int64_t g = 0; g < groups; g++) {
+    __m256i b0 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(w + g * kQgemmNr));
+    __m256i b1 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(w + g * kQgemmNr + 8));
+    for (int r = 0; r < kQgemmMr; r++) {
+      int32_t quad;
+      memcpy(&quad, a + r * ldq + g * 4, sizeof(quad));
+      __m256i a_r = _mm256_xor_si256(_mm256_set1_epi32(quad), flip);
+      __m256i a_abs = _mm256_abs_epi8(a_r);
+      c[r][0] = _mm256_add_epi32(c[r][0], _mm256_madd_epi16(
+          _mm256_maddubs_epi16(a_abs, _mm256_sign_epi8(b0, a_r)), ones));
+      c[r][1] = _mm256_add_epi32(c[r][1], _mm256_madd_epi16(
+          _mm256_maddubs_epi16(a_abs, _mm256_sign_epi8(b1, a_r)), ones));
+    }
+  }
+  const __m256i* offsets =
+      reinterpret_cast<const __m256i*>(w + (groups + 1) * kQgemmNr);
+  __m256i offset0 = _mm256_loadu_si256(offsets);
+  __m256i offset1 = _mm256_loadu_si256(offsets + 1);
+  for (int r = 0; r < rows; r++) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + r * kQgemmNr),
+                        _mm256_add_epi32(c[r][0], offset0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + r * kQgemmNr + 8),
+                        _mm256_add_epi32(c[r][1], offset1));
+  }
+#else
+  const int8_t* b = reinterpret_cast<const int8_t*>(w);
+  for (int r = 0; r < rows; r++) {
+    for (int j = 0; j < kQgemmNr; j++) {
+      int32_t sum = 0;
+      for (int64_t g = 0; g < groups; g++) {
+        for (int t = 0; t < 4; t++) {
+          sum += a[r * ldq + g * 4 + t] * b[(g * kQgemmNr + j) * 4 + t];
+        }
+      }
+      acc[r * kQgemmNr + j] = sum;
+    }
+  }
+#endif
+}
+
+// c [m, n] = xq * w dequantized with x_scale and the weights' channel
+// scales, where xq comes from QuantizeActivations and w from
+// PackInt8Weights. epilogue(row, col, c, len) is called for every finished
+// row segment, as in Gemm.
+template <typename Epilogue>
+void Int8Gemm(int64_t m, int64_t n, int64_t k, const uint8_t* xq,
+              float x_scale, const float* packed, float* c,
+              const Epilogue& epilogue) {
+  const int64_t groups = QgemmGroups(k);
+  const int64_t ldq = 4 * groups;
+  const int64_t panels = QgemmPanels(n);
+  const int64_t m_blocks = (m + kQgemmMc - 1) / kQgemmMc;
+
+  ThreadPool::Global()->ParallelFor(m_blocks * panels, [&](int64_t task) {
+    const int64_t i0 = (task / panels) * kQgemmMc;
+    const int64_t j0 = (task % panels) * kQgemmNr;
+    const int64_t mc = std::min(kQgemmMc, m - i0);
+    const int cols = static_cast<int>(std::min<int64_t>(kQgemmNr, n - j0));
+    const float* panel = packed + (task % panels) * QgemmPanelSize(k);
+    const float* scales = panel + groups * kQgemmNr;
+    const int32_t* offsets =
+        reinterpret_cast<const int32_t*>(panel + (groups + 1) * kQgemmNr);
+
+    int32_t acc[kQgemmMr * kQgemmNr];
+    // The last row tile may run past m, it reads a copy padded with the
+    // zero point instead.
+    std::vector<uint8_t> tail;
+    for (int64_t ir = 0; ir < mc; ir += kQgemmMr) {
+      const int rows = static_cast<int>(std::min<int64_t>(kQgemmMr, mc - ir));
+      const uint8_t* a = xq + (i0 + ir) * ldq;
+      if (rows < kQgemmMr) {
+        tail.assign(kQgemmMr * ldq, 128);
+        memcpy(tail.data(), a, rows * ldq);
+        a = tail.data();
+      }
+      QgemmMicroKernel(groups, a, ldq, rows, panel, acc);
+      for (int r = 0; r < rows; r++) {
+        float* dst = c + (i0 + ir + r) * n + j0;
+        for (int j = 0; j < cols; j++) {
+          dst[j] = (acc[r * kQgemmNr + j] - offsets[j]) * (x_scale * scales[j]);
+        }
+        epilogue(i0 + ir + r, j0, dst, cols);
+      }
+    }
+  });
+}
+
+#endif  // QGEMM_H_
@@ -0,0 +1,138 @@
+#ifndef QUANTIZE_H_
+#define QUANTIZE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+#include "executor.h"
+#include "graph_rewrite.h"
+#include "node.h"
+#include "operator.h"
+#include "qgemm.h"
+
+// Post-training int8 quantization of a trained forward graph:
+//
+//   Int8Quantizer quantizer(logits);
+//   for (auto& batch : samples) quantizer.Calibrate(batch);
+//   Node quantized = quantizer.Convert(feed_dicts);
+//
+// The layers are the Dense nodes DenseFusion forms and the remaining
+// untransposed MatMuls, whenever their weight is a variable. Calibration
+// records the largest |x| reaching each layer, which becomes its activation
+// scale. Convert swaps the calibrated layers for QuantizedDense nodes, whose
+// weights it packs from feed and adds to it as new variables.
+class Int8Quantizer {
+public:
+  explicit Int8Quantizer(const Node& root) {
+    root_ = fusion_.Fuse(root);
+    FindLayers();
+  }
+
+  // Runs the forward graph on one sample batch.
+  void Calibrate(std::unordered_map<Node, Tensor>& feed) {
+    std::vector<Node> inputs;
+    for (auto& layer : layers_) {
+      inputs.push_back(LayerInputs(layer)[0]);
+    }
+    Executor exec(Context::cpu(), root_, {});
+    std::vector<Tensor> vals;
+    std::vector<Tensor> grads;
+    exec.Run(inputs, vals, {}, grads, feed);
+    for (size_t i = 0; i < layers_.size(); i++) {
+      const float* x = vals[i].GetHandle();
+      float& range = ranges_[layers_[i]];
+      for (int64_t j = 0; j < vals[i].NumElements(); j++) {
+        range = std::max(range, std::fabs(x[j]));
+      }
+    }
+  }
+
+  // The forward graph with its calibrated layers quantized. feed must hold
+  // the trained weights, the packed ones are added under new variables.
+  Node Convert(std::unordered_map<Node, Tensor>& feed) {
+    std::unordered_map<Node, Node> converted;
+    return ConvertNode(root_, feed, converted);
+  }
+
+private:
+  static std::string OpType(const Node& node) {
+    return node.GetOp() == nullptr ? "" : node.GetOp()->GetOpType();
+  }
+
+  static std::vector<Node> LayerInputs(const Node& node) {
+    std::vector<Node> inputs;
+    node.GetInputNodes(inputs);
+    return inputs;
+  }
+
+  void FindLayers() {
+    std::unordered_set<Node> visited = {root_};
+    std::vector<Node> stack = {root_};
+    while (!stack.empty()) {
+      Node node = stack.back();
+      stack.pop_back();
+      std::vector<Node> inputs = LayerInputs(node);
+      if (IsLayer(node)) layers_.push_back(node);
+      for (auto& input : inputs) {
+        if (visited.insert(input).second) stack.push_back(input);
+      }
+    }
+  }
+
+  static bool IsLayer(const Node& node) {
+    std::string op_type = OpType(node);
+    if (op_type == "MatMul") {
+      bool trans_a = false, trans_b = false;
+      node.GetAttr("trans_a", trans_a);
+      node.GetAttr("trans_b", trans_b);
+      if (trans_a || trans_b) return false;
+    } else if (op_type != "Dense") {
+      return false;
+    }
+    return LayerInputs(node)[1].IsVariable();
+  }
+
+  Node ConvertNode(const Node& node, std::unordered_map<Node, Tensor>& feed,
+                   std::unordered_map<Node, Node>& converted) {
+    auto iter = converted.find(node);
+    if (iter != converted.end()) return iter->second;
+    if (node.IsVariable()) return node;
+
+    std::vector<Node> inputs = LayerInputs(node);
+    bool changed = false;
+    for (auto& input : inputs) {
+      Node new_input = ConvertNode(input, feed, converted);
+      changed = changed || new_input.id() != input.id();
+      input = new_input;
+    }
+
+    Node result = changed ? node.WithInputs(inputs) : node;
+    auto range = ranges_.find(node);
+    if (range != ranges_.end()) {
+      const Tensor& w = feed.at(inputs[1]);
+      const int64_t k = w.GetTensorShape().DimSize(0);
+      const int64_t n = w.GetTensorShape().DimSize(1);
+      Tensor packed_val(
+          TensorShape(QgemmPanels(n), QgemmGroups(k) + 2, kQgemmNr));
+      PackInt8Weights(w.GetHandle(), k, n, packed_val.GetHandle());
+      Node packed(inputs[1].name() + "_int8");
+      feed[packed] = packed_val;
+
+      inputs[1] = packed;
+      std::string activation = "none";
+      node.GetAttr("activation", activation);
+      float scale = range->second > 0 ? range->second / 127 : 1;
+      result = QuantizedDenseOperator(inputs, n, scale, activation);
+    }
+    converted[node] = result;
+    return result;
+  }
+
+  DenseFusion fusion_;
+  Node root_;
+  std::vector<Node> layers_;
+  std::unordered_map<Node, float> ranges_;
+};
+
+#endif  // QUANTIZE_H_
@@ -0,0 +1,265 @@
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "simd.h"
+#include "thread_pool.h"
+
+// Counter-based random numbers from Philox4x32-10 (Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3"). Each draw is a pure function of
+// (seed, stream, index) and carries no state to the next. So any range of a
+// tensor can be generated by any thread, and results do not depend on the
+// number of threads. stream separates independent draws under one seed,
+// such as the masks of successive dropout steps.
+//
+// Elements come in groups of kRandomGroup, taken from 8 Philox blocks that
+// are computed side by side. Element j of group g is word j / 8 of block
+// 8 * g + j % 8, so each word of the 8 blocks fills 8 consecutive elements.
+// The AVX2 path and the scalar fallback produce the same words. The floats
+// made from them may differ in the last bits, as log, sin and cos do.
+
+const uint32_t kPhiloxM0 = 0xD2511F53;
+const uint32_t kPhiloxM1 = 0xCD9E8D57;
+const uint32_t kPhiloxW0 = 0x9E3779B9;
+const uint32_t kPhiloxW1 = 0xBB67AE85;
+const int kPhiloxRounds = 10;
+
+const int kRandomGroup = 32;
+
+// Groups per task.
+const int64_t kRandomGrain = 512;
+
+// The four words of counter (block, stream, attempt) under key seed.
+// attempt numbers the redraws of truncated normals and is 0 otherwise.
+inline void Philox4x32(uint64_t seed, uint64_t block, uint32_t stream,
+                       uint32_t attempt, uint32_t out[4]) {
+  uint32_t c0 = static_cast<uint32_t>(block);
+  uint32_t c1 = static_cast<uint32_t>(block >> 32);
+  uint32_t c2 = stream;
+  uint32_t c3 = attempt;
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+  for (int r = 0; r < kPhiloxRounds; r++) {
+    uint64_t p0 = static_cast<uint64_t>(kPhiloxM0) * c0;
+    uint64_t p1 = static_cast<uint64_t>(kPhiloxM1) * c2;
+    c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+    c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+    c1 = static_cast<uint32_t>(p1);
+    c3 = static_cast<uint32_t>(p0);
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+#if defined(__AVX2__)
+// Low words of a * m for 8 lanes of 32 bits, the high words go to hi.
+inline __m256i MulHiLo32(__m256i a, __m256i m, __m256i* hi) {
+  __m256i even = _mm256_mul_epu32(a, m);
+  __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+  *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+  return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+}
+#endif
+
+// The kRandomGroup words of group, laid out as described above.
+inline void PhiloxGroup(uint64_t seed, uint32_t stream, uint32_t attempt,
+                        int64_t group, uint32_t* words) {
+  const uint64_t block = static_cast<uint64_t>(group) * 8;
+#if defined(__AVX2__)
+  // block is a multiple of 8, adding the lane never carries.
+  __m256i c0 = _mm256_add_epi32(
+      _mm256_set1_epi32(static_cast<int32_t>(block)),
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  __m256i c1 = _mm256_set1_epi32(static_cast<int32_t>(block >> 32));
+  __m256i c2 = _mm256_set1_epi32(static_cast<int32_t>(stream));
+  __m256i c3 = _mm256_set1_epi32(static_cast<int32_t>(attempt));
+  const __m256i m0 = _mm256_set1_epi32(static_cast<int32_t>(kPhiloxM0));
+  const __m256i m1 = _mm256_set1_epi32(static_cast<int32_t>(kPhiloxM1));
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+  for (int r = 0; r < kPhiloxRounds; r++) {
+    __m256i hi0, hi1;
+    __m256i lo0 = MulHiLo32(c0, m0, &hi0);
+    __m256i lo1 = MulHiLo32(c2, m1, &hi1);
+    c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1),
+                          _mm256_set1_epi32(static_cast<int32_t>(k0)));
+    c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3),
+                          _mm256_set1_epi32(static_cast<int32_t>(k1)));
+    c1 = lo1;
+    c3 = lo0;
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  __m256i* dst = reinterpret_cast<__m256i*>(words);
+  _mm256_storeu_si256(dst, c0);
+  _mm256_storeu_si256(dst + 1, c1);
+  _mm256_storeu_si256(dst + 2, c2);
+  _mm256_storeu_si256(dst + 3, c3);
+#else
+  for (int lane = 0; lane < 8; lane++) {
+    uint32_t out[4];
+    Philox4x32(seed, block + lane, stream, attempt, out);
+    for (int w = 0; w < 4; w++) {
+      words[w * 8 + lane] = out[w];
+    }
+  }
+#endif
+}
+
+// Calls fn(group, len) for every group of [0, n), in parallel. len is the
+// number of elements of the group below n.
+template <typename Fn>
+inline void ForEachRandomGroup(int64_t n, Fn fn) {
+  const int64_t groups = (n + kRandomGroup - 1) / kRandomGroup;
+  ThreadPool::Global()->ParallelForRange(groups, kRandomGrain,
+                                         [&](int64_t begin, int64_t end) {
+    for (int64_t group = begin; group < end; group++) {
+      fn(group, std::min<int64_t>(kRandomGroup, n - group * kRandomGroup));
+    }
+  });
+}
+
+// The top 24 bits of word as a float in [0, 1).
+inline float WordToUniform(uint32_t word) {
+  return (word >> 8) * (1.0f / 16777216.0f);
+}
+
+// Box-Muller on pairs of words: word w and w + 1 of a block, w even, give
+// the two standard normals of those positions.
+inline void NormalGroup(const uint32_t* words, float* out) {
+  const float kTwoPi = 6.28318530718f;
+  int h = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  const __m256 scale = _mm256_set1_ps(1.0f / 16777216.0f);
+  for (; h < kRandomGroup; h += 16) {
+    __m256i a = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(words + h));
+    __m256i b = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(words + h + 8));
+    // u in (0, 1], so its log is finite.
+    __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(
+        _mm256_srli_epi32(a, 8), _mm256_set1_epi32(1))), scale);
+    __m256 theta = _mm256_mul_ps(
+        _mm256_fmsub_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(b, 8)), scale,
+                        _mm256_set1_ps(0.5f)),
+        _mm256_set1_ps(kTwoPi));
+    __m256 r = _mm256_sqrt_ps(
+        _mm256_mul_ps(LogPs(u), _mm256_set1_ps(-2.0f)));
+    __m256 sin_theta, cos_theta;
+    SinCosPs(theta, &sin_theta, &cos_theta);
+    _mm256_storeu_ps(out + h, _mm256_mul_ps(r, cos_theta));
+    _mm256_storeu_ps(out + h + 8, _mm256_mul_ps(r, sin_theta));
+  }
+#endif
+  for (; h < kRandomGroup; h += 16) {
+    for (int j = 0; j < 8; j++) {
+      float u = ((words[h + j] >> 8) + 1) * (1.0f / 16777216.0f);
+      float theta = (WordToUniform(words[h + j + 8]) - 0.5f) * kTwoPi;
+      float r = std::sqrt(-2.0f * std::log(u));
+      out[h + j] = r * std::cos(theta);
+      out[h + j + 8] = r * std::sin(theta);
+    }
+  }
+}
+
+// out[i] uniform in [low, high).
+inline void PhiloxUniform(uint64_t seed, uint32_t stream, float low,
+                          float high, int64_t n, float* out) {
+  ForEachRandomGroup(n, [=](int64_t group, int64_t len) {
+    uint32_t words[kRandomGroup];
+    PhiloxGroup(seed, stream, 0, group, words);
+    float* dst = out + group * kRandomGroup;
+    for (int64_t j = 0; j < len; j++) {
+      dst[j] = low + (high - low) * WordToUniform(words[j]);
+    }
+  });
+}
+
+// out[i] normal with mean and stddev.
+inline void PhiloxNormal(uint64_t seed, uint32_t stream, float mean,
+                         float stddev, int64_t n, float* out) {
+  ForEachRandomGroup(n, [=](int64_t group, int64_t len) {
+    uint32_t words[kRandomGroup];
+    float normals[kRandomGroup];
+    PhiloxGroup(seed, stream, 0, group, words);
+    NormalGroup(words, normals);
+    float* dst = out + group * kRandomGroup;
+    for (int64_t j = 0; j < len; j++) {
+      dst[j] = mean + stddev * normals[j];
+    }
+  });
+}
+
+// out[i] normal with mean and stddev, redrawn while more than two stddev
+// from the mean. Redraw k of element i is element i of the group drawn with
+// attempt k, so redraws take the vector path as well. About 1 in 22
+// elements needs one.
+inline void PhiloxTruncatedNormal(uint64_t seed, uint32_t stream, float mean,
+                                  float stddev, int64_t n, float* out) {
+  ForEachRandomGroup(n, [=](int64_t group, int64_t len) {
+    uint32_t words[kRandomGroup];
+    float normals[kRandomGroup];
+    float redraws[kRandomGroup];
+    PhiloxGroup(seed, stream, 0, group, words);
+    NormalGroup(words, normals);
+    for (uint32_t attempt = 1; ; attempt++) {
+      bool done = true;
+      for (int64_t j = 0; j < len; j++) {
+        done = done && std::fabs(normals[j]) <= 2.0f;
+      }
+      if (done) break;
+      PhiloxGroup(seed, stream, attempt, group, words);
+      NormalGroup(words, redraws);
+      for (int64_t j = 0; j < len; j++) {
+        if (std::fabs(normals[j]) > 2.0f) normals[j] = redraws[j];
+      }
+    }
+    float* dst = out + group * kRandomGroup;
+    for (int64_t j = 0; j < len; j++) {
+      dst[j] = mean + stddev * normals[j];
+    }
+  });
+}
+
+// y[i] = x[i] / (1 - rate) where the mask keeps element i, else 0. Element
+// i is kept when its 24 bit uniform is at least rate, so the same (seed,
+// stream) gives the same mask for the gradient without storing it. y may
+// alias x.
+inline void PhiloxDropout(uint64_t seed, uint32_t stream, float rate,
+                          const float* x, int64_t n, float* y) {
+  const uint32_t threshold =
+      static_cast<uint32_t>(std::ceil(rate * 16777216.0f));
+  const float scale = rate < 1.0f ? 1.0f / (1.0f - rate) : 0.0f;
+  ForEachRandomGroup(n, [=](int64_t group, int64_t len) {
+    uint32_t words[kRandomGroup];
+    PhiloxGroup(seed, stream, 0, group, words);
+    const float* src = x + group * kRandomGroup;
+    float* dst = y + group * kRandomGroup;
+    int64_t j = 0;
+#if defined(__AVX2__)
+    // Masked without branches, which would miss on half of a random mask.
+    // The 24 bit uniforms compare correctly as signed.
+    const __m256i limit = _mm256_set1_epi32(static_cast<int32_t>(threshold));
+    const __m256 keep_scale = _mm256_set1_ps(scale);
+    for (; j + 8 <= len; j += 8) {
+      __m256i u = _mm256_srli_epi32(_mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(words + j)), 8);
+      __m256i drop = _mm256_cmpgt_epi32(limit, u);
+      __m256 factor = _mm256_andnot_ps(_mm256_castsi256_ps(drop), keep_scale);
+      _mm256_storeu_ps(dst + j, _mm256_mul_ps(_mm256_loadu_ps(src + j),
+                                              factor));
+    }
+#endif
+    for (; j < len; j++) {
+      dst[j] = src[j] * ((words[j] >> 8) >= threshold ? scale : 0.0f);
+    }
+  });
+}
+
+#endif  // RANDOM_H_
@@ -0,0 +1,248 @@
+#ifndef REDUCE_H_
+#define REDUCE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "simd.h"
+#include "tensor_shape.h"
+#include "thread_pool.h"
+
+enum class ReduceKind {
+  kSum,
+  kMax
+};
+
+// Elements handled by one task. Work is split by this size only, so the
+// partial results, and the order they are combined in, are the same for any
+// number of threads.
+const int64_t kReduceGrain = 1 << 14;
+
+// Returns a mask with one entry per dim, an empty axes list reduces every
+// dim and negative axes count from the back.
+inline std::vector<bool> ParseReduceAxes(const std::vector<int>& axes,
+                                         int num_dims) {
+  std::vector<bool> reduced(num_dims, axes.empty());
+  for (int axis : axes) {
+    if (axis < 0) axis += num_dims;
+    assert(axis >= 0 && axis < num_dims);
+    reduced[axis] = true;
+  }
+  return reduced;
+}
+
+inline TensorShape ReducedShape(const TensorShape& shape,
+                                const std::vector<bool>& reduced,
+                                bool keepdims) {
+  TensorShape out_shape;
+  for (int i = 0; i < shape.NumDims(); i++) {
+    if (!reduced[i]) {
+      out_shape.AppendDim(shape.DimSize(i));
+    } else if (keepdims) {
+      out_shape.AppendDim(1);
+    }
+  }
+  // A full reduction yields one element, like SoftmaxCrossEntropy's output.
+  if (out_shape.NumDims() == 0) {
+    out_shape = TensorShape(1);
+  }
+  return out_shape;
+}
+
+inline void InitReduce(float* out, int64_t n, ReduceKind kind) {
+  float init = kind == ReduceKind::kSum ?
+      0.0f : -std::numeric_limits<float>::infinity();
+  std::fill(out, out + n, init);
+}
+
+inline void AccumulateRow(float* out, const float* in, int64_t n,
+                          ReduceKind kind) {
+  if (kind == ReduceKind::kSum) {
+    SimdAccumulate(out, in, n);
+  } else {
+    SimdMaxAccumulate(out, in, n);
+  }
+}
+
+inline float ReduceRow(const float* in, int64_t n, ReduceKind kind) {
+  return kind == ReduceKind::kSum ? SimdSum(in, n) : SimdMax(in, n);
+}
+
+inline float Combine(float a, float b, ReduceKind kind) {
+  return kind == ReduceKind::kSum ? a + b : std::max(a, b);
+}
+
+// Reduces the middle dim of an [outer, r, inner] array into [outer, inner].
+//
+// inner == 1 is a row-wise reduction, each output is one contiguous SIMD
+// reduction. Otherwise rows of length inner are accumulated column-wise into
+// the output, which streams the input once. Long reductions are cut into
+// chunks of rows that produce partial results, combined in chunk order.
+inline void ReduceMiddle(const float* in, int64_t outer, int64_t r,
+                         int64_t inner, ReduceKind kind, float* out) {
+  ThreadPool* pool = ThreadPool::Global();
+
+  if (inner == 1) {
+    int64_t num_chunks = (r + kReduceGrain - 1) / kReduceGrain;
+    if (num_chunks <= 1) {
+      int64_t rows_per_task = std::max<int64_t>(1, kReduceGrain / r);
+      pool->ParallelForRange(outer, rows_per_task,
+                             [&](int64_t begin, int64_t end) {
+        for (int64_t o = begin; o < end; o++) {
+          out[o] = ReduceRow(in + o * r, r, kind);
+        }
+      });
+      return;
+    }
+
+    std::vector<float> partials(outer * num_chunks);
+    pool->ParallelFor(outer * num_chunks, [&](int64_t task) {
+      int64_t o = task / num_chunks;
+      int64_t begin = (task % num_chunks) * kReduceGrain;
+      int64_t end = std::min(r, begin + kReduceGrain);
+      partials[task] = ReduceRow(in + o * r + begin, end - begin, kind);
+    });
+    for (int64_t o = 0; o < outer; o++) {
+      float val = partials[o * num_chunks];
+      for (int64_t c = 1; c < num_chunks; c++) {
+        val = Combine(val, partials[o * num_chunks + c], kind);
+      }
+      out[o] = val;
+    }
+    return;
+  }
+
+  int64_t rows_per_chunk = std::max<int64_t>(1, kReduceGrain / inner);
+  int64_t num_chunks = (r + rows_per_chunk - 1) / rows_per_chunk;
+  if (num_chunks <= 1) {
+    pool->ParallelFor(outer, [&](int64_t o) {
+      float* dst = out + o * inner;
+      const float* src = in + o * r * inner;
+      memcpy(dst, src, inner * sizeof(float));
+      for (int64_t i = 1; i < r; i++) {
+        AccumulateRow(dst, src + i * inner, inner, kind);
+      }
+    });
+    return;
+  }
+
+  std::vector<float> partials(outer * num_chunks * inner);
+  pool->ParallelFor(outer * num_chunks, [&](int64_t task) {
+    int64_t o = task / num_chunks;
+    int64_t begin = (task % num_chunks) * rows_per_chunk;
+    int64_t end = std::min(r, begin + rows_per_chunk);
+    float* dst = partials.data() + task * inner;
+    const float* src = in + (o * r + begin) * inner;
+    memcpy(dst, src, inner * sizeof(float));
+    for (int64_t i = 1; i < end - begin; i++) {
+      AccumulateRow(dst, src + i * inner, inner, kind);
+    }
+  });
+  pool->ParallelForRange(outer * inner, kReduceGrain,
+                         [&](int64_t begin, int64_t end) {
+    for (int64_t idx = begin; idx < end; idx++) {
+      int64_t o = idx / inner;
+      int64_t j = idx % inner;
+      const float* part = partials.data() + o * num_chunks * inner + j;
+      float val = part[0];
+      for (int64_t c = 1; c < num_chunks; c++) {
+        val = Combine(val, part[c * inner], kind);
+      }
+      out[idx] = val;
+    }
+  });
+}
+
+// Reduces in over the dims marked in reduced. Adjacent dims with the same
+// mark are merged first, then the reduced groups are folded innermost first,
+// each fold being one ReduceMiddle pass.
+inline void ReduceAxes(const float* in, const TensorShape& shape,
+                       const std::vector<bool>& reduced, ReduceKind kind,
+                       float* out) {
+  std::vector<int64_t> sizes;
+  std::vector<bool> marks;
+  for (int i = 0; i < shape.NumDims(); i++) {
+    if (shape.DimSize(i) == 1) continue;
+    if (!marks.empty() && marks.back() == reduced[i]) {
+      sizes.back() *= shape.DimSize(i);
+    } else {
+      sizes.push_back(shape.DimSize(i));
+      marks.push_back(reduced[i]);
+    }
+  }
+
+  int64_t num_elements = shape.NumElements();
+  const float* src = in;
+  std::vector<float> buffers[2];
+  int which = 0;
+  while (true) {
+    int g = -1;
+    int num_reduced = 0;
+    for (int i = 0; i < (int)marks.size(); i++) {
+      if (marks[i]) {
+        g = i;
+        num_reduced++;
+      }
+    }
+    if (g < 0) {
+      if (src != out) memcpy(out, src, num_elements * sizeof(float));
+      return;
+    }
+
+    int64_t outer = 1, inner = 1;
+    for (int i = 0; i < g; i++) outer *= sizes[i];
+    for (int i = g + 1; i < (int)sizes.size(); i++) inner *= sizes[i];
+
+    float* dst = out;
+    if (num_reduced > 1) {
+      buffers[which].resize(outer * inner);
+      dst = buffers[which].data();
+      which ^= 1;
+    }
+    ReduceMiddle(src, outer, sizes[g], inner, kind, dst);
+    if (dst == out) return;
+
+    src = dst;
+    num_elements = outer * inner;
+    sizes.erase(sizes.begin() + g);
+    marks.erase(marks.begin() + g);
+  }
+}
+
+// Index of the maximum along one axis, the first one wins on ties.
+inline void ArgMaxAxis(const float* in, const TensorShape& shape, int axis,
+                       float* out) {
+  int64_t outer = 1, inner = 1;
+  for (int i = 0; i < axis; i++) outer *= shape.DimSize(i);
+  for (int i = axis + 1; i < shape.NumDims(); i++) inner *= shape.DimSize(i);
+  int64_t r = shape.DimSize(axis);
+
+  ThreadPool::Global()->ParallelFor(outer, [&](int64_t o) {
+    const float* src = in + o * r * inner;
+    float* dst = out + o * inner;
+    if (inner == 1) {
+      int64_t best = 0;
+      for (int64_t i = 1; i < r; i++) {
+        if (src[i] > src[best]) best = i;
+      }
+      dst[0] = best;
+      return;
+    }
+    std::vector<float> best_val(src, src + inner);
+    std::fill(dst, dst + inner, 0.0f);
+    for (int64_t i = 1; i < r; i++) {
+      const float* row = src + i * inner;
+      for (int64_t j = 0; j < inner; j++) {
+        if (row[j] > best_val[j]) {
+          best_val[j] = row[j];
+          dst[j] = i;
+        }
+      }
+    }
+  });
+}
+
+#endif  // REDUCE_H_
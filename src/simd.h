@@ -0,0 +1,318 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Vectorized building blocks for the CPU kernels, with an AVX2 path and a
+// scalar fallback. Accumulation order is fixed for a given n, so results do
+// not depend on alignment or on which thread runs the kernel.
+
+#if defined(__AVX2__)
+inline float HorizontalSum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+  return _mm_cvtss_f32(lo);
+}
+
+inline float HorizontalMax(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_max_ps(lo, hi);
+  lo = _mm_max_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_max_ss(lo, _mm_movehdup_ps(lo));
+  return _mm_cvtss_f32(lo);
+}
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+// exp(x) as 2^n * exp(r) with r = x - n * ln(2) in [-ln(2) / 2, ln(2) / 2]
+// and exp(r) from the Cephes polynomial, to a relative error of about 1e-7.
+// x is clamped to [-87, 88], so large negative inputs give about 1e-38
+// rather than 0.
+inline __m256 ExpPs(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)),
+                    _mm256_set1_ps(88.0f));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), r);
+  y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+  __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(e, 23)));
+}
+
+// log(x) for positive normal x as e * ln(2) + log(m) with m in
+// [sqrt(0.5), sqrt(2)), from the Cephes polynomial to about 1e-7 relative.
+inline __m256 LogPs(__m256 x) {
+  __m256i bits = _mm256_castps_si256(x);
+  __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+      _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+  // m in [0.5, 1), then moved to [sqrt(0.5), sqrt(2)) - 1.
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+      _mm256_set1_epi32(0x3f000000)));
+  __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781f), _CMP_LT_OQ);
+  e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+  m = _mm256_add_ps(_mm256_sub_ps(m, _mm256_set1_ps(1.0f)),
+                    _mm256_and_ps(small, m));
+  __m256 z = _mm256_mul_ps(m, m);
+  __m256 y = _mm256_set1_ps(7.0376836292e-2f);
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.1514610310e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.1676998740e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.2420140846e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.4249322787e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.6668057665e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(2.0000714765e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-2.4999993993e-1f));
+  y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(3.3333331174e-1f));
+  y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+  y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+  y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+  return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f),
+                         _mm256_add_ps(m, y));
+}
+
+// sin(x) and cos(x) for x in [-pi, pi], reduced to [-pi / 4, pi / 4] around
+// the nearest multiple of pi / 2 and taken from the Cephes polynomials.
+inline void SinCosPs(__m256 x, __m256* sin_x, __m256* cos_x) {
+  __m256 j = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(0.636619772f)),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(j, _mm256_set1_ps(1.5703125f), x);
+  r = _mm256_fnmadd_ps(j, _mm256_set1_ps(4.837512969970703125e-4f), r);
+  r = _mm256_fnmadd_ps(j, _mm256_set1_ps(7.54978995489188216e-8f), r);
+  __m256 z = _mm256_mul_ps(r, r);
+
+  __m256 s = _mm256_set1_ps(-1.9515295891e-4f);
+  s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(8.3321608736e-3f));
+  s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+  s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), r, r);
+  __m256 c = _mm256_set1_ps(2.443315711809948e-5f);
+  c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(-1.388731625493765e-3f));
+  c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+  c = _mm256_mul_ps(_mm256_mul_ps(c, z), z);
+  c = _mm256_add_ps(_mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), c),
+                    _mm256_set1_ps(1.0f));
+
+  // Quadrant q = j mod 4: sin is s, c, -s, -c and cos is c, -s, -c, s.
+  __m256i q = _mm256_cvtps_epi32(j);
+  __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+      _mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+  __m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(
+      _mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+  __m256 cos_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(
+      _mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+  *sin_x = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sin_sign);
+  *cos_x = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cos_sign);
+}
+#endif
+
+// Sum of x[0, n), accumulated in four independent lanes of 8.
+inline float SimdSum(const float* x, int64_t n) {
+  int64_t i = 0;
+  float sum = 0.0;
+#if defined(__AVX2__)
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  __m256 acc2 = _mm256_setzero_ps();
+  __m256 acc3 = _mm256_setzero_ps();
+  for (; i + 32 <= n; i += 32) {
+    acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(x + i));
+    acc1 = _mm256_add_ps(acc1, _mm256_loadu_ps(x + i + 8));
+    acc2 = _mm256_add_ps(acc2, _mm256_loadu_ps(x + i + 16));
+    acc3 = _mm256_add_ps(acc3, _mm256_loadu_ps(x + i + 24));
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(x + i));
+  }
+  acc0 = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+  sum = HorizontalSum(acc0);
+#endif
+  for (; i < n; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+inline float SimdMax(const float* x, int64_t n) {
+  int64_t i = 0;
+  float max_val = -std::numeric_limits<float>::infinity();
+#if defined(__AVX2__)
+  if (n >= 8) {
+    __m256 acc0 = _mm256_loadu_ps(x);
+    __m256 acc1 = acc0;
+    for (i = 8; i + 16 <= n; i += 16) {
+      acc0 = _mm256_max_ps(acc0, _mm256_loadu_ps(x + i));
+      acc1 = _mm256_max_ps(acc1, _mm256_loadu_ps(x + i + 8));
+    }
+    for (; i + 8 <= n; i += 8) {
+      acc0 = _mm256_max_ps(acc0, _mm256_loadu_ps(x + i));
+    }
+    max_val = HorizontalMax(_mm256_max_ps(acc0, acc1));
+  }
+#endif
+  for (; i < n; i++) {
+    max_val = std::max(max_val, x[i]);
+  }
+  return max_val;
+}
+
+// y[i] += x[i]
+inline void SimdAccumulate(float* y, const float* x, int64_t n) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i,
+                     _mm256_add_ps(_mm256_loadu_ps(y + i),
+                                   _mm256_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+// y[i] = max(y[i], x[i])
+inline void SimdMaxAccumulate(float* y, const float* x, int64_t n) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i,
+                     _mm256_max_ps(_mm256_loadu_ps(y + i),
+                                   _mm256_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] = std::max(y[i], x[i]);
+  }
+}
+
+// y[i] *= alpha
+inline void SimdScale(float* y, float alpha, int64_t n) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  __m256 a = _mm256_set1_ps(alpha);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(_mm256_loadu_ps(y + i), a));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] *= alpha;
+  }
+}
+
+// y[i] = exp(x[i] - shift), returning the sum of y. y may alias x.
+inline float SimdExp(const float* x, float shift, int64_t n, float* y) {
+  int64_t i = 0;
+  float sum = 0.0;
+#if defined(__AVX2__) && defined(__FMA__)
+  const __m256 s = _mm256_set1_ps(shift);
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    __m256 e = ExpPs(_mm256_sub_ps(_mm256_loadu_ps(x + i), s));
+    _mm256_storeu_ps(y + i, e);
+    acc = _mm256_add_ps(acc, e);
+  }
+  sum = HorizontalSum(acc);
+#endif
+  for (; i < n; i++) {
+    y[i] = std::exp(x[i] - shift);
+    sum += y[i];
+  }
+  return sum;
+}
+
+// y[i] += alpha * x[i]
+inline void SimdAxpy(float* y, float alpha, const float* x, int64_t n) {
+  int64_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 a = _mm256_set1_ps(alpha);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] += alpha * x[i];
+  }
+}
+
+// Sum of x[i] * y[i]
+inline float SimdDot(const float* x, const float* y, int64_t n) {
+  int64_t i = 0;
+  float sum = 0.0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+                          acc);
+  }
+  sum = HorizontalSum(acc);
+#endif
+  for (; i < n; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// bits[i / 32] bit i % 32 is set when x[i] > 0, the mask Relu's gradient
+// needs in 1/32 of the memory of its input. Bits past n in the last word are
+// zero.
+inline void SimdPositiveMask(const float* x, int64_t n, uint32_t* bits) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  const __m256 zero = _mm256_setzero_ps();
+  for (; i + 32 <= n; i += 32) {
+    uint32_t word = 0;
+    for (int j = 0; j < 4; j++) {
+      __m256 positive = _mm256_cmp_ps(_mm256_loadu_ps(x + i + j * 8), zero,
+                                      _CMP_GT_OQ);
+      word |= static_cast<uint32_t>(_mm256_movemask_ps(positive)) << (j * 8);
+    }
+    bits[i / 32] = word;
+  }
+#endif
+  for (; i < n; i += 32) {
+    uint32_t word = 0;
+    for (int64_t j = 0; j < 32 && i + j < n; j++) {
+      word |= static_cast<uint32_t>(x[i + j] > 0) << j;
+    }
+    bits[i / 32] = word;
+  }
+}
+
+// y[i] = x[i] where bit i of bits is set, else 0. y may alias x.
+inline void SimdApplyMask(const float* x, const uint32_t* bits, int64_t n,
+                          float* y) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  for (; i + 8 <= n; i += 8) {
+    int byte = (bits[i / 32] >> (i % 32)) & 0xff;
+    __m256i set = _mm256_and_si256(_mm256_set1_epi32(byte), lanes);
+    __m256 keep = _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes));
+    _mm256_storeu_ps(y + i, _mm256_and_ps(keep, _mm256_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] = (bits[i / 32] >> (i % 32)) & 1 ? x[i] : 0.0f;
+  }
+}
+
+#endif  // SIMD_H_
@@ -0,0 +1,243 @@
+#ifndef SPARSE_TENSOR_H_
+#define SPARSE_TENSOR_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "tensor.h"
+#include "thread_pool.h"
+
+// Row-sparse tensors, the gradients of embedding tables: only the rows of a
+// [rows, row_size] tensor that a step touched, each with its index. A row
+// index may appear more than once, its entries add up.
+//
+// Inside the graph a sparse value is a plain [n, 1 + row_size] tensor whose
+// column 0 holds the row index, so it flows through the executor like any
+// other value. Indices are stored as floats and are exact up to
+// kMaxFloatIndex (2^24), the Embedding ops reject larger tables.
+
+// Packed row i, its index followed by row_size values.
+inline int64_t SparseRowIndex(const float* packed, int64_t row_size,
+                              int64_t i) {
+  return static_cast<int64_t>(packed[i * (1 + row_size)]);
+}
+
+// Gathers rows ids[i] of table [rows, row_size] into out [n, row_size].
+inline void GatherRows(const float* table, int64_t rows, int64_t row_size,
+                       const float* ids, int64_t n, float* out) {
+  ThreadPool::Global()->ParallelForRange(
+      n, std::max<int64_t>(1, (1 << 14) / std::max<int64_t>(row_size, 1)),
+      [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      int64_t row = static_cast<int64_t>(ids[i]);
+      assert(row >= 0 && row < rows);
+      memcpy(out + i * row_size, table + row * row_size,
+             row_size * sizeof(float));
+    }
+  });
+}
+
+// Packs rows[i] [n, row_size] with index ids[i] into packed
+// [n, 1 + row_size].
+inline void PackSparseRows(const float* rows, const float* ids, int64_t n,
+                           int64_t row_size, float* packed) {
+  for (int64_t i = 0; i < n; i++) {
+    float* dst = packed + i * (1 + row_size);
+    dst[0] = ids[i];
+    memcpy(dst + 1, rows + i * row_size, row_size * sizeof(float));
+  }
+}
+
+// dense [rows, row_size] += the n packed rows. Rows are added in order, so
+// repeated indices sum deterministically.
+inline void ScatterAddSparseRows(const float* packed, int64_t n,
+                                 int64_t row_size, float* dense) {
+  for (int64_t i = 0; i < n; i++) {
+    const float* src = packed + i * (1 + row_size) + 1;
+    float* dst = dense + SparseRowIndex(packed, row_size, i) * row_size;
+    for (int64_t j = 0; j < row_size; j++) {
+      dst[j] += src[j];
+    }
+  }
+}
+
+class SparseTensor {
+public:
+  // packed is a sparse value as the executor returns it, dense_shape the
+  // shape of the tensor it is a gradient of.
+  SparseTensor(const Tensor& packed, const TensorShape& dense_shape)
+      : packed_(packed), dense_shape_(dense_shape) {
+    assert(packed.GetTensorShape().NumDims() == 2);
+    assert(packed.GetTensorShape().DimSize(1) == 1 + RowSize());
+  }
+
+  const TensorShape& DenseShape() const { return dense_shape_; }
+
+  int64_t NumRows() const { return packed_.GetTensorShape().DimSize(0); }
+
+  int64_t RowSize() const {
+    return dense_shape_.NumElements() / dense_shape_.DimSize(0);
+  }
+
+  int64_t Index(int64_t i) const {
+    return SparseRowIndex(packed_.GetHandle(), RowSize(), i);
+  }
+
+  const float* Row(int64_t i) const {
+    return packed_.GetHandle() + i * (1 + RowSize()) + 1;
+  }
+
+  // Each index once, in increasing order, with its entries summed.
+  SparseTensor Coalesce() const {
+    const int64_t row_size = RowSize();
+    std::vector<int64_t> order(NumRows());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](int64_t a, int64_t b) {
+      return Index(a) < Index(b);
+    });
+    int64_t unique = 0;
+    for (int64_t i = 0; i < NumRows(); i++) {
+      if (i == 0 || Index(order[i]) != Index(order[i - 1])) unique++;
+    }
+
+    Tensor packed(TensorShape(unique, 1 + row_size));
+    float* dst = packed.GetHandle() - (1 + row_size);
+    for (int64_t i = 0; i < NumRows(); i++) {
+      const float* src = Row(order[i]);
+      if (i == 0 || Index(order[i]) != Index(order[i - 1])) {
+        dst += 1 + row_size;
+        dst[0] = static_cast<float>(Index(order[i]));
+        memcpy(dst + 1, src, row_size * sizeof(float));
+      } else {
+        for (int64_t j = 0; j < row_size; j++) {
+          dst[1 + j] += src[j];
+        }
+      }
+    }
+    return SparseTensor(packed, dense_shape_);
+  }
+
+  Tensor ToDense() const {
+    Tensor dense(dense_shape_);
+    memset(dense.GetHandle(), 0, dense.NumElements() * sizeof(float));
+    ScatterAddSparseRows(packed_.GetHandle(), NumRows(), RowSize(),
+                         dense.GetHandle());
+    return dense;
+  }
+
+private:
+  Tensor packed_;
+  TensorShape dense_shape_;
+};
+
+// param -= lr * grad, touching only the rows in grad.
+inline void SparseApplySGD(Tensor& param, const SparseTensor& grad,
+                           float lr) {
+  assert(param.GetTensorShape() == grad.DenseShape());
+  const int64_t row_size = grad.RowSize();
+  for (int64_t i = 0; i < grad.NumRows(); i++) {
+    const float* src = grad.Row(i);
+    float* dst = param.GetHandle() + grad.Index(i) * row_size;
+    for (int64_t j = 0; j < row_size; j++) {
+      dst[j] -= lr * src[j];
+    }
+  }
+}
+
+// Adagrad on the rows in grad: accum += g^2, param -= lr * g / sqrt(accum).
+// accum has param's shape, rows grad does not touch keep their state.
+inline void SparseApplyAdagrad(Tensor& param, Tensor& accum,
+                               const SparseTensor& grad, float lr,
+                               float epsilon = 1e-10) {
+  assert(param.GetTensorShape() == grad.DenseShape());
+  assert(accum.GetTensorShape() == grad.DenseShape());
+  // The squared gradient of a row must be taken over its summed entries.
+  SparseTensor rows = grad.Coalesce();
+  const int64_t row_size = rows.RowSize();
+  ThreadPool::Global()->ParallelFor(rows.NumRows(), [&](int64_t i) {
+    const float* g = rows.Row(i);
+    float* p = param.GetHandle() + rows.Index(i) * row_size;
+    float* a = accum.GetHandle() + rows.Index(i) * row_size;
+    for (int64_t j = 0; j < row_size; j++) {
+      a[j] += g[j] * g[j];
+      p[j] -= lr * g[j] / (std::sqrt(a[j]) + epsilon);
+    }
+  });
+}
+
+// A [rows, cols] matrix in compressed sparse row form: the nonzeros of row
+// r are Values()[RowPtr()[r], RowPtr()[r + 1]) in columns ColIdx()[...].
+// The three tensors feed SparseMatMul's row_ptr, col_idx and values inputs.
+class CsrTensor {
+public:
+  CsrTensor(const std::vector<float>& row_ptr,
+            const std::vector<float>& col_idx,
+            const std::vector<float>& values, int64_t cols)
+      : row_ptr_(TensorShape(row_ptr.size())),
+        col_idx_(TensorShape(col_idx.size())),
+        values_(TensorShape(values.size())), cols_(cols) {
+    assert(!row_ptr.empty() && col_idx.size() == values.size());
+    assert(static_cast<size_t>(row_ptr.back()) == values.size());
+    row_ptr_.SyncFromVector(row_ptr, row_ptr.size());
+    col_idx_.SyncFromVector(col_idx, col_idx.size());
+    values_.SyncFromVector(values, values.size());
+  }
+
+  // The nonzeros of x [rows, cols]. Throws std::length_error when the
+  // offsets or columns do not fit in floats, past kMaxFloatIndex.
+  static CsrTensor FromDense(const float* x, int64_t rows, int64_t cols) {
+    if (cols > kMaxFloatIndex) {
+      throw std::length_error("CSR matrix has more than 2^24 columns");
+    }
+    std::vector<float> row_ptr(1, 0);
+    std::vector<float> col_idx;
+    std::vector<float> values;
+    for (int64_t r = 0; r < rows; r++) {
+      for (int64_t c = 0; c < cols; c++) {
+        if (x[r * cols + c] == 0) continue;
+        col_idx.push_back(static_cast<float>(c));
+        values.push_back(x[r * cols + c]);
+      }
+      if (values.size() > static_cast<size_t>(kMaxFloatIndex)) {
+        throw std::length_error("CSR matrix has more than 2^24 nonzeros");
+      }
+      row_ptr.push_back(static_cast<float>(values.size()));
+    }
+    return CsrTensor(row_ptr, col_idx, values, cols);
+  }
+
+  const Tensor& RowPtr() const { return row_ptr_; }
+  const Tensor& ColIdx() const { return col_idx_; }
+  const Tensor& Values() const { return values_; }
+
+  int64_t Rows() const { return row_ptr_.NumElements() - 1; }
+  int64_t Cols() const { return cols_; }
+  int64_t NumNonzeros() const { return values_.NumElements(); }
+
+  Tensor ToDense() const {
+    Tensor dense(TensorShape(Rows(), cols_));
+    memset(dense.GetHandle(), 0, dense.NumElements() * sizeof(float));
+    const float* row_ptr = row_ptr_.GetHandle();
+    for (int64_t r = 0; r < Rows(); r++) {
+      for (int64_t k = static_cast<int64_t>(row_ptr[r]);
+           k < static_cast<int64_t>(row_ptr[r + 1]); k++) {
+        int64_t c = static_cast<int64_t>(col_idx_.GetHandle()[k]);
+        dense.GetHandle()[r * cols_ + c] = values_.GetHandle()[k];
+      }
+    }
+    return dense;
+  }
+
+private:
+  Tensor row_ptr_;
+  Tensor col_idx_;
+  Tensor values_;
+  int64_t cols_;
+};
+
+#endif  // SPARSE_TENSOR_H_
@@ -0,0 +1,135 @@
+#ifndef SPMM_H_
+#define SPMM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "simd.h"
+#include "thread_pool.h"
+
+// Products of a CSR matrix x [rows, cols] with dense row-major matrices. The
+// nonzeros of row r are values[row_ptr[r], row_ptr[r + 1]) in columns
+// col_idx[...]. Like the other index inputs of the graph, row_ptr and
+// col_idx hold integers as floats, so x can have at most kMaxFloatIndex
+// (2^24) nonzeros and columns.
+
+struct CsrMatrix {
+  const float* row_ptr;
+  const float* col_idx;
+  const float* values;
+  int64_t rows;
+  int64_t cols;
+
+  int64_t Begin(int64_t r) const { return static_cast<int64_t>(row_ptr[r]); }
+  int64_t Col(int64_t k) const { return static_cast<int64_t>(col_idx[k]); }
+  int64_t NumNonzeros() const { return Begin(rows); }
+};
+
+// Rows per task so a task does about kSpmmGrain multiply-adds.
+const int64_t kSpmmGrain = 1 << 15;
+
+inline int64_t SpmmRowGrain(int64_t rows, int64_t work) {
+  return std::max<int64_t>(1, rows * kSpmmGrain / std::max<int64_t>(work, 1));
+}
+
+// dst[0, n) = sum over k in [begin, end) of values[k] * src[index[k]],
+// where src rows are n wide. Blocks of 32 columns are summed in registers
+// across all k before they are stored.
+template <typename Index>
+inline void SparseRowCombine(const float* values, const Index* index,
+                             int64_t begin, int64_t end, const float* src,
+                             int64_t n, float* dst) {
+  int64_t j = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  for (; j + 32 <= n; j += 32) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    for (int64_t k = begin; k < end; k++) {
+      const float* row = src + static_cast<int64_t>(index[k]) * n + j;
+      __m256 v = _mm256_set1_ps(values[k]);
+      acc0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row), acc0);
+      acc1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 8), acc1);
+      acc2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 16), acc2);
+      acc3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 24), acc3);
+    }
+    _mm256_storeu_ps(dst + j, acc0);
+    _mm256_storeu_ps(dst + j + 8, acc1);
+    _mm256_storeu_ps(dst + j + 16, acc2);
+    _mm256_storeu_ps(dst + j + 24, acc3);
+  }
+#endif
+  if (j == n) return;
+  memset(dst + j, 0, (n - j) * sizeof(float));
+  for (int64_t k = begin; k < end; k++) {
+    SimdAxpy(dst + j, values[k], src + static_cast<int64_t>(index[k]) * n + j,
+             n - j);
+  }
+}
+
+// y [rows, n] = x * w, w is [cols, n]. Each row of y sums the rows of w its
+// nonzeros select, in order, so the result does not depend on the split.
+inline void CsrMatMul(const CsrMatrix& x, const float* w, int64_t n,
+                      float* y) {
+  ThreadPool::Global()->ParallelForRange(
+      x.rows, SpmmRowGrain(x.rows, (x.NumNonzeros() + x.rows) * n),
+      [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      SparseRowCombine(x.values, x.col_idx, x.Begin(r), x.Begin(r + 1), w,
+                       n, y + r * n);
+    }
+  });
+}
+
+// y [cols, n] = x^T * dy, dy is [rows, n]. The nonzeros are first grouped by
+// column, a counting sort that keeps row order, so each row of y is owned by
+// one task and sums in a fixed order.
+inline void CsrTransposeMatMul(const CsrMatrix& x, const float* dy, int64_t n,
+                               float* y) {
+  const int64_t nnz = x.NumNonzeros();
+  std::vector<int64_t> col_ptr(x.cols + 1, 0);
+  for (int64_t k = 0; k < nnz; k++) {
+    col_ptr[x.Col(k) + 1]++;
+  }
+  for (int64_t c = 0; c < x.cols; c++) {
+    col_ptr[c + 1] += col_ptr[c];
+  }
+  std::vector<int64_t> next(col_ptr.begin(), col_ptr.end() - 1);
+  std::vector<int64_t> entry_row(nnz);
+  std::vector<float> entry_value(nnz);
+  for (int64_t r = 0; r < x.rows; r++) {
+    for (int64_t k = x.Begin(r); k < x.Begin(r + 1); k++) {
+      int64_t pos = next[x.Col(k)]++;
+      entry_row[pos] = r;
+      entry_value[pos] = x.values[k];
+    }
+  }
+
+  ThreadPool::Global()->ParallelForRange(
+      x.cols, SpmmRowGrain(x.cols, (nnz + x.cols) * n),
+      [&](int64_t begin, int64_t end) {
+    for (int64_t c = begin; c < end; c++) {
+      SparseRowCombine(entry_value.data(), entry_row.data(), col_ptr[c],
+                       col_ptr[c + 1], dy, n, y + c * n);
+    }
+  });
+}
+
+// dvalues[k] = dy[r] . w[col_idx[k]] for each nonzero k of row r, the
+// gradient of x * w with respect to the values of x.
+inline void CsrMatMulValuesGrad(const CsrMatrix& x, const float* dy,
+                                const float* w, int64_t n, float* dvalues) {
+  ThreadPool::Global()->ParallelForRange(
+      x.rows, SpmmRowGrain(x.rows, (x.NumNonzeros() + x.rows) * n),
+      [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      for (int64_t k = x.Begin(r); k < x.Begin(r + 1); k++) {
+        dvalues[k] = SimdDot(dy + r * n, w + x.Col(k) * n, n);
+      }
+    }
+  });
+}
+
+#endif  // SPMM_H_
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "tensor.h"
 
 Tensor operator+(float val, const Tensor& rhs) {
@@ -7,3 +8,50 @@ Tensor operator+(float val, const Tensor& rhs) {
 Tensor operator*(float val, const Tensor& rhs) {
   return rhs * val;
 }
+
+template <typename From, typename To>
+static void CastElements(const Tensor& from, Tensor& to) {
+  const int64_t n = from.NumElements();
+  const From* src = from.GetData<From>();
+  To* dst = to.GetData<To>();
+  // Through float in blocks that stay in L1.
+  const int64_t kBlock = 1024;
+  float buffer[kBlock];
+  for (int64_t i = 0; i < n; i += kBlock) {
+    int64_t len = std::min(kBlock, n - i);
+    ConvertToFloat(src + i, len, buffer);
+    ConvertFromFloat(buffer, len, dst + i);
+  }
+}
+
+template <typename From>
+static void CastFrom(const Tensor& from, Tensor& to) {
+  switch (to.GetDataType()) {
+    case DataType::kFloat32:
+      CastElements<From, float>(from, to);
+      break;
+    case DataType::kBFloat16:
+      CastElements<From, BFloat16>(from, to);
+      break;
+    case DataType::kFloat16:
+      CastElements<From, Float16>(from, to);
+      break;
+  }
+}
+
+Tensor Tensor::Cast(DataType dtype) const {
+  if (dtype == dtype_) return *this;
+  Tensor result(shape_, ctx_, dtype);
+  switch (dtype_) {
+    case DataType::kFloat32:
+      CastFrom<float>(*this, result);
+      break;
+    case DataType::kBFloat16:
+      CastFrom<BFloat16>(*this, result);
+      break;
+    case DataType::kFloat16:
+      CastFrom<Float16>(*this, result);
+      break;
+  }
+  return result;
+}
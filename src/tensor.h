@@ -1,175 +1,270 @@
 #ifndef TENSOR_H_
 #define TENSOR_H_
 
+#include <cassert>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <vector>
 #include "context.h"
+#include "data_type.h"
+#include "device_api.h"
+#include "half.h"
 #include "tensor_shape.h"
 
 class Tensor {
 public:
   Tensor() 
       : shape_(TensorShape(0)) {
-    handle_ = new float[shape_.NumElements()];
+    Allocate();
   };
 
   Tensor(const TensorShape& shape) 
       : shape_(shape) {
-    handle_ = new float[shape_.NumElements()];
+    Allocate();
+  }
+
+  Tensor(const TensorShape& shape, const Context& ctx)
+      : shape_(shape), ctx_(ctx) {
+    Allocate();
+  }
+
+  // A tensor whose elements are stored as dtype. Only float tensors have a
+  // handle, the others are read through GetData.
+  Tensor(const TensorShape& shape, const Context& ctx, DataType dtype)
+      : shape_(shape), ctx_(ctx), dtype_(dtype) {
+    Allocate();
   }
 
   Tensor(const Tensor& tensor) 
-      : shape_(tensor.shape_) {
-    handle_ = new float[shape_.NumElements()];     
-    for (int i = 0; i < shape_.NumElements(); i++) {
-      handle_[i]= tensor.handle_[i];
-    }
+      : shape_(tensor.shape_), ctx_(tensor.ctx_), dtype_(tensor.dtype_) {
+    Allocate();
+    CopyFrom(tensor);
+  }
+
+  // Moves are noexcept so growing vectors move tensors instead of copying
+  // them, a copy of a view would copy its whole buffer.
+  Tensor(Tensor&& tensor) noexcept
+      : handle_(tensor.handle_), shape_(tensor.shape_), ctx_(tensor.ctx_),
+        dtype_(tensor.dtype_), owns_(tensor.owns_) {
+    tensor.handle_ = nullptr;
+    tensor.shape_ = TensorShape();
+    tensor.owns_ = true;
+  }
+
+  // A tensor sharing tensor's buffer without owning it, tensor must outlive
+  // it. Copies of a view, and views assigned to, are ordinary tensors.
+  static Tensor View(Tensor& tensor) {
+    return Tensor(tensor.handle_, tensor.shape_, tensor.ctx_, tensor.dtype_);
   }
 
+  // Copies tensor's elements into a buffer of this tensor's own, reused
+  // when it has the right size. A view is always detached first, so
+  // assignment never writes into the buffer of the tensor it aliased.
   Tensor& operator=(const Tensor& tensor) {
     if (this != &tensor) {
-      delete[] handle_;
-      shape_ = tensor.shape_;
-      handle_ = new float[shape_.NumElements()];
-      for (int i = 0; i < shape_.NumElements(); i++) {
-        handle_[i] = tensor.handle_[i];
+      if (!owns_ || NumBytes() != tensor.NumBytes()) {
+        Release();
+        shape_ = tensor.shape_;
+        dtype_ = tensor.dtype_;
+        Allocate();
+      } else {
+        shape_ = tensor.shape_;
+        dtype_ = tensor.dtype_;
       }
+      CopyFrom(tensor);
+    }
+    return *this;
+  }
+
+  Tensor& operator=(Tensor&& tensor) noexcept {
+    if (this != &tensor) {
+      Release();
+      handle_ = tensor.handle_;
+      shape_ = tensor.shape_;
+      ctx_ = tensor.ctx_;
+      dtype_ = tensor.dtype_;
+      owns_ = tensor.owns_;
+      tensor.handle_ = nullptr;
+      tensor.shape_ = TensorShape();
+      tensor.owns_ = true;
     }
     return *this;
   }
 
   ~Tensor() {
-    delete[] handle_;
+    Release();
   }
 
+  // Elementwise arithmetic reads both sides through handle_, so it is only
+  // defined for float tensors. Cast others to DataType::kFloat32 first.
   Tensor operator+(const Tensor& rhs) const {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] + rhs.handle_[i];
     }
     return result;
   }
 
   Tensor operator-(const Tensor& rhs) const {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] - rhs.handle_[i];
     }
     return result;
   }
 
   Tensor operator*(const Tensor& rhs) const {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] * rhs.handle_[i];
     }
     return result;
   }
 
   Tensor operator/(const Tensor& rhs) const {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] / rhs.handle_[i];
     }
     return result;
   }
 
   Tensor operator+(float val) const {
+    assert(dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] + val;
     }
     return result;
   }
 
   Tensor operator-(float val) const {
+    assert(dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] - val;
     }
     return result;
   }
 
   Tensor operator*(float val) const {
+    assert(dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] * val;
     }
     return result;
   }
 
   Tensor operator/(float val) const {
+    assert(dtype_ == DataType::kFloat32);
     Tensor result(shape_);
-    for (int i = 0; i < NumElements(); i++) {
+    for (int64_t i = 0; i < NumElements(); i++) {
       result.handle_[i] = handle_[i] / val;
     }
     return result;
   }
 
   Tensor& operator+=(const Tensor& rhs) {
-    for (int i = 0; i < NumElements(); i++) {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
+    for (int64_t i = 0; i < NumElements(); i++) {
       handle_[i] += rhs.handle_[i];
     }
     return *this;
   }
 
   Tensor& operator-=(const Tensor& rhs) {
-    for (int i = 0; i < NumElements(); i++) {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
+    for (int64_t i = 0; i < NumElements(); i++) {
       handle_[i] -= rhs.handle_[i];
     }
     return *this;
   }
 
   Tensor& operator*=(const Tensor& rhs) {
-    for (int i = 0; i < NumElements(); i++) {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
+    for (int64_t i = 0; i < NumElements(); i++) {
       handle_[i] *= rhs.handle_[i];
     }
     return *this;
   }
 
   Tensor& operator/=(const Tensor& rhs) {
-    for (int i = 0; i < NumElements(); i++) {
+    assert(dtype_ == DataType::kFloat32 && rhs.dtype_ == DataType::kFloat32);
+    for (int64_t i = 0; i < NumElements(); i++) {
       handle_[i] /= rhs.handle_[i];
     }
     return *this;
   }
 
   void SyncFromCPU(const float* data, size_t size) {
-    for (int i = 0; i < shape_.NumElements(); i++) {
-      handle_[i] = data[i];
-    } 
+    assert(dtype_ == DataType::kFloat32);
+    memcpy(handle_, data, shape_.NumElements() * sizeof(float));
   }
 
   void SyncFromVector(const std::vector<float>& data, size_t size) {
-    for (int i = 0; i < shape_.NumElements(); i++) {
-      handle_[i] = data[i];
-    } 
+    assert(dtype_ == DataType::kFloat32);
+    memcpy(handle_, data.data(), shape_.NumElements() * sizeof(float));
   }
 
   const TensorShape& GetTensorShape() const { return shape_; }
 
-  float* GetHandle() { return handle_; }
-  const float* GetHandle() const { return handle_; }
+  DataType GetDataType() const { return dtype_; }
+
+  float* GetHandle() {
+    assert(dtype_ == DataType::kFloat32);
+    return handle_;
+  }
 
-  int NumElements() const {
+  const float* GetHandle() const {
+    assert(dtype_ == DataType::kFloat32);
+    return handle_;
+  }
+
+  // The elements as T, which has to match the tensor's dtype.
+  template <typename T>
+  T* GetData() {
+    assert(DataTypeOf<T>::value == dtype_);
+    return reinterpret_cast<T*>(handle_);
+  }
+
+  template <typename T>
+  const T* GetData() const {
+    assert(DataTypeOf<T>::value == dtype_);
+    return reinterpret_cast<const T*>(handle_);
+  }
+
+  int64_t NumElements() const {
     return shape_.NumElements();
   }
 
+  size_t NumBytes() const {
+    return shape_.NumElements() * DataTypeSize(dtype_);
+  }
+
+  // A copy with its elements converted to dtype.
+  Tensor Cast(DataType dtype) const;
+
   // For 2 dims tensor and 1 dim tensor
   std::string Debug() const {
+    if (dtype_ != DataType::kFloat32) return Cast(DataType::kFloat32).Debug();
     std::stringstream ss;
     if (shape_.NumDims() == 2) {
-      int dim_a = shape_.DimSize(0);
-      int dim_b = shape_.DimSize(1);
-      for (int i = 0; i < dim_a; i++) {
-        for (int j = 0; j < dim_b; j++) {
+      int64_t dim_a = shape_.DimSize(0);
+      int64_t dim_b = shape_.DimSize(1);
+      for (int64_t i = 0; i < dim_a; i++) {
+        for (int64_t j = 0; j < dim_b; j++) {
           ss << handle_[dim_b * i + j] << " ";
         }
       } 
     } else {
-      for (int i = 0; i < shape_.DimSize(0); i++) {
+      for (int64_t i = 0; i < shape_.DimSize(0); i++) {
         ss << handle_[i] << " ";
       }
     }
@@ -177,8 +272,33 @@ public:
   }
 
  private:
+  Tensor(float* handle, const TensorShape& shape, const Context& ctx,
+         DataType dtype)
+      : handle_(handle), shape_(shape), ctx_(ctx), dtype_(dtype),
+        owns_(false) {
+  }
+
+  void Allocate() {
+    handle_ = static_cast<float*>(CPUDeviceAPI::Global()->Allocate(
+        ctx_, NumBytes(), CachingAllocator::kAlignment));
+    owns_ = true;
+  }
+
+  void Release() {
+    if (owns_) CPUDeviceAPI::Global()->Free(ctx_, handle_);
+    handle_ = nullptr;
+  }
+
+  void CopyFrom(const Tensor& tensor) {
+    CPUDeviceAPI::Global()->Copy(handle_, ctx_, tensor.handle_, tensor.ctx_,
+                                 NumBytes());
+  }
+
   float* handle_;
   TensorShape shape_;
+  Context ctx_;
+  DataType dtype_ = DataType::kFloat32;
+  bool owns_ = true;
 };
 
 
@@ -1,71 +1,49 @@
 #ifndef TENSOR_SHAPE_
 #define TENSOR_SHAPE_
 
+#include <cassert>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 
+// Dims are stored inline, so shapes are trivially copyable and never touch
+// the heap. The element count is kept up to date as dims are appended.
 class TensorShape {
 public:
-  TensorShape()
-      : num_dims_(0) {
-  }
-
-  explicit TensorShape(int x) 
-      : num_dims_(1) {
-    dim_size_ = new int;
-    dim_size_[0] = x;
-  }
-
-  TensorShape(int x, int y) 
-      : num_dims_(2) {
-    dim_size_ = new int[2];
-    dim_size_[0] = x;
-    dim_size_[1] =y;
-  }
+  static const int kMaxDims = 8;
 
-  TensorShape(int x, int y, int z)
-      : num_dims_(3) {
-    dim_size_ = new int[3];
-    dim_size_[0] = x;
-    dim_size_[1] = y;
-    dim_size_[2] = x;
+  TensorShape()
+      : num_dims_(0), num_elements_(0) {
   }
 
-  TensorShape(const TensorShape& shape) 
-      : num_dims_(shape.num_dims_) {
-    dim_size_ = new int[num_dims_];
-    for (int i = 0; i < num_dims_; i++) {
-      dim_size_[i] = shape.dim_size_[i];
-    }
+  explicit TensorShape(int64_t x)
+      : num_dims_(0), num_elements_(0) {
+    AppendDim(x);
   }
 
-  TensorShape& operator=(const TensorShape& shape) {
-    if (this != &shape) {
-      delete[] dim_size_;
-      num_dims_ = shape.num_dims_;
-      dim_size_ = new int[num_dims_];
-      for (int i = 0; i < num_dims_; i++) {
-        dim_size_[i] = shape.dim_size_[i];
-      }
-    }
-    return *this;
+  TensorShape(int64_t x, int64_t y)
+      : num_dims_(0), num_elements_(0) {
+    AppendDim(x);
+    AppendDim(y);
   }
 
-  TensorShape(TensorShape&& shape) 
-      : num_dims_(shape.num_dims_), dim_size_(shape.dim_size_) {
-    shape.dim_size_ = nullptr;
+  TensorShape(int64_t x, int64_t y, int64_t z)
+      : num_dims_(0), num_elements_(0) {
+    AppendDim(x);
+    AppendDim(y);
+    AppendDim(z);
   }
 
-  TensorShape& operator=(TensorShape&& shape) {
-    if (this != &shape) {
-      num_dims_ = shape.num_dims_;
-      dim_size_ = shape.dim_size_;
-      shape.dim_size_ = nullptr;
-    } 
-    return *this;
+  TensorShape(int64_t n, int64_t x, int64_t y, int64_t z)
+      : num_dims_(0), num_elements_(0) {
+    AppendDim(n);
+    AppendDim(x);
+    AppendDim(y);
+    AppendDim(z);
   }
 
-  bool operator==(const TensorShape& rhs) {
+  bool operator==(const TensorShape& rhs) const {
     if (num_dims_ != rhs.num_dims_) {
       return false;
     } else {
@@ -78,57 +56,67 @@ public:
     return true;
   }
 
-  bool operator!=(const TensorShape& rhs) {
+  bool operator!=(const TensorShape& rhs) const {
     return !(*this == rhs);
   }
 
-  ~TensorShape() {
-    delete[] dim_size_;  
-  }
-
-  void AppendDim(int dim) {
-    // TODO
-    if (num_dims_ == 0) {
-      dim_size_ = new int[3];      
-    }
+  void AppendDim(int64_t dim) {
+    assert(num_dims_ < kMaxDims);
     dim_size_[num_dims_++] = dim;
+    num_elements_ = num_dims_ == 1 ? dim : num_elements_ * dim;
   }
 
-  int NumDims() const { 
-    return num_dims_; 
+  int NumDims() const {
+    return num_dims_;
   }
 
-  int DimSize(int d) const { 
+  int64_t DimSize(int d) const {
     if (d >= num_dims_) {
       return -1;
     } else {
       return dim_size_[d];
     }
-  } 
-  
-  int NumElements() const {
-    if (num_dims_ == 0) return 0;
+  }
+
+  // A shape without dims has no elements.
+  int64_t NumElements() const {
+    return num_elements_;
+  }
 
-    int num_elements = 1;
+  size_t Hash() const {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ num_dims_;
     for (int i = 0; i < num_dims_; i++) {
-      num_elements *= dim_size_[i]; 
-    } 
-    return num_elements;
+      h ^= static_cast<uint64_t>(dim_size_[i]) + 0x9e3779b97f4a7c15ULL +
+           (h << 6) + (h >> 2);
+    }
+    return h;
   }
 
   std::string DebugString() const {
     std::string shape_str = "[";
     for (int i = 0; i < num_dims_; i++) {
-      shape_str += (std::to_string(dim_size_[i]) + ",");
+      if (i != 0) shape_str += ",";
+      shape_str += std::to_string(dim_size_[i]);
     }
-    shape_str.resize(shape_str.size() - 1);
     shape_str += "]";
     return shape_str;
   }
 
 private:
   int num_dims_;
-  int* dim_size_;
+  int64_t num_elements_;
+  int64_t dim_size_[kMaxDims];
+};
+
+namespace std {
+
+template <>
+struct hash<TensorShape> {
+  size_t operator()(const TensorShape& shape) const {
+    return shape.Hash();
+  }
 };
 
+}
+
 #endif
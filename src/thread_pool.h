@@ -0,0 +1,207 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cpu_allocator.h"
+#include "numa.h"
+
+// ThreadPool runs ParallelFor loops on a fixed set of workers, the calling
+// thread takes part in every loop. Kernels that need deterministic results
+// should split their work into tasks by problem size only, never by
+// NumThreads(), and combine partial results in task order.
+//
+// Workers are spread over the NUMA nodes in equal runs. Each is pinned to
+// the CPUs of its node and binds its large allocations there, so the
+// buffers a worker allocates are local to it. DLSYS_NUMA=0 turns this off
+// along with the allocator's node binding.
+class ThreadPool {
+public:
+  // Sized by DLSYS_NUM_THREADS, or the number of hardware threads.
+  static ThreadPool* Global() {
+    static ThreadPool* pool = new ThreadPool(DefaultNumThreads());
+    return pool;
+  }
+
+  explicit ThreadPool(int num_threads)
+      : num_threads_(num_threads < 1 ? 1 : num_threads),
+        generation_(0),
+        stop_(false),
+        fn_(nullptr),
+        num_tasks_(0),
+        next_task_(0),
+        num_pending_(0) {
+    for (int i = 1; i < num_threads_; i++) {
+      workers_.emplace_back([this, i] { WorkerLoop(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // The most tasks of one ParallelFor.
+  static constexpr int64_t kMaxTasks = (int64_t(1) << 32) - 1;
+
+  int NumThreads() const { return num_threads_; }
+
+  // Calls fn(i) for every i in [0, num_tasks) and returns once all are done.
+  // Nested calls from inside a task run serially on the calling thread.
+  void ParallelFor(int64_t num_tasks, const std::function<void(int64_t)>& fn) {
+    if (num_tasks <= 0) return;
+    if (num_tasks == 1 || num_threads_ == 1 || InParallel()) {
+      for (int64_t i = 0; i < num_tasks; i++) fn(i);
+      return;
+    }
+
+    assert(num_tasks <= kMaxTasks);
+    std::lock_guard<std::mutex> submit_lock(submit_mu_);
+    uint32_t generation;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      generation = static_cast<uint32_t>(++generation_);
+      fn_ = &fn;
+      num_tasks_ = num_tasks;
+      num_pending_ = num_tasks;
+      next_task_ = static_cast<uint64_t>(generation) << 32;
+    }
+    work_cv_.notify_all();
+
+    RunTasks(generation, &fn, num_tasks);
+
+    std::unique_lock<std::mutex> lock(mu_);
+    done_cv_.wait(lock, [this] { return num_pending_ == 0; });
+    fn_ = nullptr;
+  }
+
+  // Splits [0, n) into ranges of at least grain elements and calls
+  // fn(begin, end) for each of them. The split only depends on n and grain.
+  void ParallelForRange(int64_t n, int64_t grain,
+                        const std::function<void(int64_t, int64_t)>& fn) {
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+    int64_t num_tasks = (n + grain - 1) / grain;
+    ParallelFor(num_tasks, [&](int64_t task) {
+      int64_t begin = task * grain;
+      int64_t end = std::min(n, begin + grain);
+      fn(begin, end);
+    });
+  }
+
+private:
+  static int DefaultNumThreads() {
+    const char* env = getenv("DLSYS_NUM_THREADS");
+    if (env != nullptr && atoi(env) > 0) return atoi(env);
+    int num_threads = std::thread::hardware_concurrency();
+    return num_threads > 0 ? num_threads : 1;
+  }
+
+  static bool& InParallel() {
+    static thread_local bool in_parallel = false;
+    return in_parallel;
+  }
+
+  // Claims the next task of loop generation. Fails once all of its tasks
+  // are claimed or a later loop has started, so a worker that read a loop's
+  // fn never runs it for another loop, nor after ParallelFor returned.
+  bool ClaimTask(uint32_t generation, int64_t num_tasks, int64_t* task) {
+    uint64_t ticket = next_task_.load();
+    while (true) {
+      if (static_cast<uint32_t>(ticket >> 32) != generation) return false;
+      int64_t index = static_cast<int64_t>(ticket & 0xffffffff);
+      if (index >= num_tasks) return false;
+      if (next_task_.compare_exchange_weak(ticket, ticket + 1)) {
+        *task = index;
+        return true;
+      }
+    }
+  }
+
+  void RunTasks(uint32_t generation, const std::function<void(int64_t)>* fn,
+                int64_t num_tasks) {
+    InParallel() = true;
+    int64_t done = 0;
+    int64_t task;
+    while (ClaimTask(generation, num_tasks, &task)) {
+      (*fn)(task);
+      done++;
+    }
+    InParallel() = false;
+
+    if (done > 0) {
+      std::lock_guard<std::mutex> lock(mu_);
+      num_pending_ -= done;
+      if (num_pending_ == 0) done_cv_.notify_all();
+    }
+  }
+
+  // Pins worker thread to its node and sends its large allocations there.
+  // The calling thread, index 0, is left where it is.
+  void PlaceWorker(int thread) {
+    if (!CachingAllocator::Global()->IsNumaAware()) return;
+    const NumaTopology& topology = NumaTopology::Get();
+    int node = topology.NodeOfThread(thread, num_threads_);
+    if (topology.PinThread(node)) {
+      CachingAllocator::SetThreadNumaNode(topology.NodeId(node));
+    }
+  }
+
+  void WorkerLoop(int thread) {
+    PlaceWorker(thread);
+    int64_t seen_generation = 0;
+    while (true) {
+      uint32_t generation;
+      const std::function<void(int64_t)>* fn;
+      int64_t num_tasks;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        work_cv_.wait(lock, [&] {
+          return stop_ || generation_ != seen_generation;
+        });
+        if (stop_) return;
+        seen_generation = generation_;
+        if (fn_ == nullptr) continue;
+        // The loop is taken as a whole under mu_, a later one cannot mix in.
+        generation = static_cast<uint32_t>(generation_);
+        fn = fn_;
+        num_tasks = num_tasks_;
+      }
+      RunTasks(generation, fn, num_tasks);
+    }
+  }
+
+  const int num_threads_;
+  std::vector<std::thread> workers_;
+
+  std::mutex submit_mu_;
+  std::mutex mu_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  int64_t generation_;
+  bool stop_;
+
+  // The loop in flight, written under mu_.
+  const std::function<void(int64_t)>* fn_;
+  int64_t num_tasks_;
+  // The loop's generation in the high 32 bits and its next unclaimed task
+  // in the low 32 bits, so claims from an earlier loop fail.
+  std::atomic<uint64_t> next_task_;
+  int64_t num_pending_;
+};
+
+#endif  // THREAD_POOL_H_